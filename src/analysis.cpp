@@ -0,0 +1,491 @@
+#include "analysis.hpp"
+#include "octree.hpp"
+#include "cursor.hpp"
+#include "checkpoint.hpp"
+
+#include <cstring>
+#include <ostream>
+
+using stinkhorn::Stinkhorn;
+
+namespace {
+	//Beyond this many distinct IP states, the analysis gives up. Folding
+	//constants means that some loops never repeat a state exactly.
+	const std::size_t MaxStates = 1 << 16;
+
+	template<class CellT>
+	bool isBefunge93Instruction(CellT c) {
+		static char const instructions[] = "0123456789+-*/%!`><^v?_|\":\\$.,#gp&~@";
+		return c > 0 && c < 128 && std::strchr(instructions, static_cast<char>(c));
+	}
+}
+
+template<class CellT, int Dimensions>
+Stinkhorn<CellT, Dimensions>::Analysis::Analysis(Tree& tree) :
+	m_tree(tree),
+	m_walker(tree),
+	m_complete(false)
+{
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::analyse(bool befunge93) {
+	m_tree.get_minmax(m_min, m_max);
+	m_tree.code_modified = false;
+	m_complete = true;
+
+	//The IP starts by executing whatever is at the origin.
+	State origin(Vector(0, 0, 0), Vector(1, 0, 0));
+	markPath(origin.position, origin.position, origin.direction);
+	m_pending.push_back(origin);
+
+	while(!m_pending.empty()) {
+		State state = m_pending.back();
+		m_pending.pop_back();
+
+		if(!m_seen.insert(state).second)
+			continue;
+
+		if(m_seen.size() > MaxStates) {
+			hazard(state.position, "too many paths to follow", true);
+			break;
+		}
+
+		step(state, befunge93);
+	}
+
+	m_pending.clear();
+	m_seen.clear();
+
+	//Only now is it known which pages hold code.
+	for(typename std::vector<Access>::const_iterator a = m_accesses.begin(); a != m_accesses.end(); ++a) {
+		mark(a->target >> PageT::bits, PageT::Usage::data);
+
+		if(a->put && (usage(a->target) & PageT::Usage::code))
+			hazard(a->position, "p writes onto a page holding code", false);
+	}
+
+	m_accesses.clear();
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::adopt(Analysis const& other) {
+	m_complete = other.m_complete;
+	m_min = other.m_min;
+	m_max = other.m_max;
+	m_pages = other.m_pages;
+	m_hazards = other.m_hazards;
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::save(CheckpointWriter& out) const {
+	out.flag(m_complete);
+	out.vector(m_min);
+	out.vector(m_max);
+
+	out.count(m_pages.size());
+	for(typename std::vector<Vector>::const_iterator p = m_pages.begin(); p != m_pages.end(); ++p)
+		out.vector(*p);
+
+	out.count(m_hazards.size());
+	for(typename std::vector<Hazard>::const_iterator h = m_hazards.begin(); h != m_hazards.end(); ++h) {
+		out.vector(h->position);
+		out.string(h->description);
+		out.flag(h->incomplete);
+	}
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::restore(CheckpointReader& in) {
+	m_complete = in.flag();
+	in.vector(m_min);
+	in.vector(m_max);
+
+	m_pages.resize(static_cast<std::size_t>(in.count(Dimensions)));
+	for(typename std::vector<Vector>::iterator p = m_pages.begin(); p != m_pages.end(); ++p)
+		in.vector(*p);
+
+	m_hazards.clear();
+	for(uint64 n = in.count(); n; --n) {
+		Vector position;
+		in.vector(position);
+		std::string description = in.string();
+		m_hazards.push_back(Hazard(position, description, in.flag()));
+	}
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::step(State state, bool befunge93) {
+	Vector const here = state.position, d = state.direction;
+	CellT c = m_tree.get(here);
+
+	//Befunge-93 ignores everything else.
+	if(befunge93 && !isBefunge93Instruction(c))
+		c = ' ';
+
+	switch(c) {
+		case '@':
+		case 'q':
+			return;
+
+		case '>': state.direction = Vector(1, 0, 0); break;
+		case '<': state.direction = Vector(-1, 0, 0); break;
+		case 'v': state.direction = Vector(0, 1, 0); break;
+		case '^': state.direction = Vector(0, -1, 0); break;
+
+		case '[': state.direction = Vector(d.y, -d.x, 0); break;
+		case ']': state.direction = Vector(-d.y, d.x, 0); break;
+		case 'r': state.direction = -d; break;
+
+		case '?':
+			for(int axis = 0; axis < Dimensions; ++axis) {
+				for(CellT sign = -1; sign <= 1; sign += 2) {
+					state.direction = Vector(axis == 0 ? sign : 0, axis == 1 ? sign : 0, axis == 2 ? sign : 0);
+					follow(state, here);
+				}
+			}
+			return;
+
+		case '_':
+		case '|':
+		case 'm':
+			{
+				if(c == 'm' && Dimensions == 2) {
+					state.direction = -d;
+					break;
+				}
+
+				Vector const forwards(c == '_' ? 1 : 0, c == '|' ? 1 : 0, c == 'm' ? 1 : 0);
+				bool known = state.known > 0;
+				CellT test = state.pop();
+
+				if(!known || !test) {
+					state.direction = forwards;
+					follow(state, here);
+				}
+				if(!known || test) {
+					state.direction = -forwards;
+					follow(state, here);
+				}
+				return;
+			}
+
+		case 'h':
+		case 'l':
+			state.direction = Dimensions == 2 ? -d : Vector(0, 0, c == 'h' ? 1 : -1);
+			break;
+
+		case 'w':
+			{
+				bool known = state.known >= 2;
+				CellT b = state.pop(), a = state.pop();
+
+				if(!known || a == b)
+					follow(state, here);
+				if(!known || a > b) {
+					state.direction = Vector(-d.y, d.x, 0);
+					follow(state, here);
+				}
+				if(!known || a < b) {
+					state.direction = Vector(d.y, -d.x, 0);
+					follow(state, here);
+				}
+				return;
+			}
+
+		case '#':
+			state.position = here + d;
+			break;
+
+		case ';':
+			m_walker.position(here);
+			m_walker.direction(d);
+			m_walker.teleport();
+			state.position = m_walker.position();
+			break;
+
+		case '"':
+			followString(state);
+			return;
+
+		case 'j':
+			{
+				if(state.known == 0) {
+					hazard(here, "j jumps a computed distance", true);
+					return;
+				}
+
+				Vector const landing = here + d * state.pop();
+				if(!inside(landing, m_min, m_max + Vector(1, 1, 1))) {
+					hazard(here, "j jumps out of funge-space", true);
+					return;
+				}
+
+				state.position = landing;
+				follow(state, landing);
+				return;
+			}
+
+		case 'k':
+			hazard(here, "k repeats an instruction", true);
+			return;
+
+		case 'x':
+			hazard(here, "x sets a computed delta", true);
+			return;
+
+		case 'i':
+			hazard(here, "i loads a file into funge-space", true);
+			return;
+
+		case '(':
+		case ')':
+			hazard(here, "fingerprints change what the instructions do", true);
+			return;
+
+		case '\'':
+			state.position = here + d;
+			state.push(m_tree.get(state.position));
+			break;
+
+		case 's':
+			{
+				m_walker.position(here);
+				m_walker.direction(d);
+				if(!m_walker.advance())
+					return;
+
+				hazard(here, "s writes onto the next instruction", false);
+				state.position = m_walker.position();
+				state.pop();
+				markPath(here, state.position, d);
+				follow(state, state.position);
+				return;
+			}
+
+		case 't':
+			{
+				//The new IP sets off backwards from here.
+				State child = state;
+				child.direction = -d;
+				follow(child, here);
+				break;
+			}
+
+		case '{':
+		case '}':
+		case 'u':
+			state.known = 0;
+			state.offset_moved = state.offset_moved || c != 'u';
+			if(c != '{') {
+				//These reflect if there is no SOSS.
+				State reflected = state;
+				reflected.direction = -d;
+				follow(reflected, here);
+			}
+			break;
+
+		case '&':
+		case '~':
+		case '=':
+		case 'o':
+			{
+				//These reflect when they fail (at the end of input, in the sandbox...)
+				state.known = 0;
+				State reflected = state;
+				reflected.direction = -d;
+				follow(reflected, here);
+				break;
+			}
+
+		case 'g':
+		case 'p':
+			if(state.known >= 2 && !state.offset_moved) {
+				CellT y = state.pop(), x = state.pop();
+				m_accesses.push_back(Access(here, Vector(x, y, 0), c == 'p'));
+			} else if(c == 'p') {
+				hazard(here, "p writes to a computed cell", false);
+			}
+			state.known = 0;
+			break;
+
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			state.push(c - '0');
+			break;
+
+		case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
+			state.push(c - 'a' + 10);
+			break;
+
+		case '+':
+		case '-':
+		case '*':
+			if(state.known >= 2) {
+				CellT b = state.pop(), a = state.pop();
+				state.push(c == '+' ? a + b : c == '-' ? a - b : a * b);
+			} else {
+				state.known = 0;
+			}
+			break;
+
+		case ':':
+			if(state.known)
+				state.push(state.top());
+			break;
+
+		case '\\':
+			if(state.known >= 2) {
+				CellT b = state.pop(), a = state.pop();
+				state.push(b);
+				state.push(a);
+			} else {
+				state.known = 0;
+			}
+			break;
+
+		case '$':
+			state.pop();
+			break;
+
+		case ' ':
+		case 'z':
+			break;
+
+		default:
+			//Unloaded fingerprint instructions reflect. Anything else that gets
+			//here only does something to the stack.
+			if(c >= 'A' && c <= 'Z')
+				state.direction = -d;
+			state.known = 0;
+			break;
+	}
+
+	follow(state, here);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::follow(State state, Vector const& from) {
+	m_walker.position(state.position);
+	m_walker.direction(state.direction);
+
+	//The IP would spin forever in empty space, which is harmless.
+	if(!m_walker.advance())
+		return;
+
+	markPath(from, m_walker.position(), state.direction);
+	state.position = m_walker.position();
+	m_pending.push_back(state);
+}
+
+//The string runs up to the next " along the path, which may be the opening one
+//again if the string wraps all the way round.
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::followString(State state) {
+	m_walker.position(state.position);
+	m_walker.direction(state.direction);
+
+	do {
+		if(!m_walker.advance(false))
+			return;
+	} while(m_walker.currentCharacter() != '\"');
+
+	markPath(state.position, m_walker.position(), state.direction);
+	state.position = m_walker.position();
+	state.known = 0;
+	follow(state, state.position);
+}
+
+//Marks each page from from to to, going the way the IP does, and wrapping at the
+//edges of funge-space as it does.
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::markPath(Vector const& from, Vector const& to, Vector const& direction) {
+	Vector pos = from, page_address = from >> PageT::bits;
+	mark(page_address, PageT::Usage::code);
+
+	Vector const extent = m_max - m_min;
+	CellT limit = extent.x + extent.y + getZ(extent) + 2;
+
+	while(pos != to && limit-- > 0) {
+		pos += direction;
+
+		if(pos.x > m_max.x) pos.x = m_min.x;
+		if(pos.x < m_min.x) pos.x = m_max.x;
+		if(pos.y > m_max.y) pos.y = m_min.y;
+		if(pos.y < m_min.y) pos.y = m_max.y;
+		if(getZ(pos) > getZ(m_max)) setZ(pos, getZ(m_min));
+		if(getZ(pos) < getZ(m_min)) setZ(pos, getZ(m_max));
+
+		if(pos >> PageT::bits != page_address) {
+			page_address = pos >> PageT::bits;
+			mark(page_address, PageT::Usage::code);
+		}
+	}
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::mark(Vector const& page_address, unsigned char usage) {
+	//Code pages are created even if they're empty, so that writing to one is noticed.
+	PageT* page = m_tree.find(page_address, true);
+	assert(page);
+
+	if(!page->usage)
+		m_pages.push_back(page_address);
+	page->usage |= usage;
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::hazard(Vector const& position, std::string const& description, bool incomplete) {
+	if(incomplete)
+		m_complete = false;
+
+	for(typename std::vector<Hazard>::const_iterator h = m_hazards.begin(); h != m_hazards.end(); ++h)
+		if(h->position == position && h->description == description)
+			return;
+
+	m_hazards.push_back(Hazard(position, description, incomplete));
+}
+
+template<class CellT, int Dimensions>
+bool Stinkhorn<CellT, Dimensions>::Analysis::current() {
+	if(!m_complete || m_tree.code_modified)
+		return false;
+
+	Vector min, max;
+	m_tree.get_minmax(min, max);
+	return min == m_min && max == m_max;
+}
+
+template<class CellT, int Dimensions>
+bool Stinkhorn<CellT, Dimensions>::Analysis::unreachable(Vector const& cell) {
+	return current() && !(usage(cell) & PageT::Usage::code);
+}
+
+template<class CellT, int Dimensions>
+unsigned char Stinkhorn<CellT, Dimensions>::Analysis::usage(Vector const& cell) {
+	PageT* page = m_tree.find(cell >> PageT::bits);
+	return page ? page->usage : 0;
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Analysis::report(std::ostream& os) {
+	os << "Pages (" << PageT::size << " cells wide, listed by their first cell):\n";
+	for(typename std::vector<Vector>::const_iterator p = m_pages.begin(); p != m_pages.end(); ++p) {
+		unsigned char u = usage(*p * PageT::size);
+		os << "  " << (*p * PageT::size) << ": "
+			<< (u & PageT::Usage::code ? (u & PageT::Usage::data ? "code and data" : "code") : "data") << "\n";
+	}
+
+	os << "Hazards:\n";
+	if(m_hazards.empty())
+		os << "  none\n";
+	for(typename std::vector<Hazard>::const_iterator h = m_hazards.begin(); h != m_hazards.end(); ++h)
+		os << "  " << h->position << ": " << h->description << (h->incomplete ? " (not followed)" : "") << "\n";
+
+	if(m_complete)
+		os << "Every path from the origin was followed.\n";
+	else
+		os << "Some paths could not be followed, so IPs may execute pages not listed as code.\n";
+}
+
+INSTANTIATE(class, Analysis);
@@ -0,0 +1,167 @@
+#ifndef B98_ANALYSIS_HPP_INCLUDED
+#define B98_ANALYSIS_HPP_INCLUDED
+
+#include "stinkhorn.hpp"
+#include "vector.hpp"
+
+#include <algorithm>
+#include <iosfwd>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+
+namespace stinkhorn {
+	/**
+	 * Before the program starts, follows every path an IP could take from the
+	 * origin: through arrows, _ | ? w [ ], #, ;, j with a constant distance,
+	 * string mode and wrapping. Each page the paths cross is marked as code, and
+	 * each page that a g or p with constant coordinates reads or writes is marked
+	 * as data (see TreePage::Usage).
+	 *
+	 * Some instructions (x, k, j with a computed distance, i, and loading
+	 * fingerprints) could send the IP somewhere the analysis can't follow, so it
+	 * is then incomplete, and only good for a report. Otherwise, the IP can't
+	 * leave the pages marked as code until one of them is written to, or
+	 * funge-space grows and wraps differently; until then, a p to any other page
+	 * can't change what the program does next.
+	 **/
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::Analysis
+		: boost::noncopyable
+	{
+		typedef TreePage PageT;
+
+	public:
+		struct Hazard {
+			Vector position;
+			std::string description;
+			bool incomplete; ///<the IP could go somewhere the analysis didn't follow
+
+			Hazard(Vector const& position, std::string const& description, bool incomplete) :
+				position(position), description(description), incomplete(incomplete)
+			{}
+		};
+
+		Analysis(Tree& tree);
+
+		//Follows the program loaded into funge-space, marking its pages.
+		void analyse(bool befunge93);
+
+		//Takes on what other found, for a tree that has borrowed the pages of
+		//other's (see ProgramImage), where the marks already are.
+		void adopt(Analysis const& other);
+
+		//Writes what the analysis found into a funge-space image (see
+		//MappedImage), and reads it back, in place of analysing again, for a
+		//tree that has mapped the image's pages.
+		void save(CheckpointWriter& out) const;
+		void restore(CheckpointReader& in);
+
+		//True if the analysis has run and found nothing it couldn't follow.
+		bool complete() const {
+			return m_complete;
+		}
+
+		//True while the pages marked as code are still the only ones an IP can
+		//reach: the analysis was complete, none of them has been written to, and
+		//funge-space hasn't grown.
+		bool current();
+
+		//True if the analysis is current and no IP can reach the cell, so writing
+		//to it can't change the path of any IP.
+		bool unreachable(Vector const& cell);
+
+		//The TreePage::Usage of the page holding the cell.
+		unsigned char usage(Vector const& cell);
+
+		std::vector<Hazard> const& hazards() const {
+			return m_hazards;
+		}
+
+		//Lists the pages marked and the hazards found, for --analyze.
+		void report(std::ostream& os);
+
+	private:
+		//Where an IP can be, and what it knows about its stack: the constants it has
+		//just pushed (for j, g and p), and whether { or } has moved its storage offset.
+		struct State {
+			static const int Depth = 4;
+
+			Vector position, direction;
+			CellT constants[Depth]; ///<the top of the stack is constants[Depth - 1]
+			int known;
+			bool offset_moved;
+
+			State(Vector const& position, Vector const& direction) :
+				position(position), direction(direction), known(0), offset_moved(false)
+			{
+				std::fill(constants, constants + Depth, CellT());
+			}
+
+			CellT top() const {
+				return constants[Depth - 1];
+			}
+
+			void push(CellT c) {
+				std::copy(constants + 1, constants + Depth, constants);
+				constants[Depth - 1] = c;
+				known = std::min(known + 1, Depth);
+			}
+
+			CellT pop() {
+				CellT c = constants[Depth - 1];
+				std::copy_backward(constants, constants + Depth - 1, constants + Depth);
+				known = std::max(known - 1, 0);
+				return c;
+			}
+
+			bool operator<(State const& rhs) const {
+				CellT const lhs_key[] = { position.x, position.y, getZ(position), direction.x, direction.y, getZ(direction), known, offset_moved },
+					rhs_key[] = { rhs.position.x, rhs.position.y, getZ(rhs.position), rhs.direction.x, rhs.direction.y, getZ(rhs.direction), rhs.known, rhs.offset_moved };
+				if(std::lexicographical_compare(lhs_key, lhs_key + 8, rhs_key, rhs_key + 8))
+					return true;
+				if(std::lexicographical_compare(rhs_key, rhs_key + 8, lhs_key, lhs_key + 8))
+					return false;
+				return std::lexicographical_compare(constants, constants + Depth, rhs.constants, rhs.constants + Depth);
+			}
+		};
+
+		//A g or p with constant coordinates, checked once every path is known.
+		struct Access {
+			Vector position, target;
+			bool put;
+
+			Access(Vector const& position, Vector const& target, bool put) :
+				position(position), target(target), put(put)
+			{}
+		};
+
+		//Executes the instruction under the state's position, queueing the states
+		//the IP can be in at its next instruction.
+		void step(State state, bool befunge93);
+
+		//Moves on from state.position as the IP would after executing an
+		//instruction, marking the cells passed since from as code.
+		void follow(State state, Vector const& from);
+
+		void followString(State state);
+		void markPath(Vector const& from, Vector const& to, Vector const& direction);
+		void mark(Vector const& page_address, unsigned char usage);
+		void hazard(Vector const& position, std::string const& description, bool incomplete);
+
+		Tree& m_tree;
+		Cursor m_walker;
+		bool m_complete;
+		Vector m_min, m_max;
+
+		std::vector<State> m_pending;
+		std::set<State> m_seen;
+		std::vector<Access> m_accesses;
+		std::vector<Vector> m_pages;
+		std::vector<Hazard> m_hazards;
+	};
+}
+
+#endif
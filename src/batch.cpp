@@ -0,0 +1,285 @@
+#include "config.hpp"
+#include "batch.hpp"
+#include "interpreter.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/cstdint.hpp"
+
+#ifdef B98_WINDOWS
+#	include <windows.h>
+#	include "boost/date_time/posix_time/posix_time_types.hpp"
+#else
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <dirent.h>
+#	include <time.h>
+#endif
+
+using std::string;
+using std::vector;
+using std::runtime_error;
+
+namespace stinkhorn {
+	namespace {
+		struct Job {
+			string source, input, output;
+		};
+
+		//Microseconds since some fixed point, from a clock that doesn't go back
+		//where there is one. Timed in 64 bits, since a job can outrun what a
+		//32-bit cell of microseconds (as HRTI counts) holds in about 36 minutes.
+		boost::int64_t microseconds() {
+#ifdef B98_WINDOWS
+			using namespace boost::posix_time;
+			static ptime const start = microsec_clock::universal_time();
+			return (microsec_clock::universal_time() - start).total_microseconds();
+#else
+			timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			return boost::int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#endif
+		}
+
+		bool exists(string const& path) {
+			std::ifstream file(path.c_str());
+			return file.good();
+		}
+
+		bool isDirectory(string const& path) {
+#ifdef B98_WINDOWS
+			DWORD attributes = GetFileAttributesA(path.c_str());
+			return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+			struct stat info;
+			return ::stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+		}
+
+		//The file names in a directory, in no particular order.
+		void listDirectory(string const& directory, vector<string>& names) {
+#ifdef B98_WINDOWS
+			WIN32_FIND_DATAA found;
+			HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &found);
+			if(find == INVALID_HANDLE_VALUE)
+				throw runtime_error("Unable to read directory " + directory);
+			do {
+				if(!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+					names.push_back(found.cFileName);
+			} while(FindNextFileA(find, &found));
+			FindClose(find);
+#else
+			DIR* dir = ::opendir(directory.c_str());
+			if(!dir)
+				throw runtime_error("Unable to read directory " + directory);
+			while(dirent* entry = ::readdir(dir))
+				names.push_back(entry->d_name);
+			::closedir(dir);
+#endif
+		}
+
+		//Where the extension starts, or the end if there isn't one.
+		string::size_type extension(string const& path) {
+			string::size_type dot = path.rfind('.'), slash = path.find_last_of("/\\");
+			if(dot == string::npos || (slash != string::npos && dot < slash))
+				return path.size();
+			return dot;
+		}
+
+		bool isSource(string const& name) {
+			string ext = name.substr(extension(name));
+			return ext == ".b98" || ext == ".b93" || ext == ".bf" || ext == ".befunge";
+		}
+
+		//Fills in the input and output that source has by default.
+		Job defaultJob(string const& source) {
+			string base = source.substr(0, extension(source));
+
+			Job job;
+			job.source = source;
+			job.input = exists(base + ".in") ? base + ".in" : "-";
+			job.output = base + ".out";
+			return job;
+		}
+
+		void readJobs(string const& path, vector<Job>& jobs) {
+			if(isDirectory(path)) {
+				vector<string> names;
+				listDirectory(path, names);
+				std::sort(names.begin(), names.end());
+
+				for(vector<string>::const_iterator name = names.begin(); name != names.end(); ++name) {
+					if(isSource(*name))
+						jobs.push_back(defaultJob(path + "/" + *name));
+				}
+				return;
+			}
+
+			std::ifstream list(path.c_str());
+			if(!list.good())
+				throw runtime_error("Unable to open batch list " + path);
+
+			string line;
+			while(getline(list, line)) {
+				std::istringstream fields(line);
+				string source;
+				if(!(fields >> source) || source[0] == '#')
+					continue;
+
+				Job job = defaultJob(source);
+				string input, output;
+				if(fields >> input)
+					job.input = input;
+				if(fields >> output)
+					job.output = output;
+				jobs.push_back(job);
+			}
+		}
+
+		template<class CellT, int Dimensions>
+		class BatchRunner : boost::noncopyable {
+			typedef typename Stinkhorn<CellT, Dimensions>::Interpreter Interpreter;
+
+		public:
+			BatchRunner(Options const& options, vector<Job> const& jobs)
+				: m_options(options), m_jobs(jobs), m_next(0)
+			{
+			}
+
+			void run() {
+				unsigned workers = std::max(1u, boost::thread::hardware_concurrency());
+				workers = static_cast<unsigned>(std::min<std::size_t>(workers, m_jobs.size()));
+
+				Worker worker = { this };
+				boost::thread_group group;
+				for(unsigned i = 0; i < workers; ++i)
+					group.create_thread(worker);
+				group.join_all();
+			}
+
+		private:
+			struct Worker {
+				BatchRunner* runner;
+
+				void operator()() {
+					runner->work();
+				}
+			};
+
+			//Jobs are handed out one at a time, in order, to whichever worker is free.
+			void work() {
+				//The interpreter refers to these options, and sees each job's source file.
+				Options options = m_options;
+				Interpreter interpreter(options);
+
+				for(;;) {
+					std::size_t i;
+					{
+						boost::mutex::scoped_lock lock(m_lock);
+						if(m_next == m_jobs.size())
+							return;
+						i = m_next++;
+					}
+
+					Job const& job = m_jobs[i];
+					options.sourceFile = job.source;
+
+					string error;
+					boost::int64_t started = microseconds();
+					int returnCode = runJob(interpreter, job, error);
+					double time = (microseconds() - started) / 1000000.0;
+
+					boost::mutex::scoped_lock lock(m_lock);
+					if(!error.empty())
+						std::cerr << job.source << ": " << error << "\n";
+					std::cout << job.source << '\t' << returnCode << '\t' << time << std::endl;
+				}
+			}
+
+			//Returns the program's exit code, or 1 and why, if it couldn't be run.
+			int runJob(Interpreter& interpreter, Job const& job, string& error) {
+				try {
+					std::istringstream no_input;
+					std::ifstream input_file;
+					std::istream* input = &no_input;
+					if(job.input != "-") {
+						input_file.open(job.input.c_str(), std::ios_base::binary | std::ios_base::in);
+						if(!input_file.good())
+							throw runtime_error("Unable to open input file " + job.input);
+						input = &input_file;
+					}
+
+					std::ostream no_output(0);
+					std::ofstream output_file;
+					std::ostream* output = &no_output;
+					if(job.output != "-") {
+						output_file.open(job.output.c_str(), std::ios_base::binary | std::ios_base::out);
+						if(!output_file.good())
+							throw runtime_error("Unable to open output file " + job.output);
+						output = &output_file;
+					}
+
+					interpreter.reset();
+					interpreter.redirect(*input, *output);
+					interpreter.run();
+					return 0;
+				} catch(QuitProgram& q) {
+					return q.returnCode;
+				} catch(std::exception& e) {
+					error = e.what();
+					return 1;
+				} catch(...) {
+					error = "unknown internal failure";
+					return 2;
+				}
+			}
+
+			Options const& m_options;
+			vector<Job> const& m_jobs;
+
+			//Guards m_next, and std::cout and std::cerr.
+			boost::mutex m_lock;
+			std::size_t m_next;
+		};
+
+		template<class CellT, int Dimensions>
+		void runJobs(Options const& opts, vector<Job> const& jobs) {
+			BatchRunner<CellT, Dimensions>(opts, jobs).run();
+		}
+	}
+
+	int runBatch(Options& opts) {
+		vector<Job> jobs;
+		readJobs(opts.batch, jobs);
+		if(jobs.empty())
+			throw runtime_error("no programs to run in " + opts.batch);
+
+#ifndef B98_NO_64BIT_CELLS
+		if(opts.cellSize == 64)
+#ifndef B98_NO_TREFUNGE
+			if(opts.trefunge)
+				runJobs<int64, 3>(opts, jobs);
+			else
+#endif
+				runJobs<int64, 2>(opts, jobs);
+		else
+#endif
+#ifndef B98_NO_TREFUNGE
+			if(opts.trefunge)
+				runJobs<int32, 3>(opts, jobs);
+			else
+#endif
+				runJobs<int32, 2>(opts, jobs);
+
+		return 0;
+	}
+}
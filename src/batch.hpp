@@ -0,0 +1,32 @@
+#ifndef B98_BATCH_HPP_INCLUDED
+#define B98_BATCH_HPP_INCLUDED
+
+#include "options.hpp"
+
+namespace stinkhorn {
+	/**
+	 * Runs every program named by opts.batch on a pool of worker threads, one for
+	 * each core, and prints each one's exit code and running time to stdout.
+	 *
+	 * opts.batch is either a directory, in which every .b98, .b93, .bf and
+	 * .befunge file is a program, or a list of programs, one to a line:
+	 *
+	 *     source [input [output]]
+	 *
+	 * A program reads its input from the given file and writes its output to the
+	 * other; - means none. By default, the input is the source file's name with
+	 * .in in place of its extension, if there is such a file, and the output the
+	 * same with .out. Blank lines, and lines beginning with #, are ignored.
+	 *
+	 * Each worker keeps one interpreter, which it resets between programs, so
+	 * funge-space's pages are allocated once per worker rather than per program.
+	 *
+	 * Programs are only isolated as far as the interpreter goes: ?'s rand() and
+	 * =, which calls system(), are shared by the whole process, so programs on
+	 * different workers draw from one random sequence, and a command one runs
+	 * can affect (or be affected by) the others.
+	 **/
+	int runBatch(Options& opts);
+}
+
+#endif
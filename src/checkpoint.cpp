@@ -0,0 +1,470 @@
+#include "config.hpp"
+#include "checkpoint.hpp"
+#include "octree.hpp"
+#include "interpreter.hpp"
+#include "context.hpp"
+#include "fingerprint.hpp"
+#include "fingerprint_stack.hpp"
+#include "stack.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "boost/date_time/posix_time/posix_time_types.hpp"
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace stinkhorn {
+	void CheckpointWriter::count(uint64 value) {
+		char buffer[10];
+		std::size_t size = 0;
+		do {
+			unsigned char byte = static_cast<unsigned char>(value & 0x7f);
+			value >>= 7;
+			buffer[size++] = static_cast<char>(value ? byte | 0x80 : byte);
+		} while(value);
+
+		m_stream.write(buffer, size);
+	}
+
+	void CheckpointWriter::cell(int64 value) {
+		count((static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63));
+	}
+
+	void CheckpointWriter::flag(bool value) {
+		m_stream.put(value ? 1 : 0);
+	}
+
+	void CheckpointWriter::bytes(void const* data, std::size_t size) {
+		m_stream.write(static_cast<char const*>(data), size);
+	}
+
+	void CheckpointWriter::string(std::string const& value) {
+		count(value.size());
+		bytes(value.data(), value.size());
+	}
+
+	namespace {
+		void cutShort() {
+			throw runtime_error("the checkpoint is cut short or damaged");
+		}
+	}
+
+	uint64 CheckpointReader::count() {
+		uint64 value = 0;
+		for(int shift = 0; ; shift += 7) {
+			int byte = m_stream.get();
+			if(!m_stream || shift > 63)
+				cutShort();
+
+			value |= static_cast<uint64>(byte & 0x7f) << shift;
+			if(!(byte & 0x80))
+				return value;
+		}
+	}
+
+	uint64 CheckpointReader::count(std::size_t each) {
+		uint64 value = count();
+
+		if(m_end < 0) {
+			std::streampos at = m_stream.tellg();
+			m_stream.seekg(0, std::ios_base::end);
+			m_end = m_stream.tellg();
+			m_stream.seekg(at);
+			if(!m_stream || m_end < 0)
+				cutShort();
+		}
+
+		std::streamoff left = m_end - std::streamoff(m_stream.tellg());
+		if(left < 0 || value > uint64(left) / each)
+			cutShort();
+		return value;
+	}
+
+	int64 CheckpointReader::cell() {
+		uint64 value = count();
+		return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+	}
+
+	bool CheckpointReader::flag() {
+		int byte = m_stream.get();
+		if(!m_stream)
+			cutShort();
+		return byte != 0;
+	}
+
+	void CheckpointReader::bytes(void* data, std::size_t size) {
+		m_stream.read(static_cast<char*>(data), size);
+		if(!m_stream)
+			cutShort();
+	}
+
+	std::string CheckpointReader::string() {
+		std::string value(static_cast<std::size_t>(count(1)), '\0');
+		if(!value.empty())
+			bytes(&value[0], value.size());
+		return value;
+	}
+
+	boost::atomic<bool> checkpointWanted(false);
+
+	namespace {
+		void wantCheckpoint(int) {
+			checkpointWanted = true;
+		}
+	}
+
+	void checkpointOnSignal() {
+#ifdef SIGUSR1
+		std::signal(SIGUSR1, wantCheckpoint);
+#endif
+	}
+
+	struct CheckpointTimer::Alarm {
+		unsigned interval;
+
+		//Runs until interrupted, which sleep lets it be.
+		void operator()() {
+			for(;;) {
+				boost::this_thread::sleep(boost::posix_time::seconds(interval));
+				checkpointWanted = true;
+			}
+		}
+	};
+
+	CheckpointTimer::CheckpointTimer(unsigned interval) {
+		Alarm alarm = { interval };
+		boost::thread(alarm).swap(m_thread);
+	}
+
+	CheckpointTimer::~CheckpointTimer() {
+		m_thread.interrupt();
+		m_thread.join();
+	}
+
+	namespace {
+		char const Magic[8] = { 'S', 'T', 'N', 'K', 'C', 'K', 'P', 'T' };
+		uint64 const Version = 1;
+
+		//Pages are saved as they are in memory, so a checkpoint can only be
+		//restored on a machine which lays cells out the same way.
+		uint32 const ByteOrder = 0x01020304;
+
+		template<class CellT, int Dimensions>
+		void writeHeader(CheckpointWriter& out) {
+			out.bytes(Magic, sizeof Magic);
+			out.count(Version);
+			out.count(sizeof(CellT) * CHAR_BIT);
+			out.count(Dimensions);
+			out.count(Stinkhorn<CellT, Dimensions>::TreePage::bits);
+			out.bytes(&ByteOrder, sizeof ByteOrder);
+		}
+
+		template<class CellT, int Dimensions>
+		void readHeader(CheckpointReader& in, string const& path) {
+			char magic[sizeof Magic];
+			in.bytes(magic, sizeof magic);
+			if(std::memcmp(magic, Magic, sizeof Magic) != 0)
+				throw runtime_error(path + " isn't a checkpoint");
+
+			if(in.count() != Version)
+				throw runtime_error(path + " was saved by a different version of stinkhorn");
+
+			uint64 cellBits = in.count(), dimensions = in.count(), pageBits = in.count();
+			if(cellBits != sizeof(CellT) * CHAR_BIT || dimensions != Dimensions || pageBits != uint64(Stinkhorn<CellT, Dimensions>::TreePage::bits))
+				throw runtime_error(path + " was saved with a different cell size or number of dimensions");
+
+			uint32 order;
+			in.bytes(&order, sizeof order);
+			if(order != ByteOrder)
+				throw runtime_error(path + " was saved on a machine with a different byte order");
+		}
+
+		//Adds the fingerprints in layer which aren't in table yet to it.
+		template<class FingerprintT>
+		void addLayer(vector<FingerprintT*> const& layer, vector<FingerprintT*>& table) {
+			for(typename vector<FingerprintT*>::const_iterator fp = layer.begin(); fp != layer.end(); ++fp) {
+				if(std::find(table.begin(), table.end(), *fp) == table.end())
+					table.push_back(*fp);
+			}
+		}
+
+		template<class ContentsT, class FingerprintT>
+		void addContents(ContentsT const& contents, vector<FingerprintT*>& table) {
+			addLayer(contents.stack, table);
+			for(int i = 0; i < 26; ++i)
+				addLayer(contents.semantics[i], table);
+		}
+
+		//A layer is saved as the fingerprints' places in the table.
+		template<class FingerprintT>
+		void saveLayer(CheckpointWriter& out, vector<FingerprintT*> const& layer, vector<FingerprintT*> const& table) {
+			out.count(layer.size());
+			for(typename vector<FingerprintT*>::const_iterator fp = layer.begin(); fp != layer.end(); ++fp)
+				out.count(std::find(table.begin(), table.end(), *fp) - table.begin());
+		}
+
+		template<class FingerprintT>
+		void restoreLayer(CheckpointReader& in, vector<FingerprintT*>& layer, vector<FingerprintT*> const& table) {
+			layer.resize(static_cast<std::size_t>(in.count(1)));
+			for(typename vector<FingerprintT*>::iterator fp = layer.begin(); fp != layer.end(); ++fp) {
+				uint64 index = in.count();
+				if(index >= table.size())
+					cutShort();
+				*fp = table[static_cast<std::size_t>(index)];
+			}
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::Checkpoint::Checkpoint(string const& path) :
+		m_path(path),
+		m_whole(0)
+	{
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Checkpoint::save(Interpreter& interpreter, vector<Thread*> const& threads, CellT nextThreadID) {
+		if(!m_file.is_open() || std::streamoff(m_file.tellp()) > 2 * m_whole)
+			start(interpreter, threads, nextThreadID);
+		else
+			append(interpreter, threads, nextThreadID, false);
+	}
+
+	//Writes the whole checkpoint to a new file, which then takes the old one's
+	//place, so that there is always a whole one at m_path.
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Checkpoint::start(Interpreter& interpreter, vector<Thread*> const& threads, CellT nextThreadID) {
+		if(m_file.is_open())
+			m_file.close();
+		m_file.clear();
+
+		string temporary = m_path + ".tmp";
+		m_file.open(temporary.c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+		if(!m_file.good())
+			throw runtime_error("Unable to write checkpoint " + temporary);
+
+		CheckpointWriter out(m_file);
+		writeHeader<CellT, Dimensions>(out);
+		append(interpreter, threads, nextThreadID, true);
+		m_whole = m_file.tellp();
+		m_file.close();
+
+#ifdef B98_WINDOWS
+		std::remove(m_path.c_str());
+#endif
+		if(std::rename(temporary.c_str(), m_path.c_str()) != 0)
+			throw runtime_error("Unable to replace checkpoint " + m_path);
+
+		m_file.open(m_path.c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+		m_file.seekp(0, std::ios_base::end);
+		if(!m_file.good())
+			throw runtime_error("Unable to write checkpoint " + m_path);
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Checkpoint::append(Interpreter& interpreter, vector<Thread*> const& threads, CellT nextThreadID, bool all) {
+		Tree& tree = interpreter.fungeSpace();
+
+		std::streamoff start = m_file.tellp();
+		uint64 length = 0;
+		m_file.write(reinterpret_cast<char const*>(&length), sizeof length);
+
+		CheckpointWriter out(m_file);
+
+		//The pages come first, since restore wants them from every record.
+		vector<typename Tree::PageEntry> pages, saving;
+		tree.list_pages(pages);
+		for(typename vector<typename Tree::PageEntry>::const_iterator page = pages.begin(); page != pages.end(); ++page) {
+			if(all || (page->second->dirty && !page->second->shared))
+				saving.push_back(*page);
+		}
+
+		out.count(saving.size());
+		for(typename vector<typename Tree::PageEntry>::const_iterator page = saving.begin(); page != saving.end(); ++page) {
+			out.vector(page->first);
+			out.bytes(page->second->data, sizeof page->second->data);
+		}
+
+		Vector min, max;
+		tree.get_minmax(min, max);
+		out.vector(min);
+		out.vector(max);
+		out.cell(nextThreadID);
+		out.string(interpreter.options().sourceFile);
+		RefcFingerprint::saveState(interpreter.registry(), out);
+
+		//Each fingerprint is saved once, however many IPs have it loaded. The
+		//interpreter's own come first, and restore finds its own in their place.
+		vector<IFingerprint*> table;
+		typename FingerprintStack::Contents base;
+		interpreter.baseFingerprints().contents(base);
+		addContents(base, table);
+		std::size_t builtin = table.size();
+
+		vector<typename FingerprintStack::Contents> loaded(threads.size());
+		for(std::size_t i = 0; i < threads.size(); ++i) {
+			threads[i]->topContext().fingerprints().contents(loaded[i]);
+			addContents(loaded[i], table);
+		}
+
+		out.count(table.size() - builtin);
+		for(std::size_t i = builtin; i < table.size(); ++i) {
+			out.count(table[i]->id());
+			table[i]->save(out);
+		}
+
+		out.count(threads.size());
+		for(std::size_t i = 0; i < threads.size(); ++i) {
+			Context& ctx = threads[i]->topContext();
+			out.cell(threads[i]->threadID());
+			out.vector(ctx.cursor().position());
+			out.vector(ctx.cursor().direction());
+			out.vector(ctx.storageOffset());
+			out.flag(ctx.stringMode());
+			out.flag(ctx.space());
+			out.flag(ctx.hoverMode());
+			out.flag(ctx.switchMode());
+			ctx.stack().save(out);
+
+			saveLayer(out, loaded[i].stack, table);
+			for(int s = 0; s < 26; ++s)
+				saveLayer(out, loaded[i].semantics[s], table);
+		}
+
+		//Only now is the record whole.
+		std::streamoff end = m_file.tellp();
+		length = end - start - sizeof length;
+		m_file.flush();
+		m_file.seekp(start);
+		m_file.write(reinterpret_cast<char const*>(&length), sizeof length);
+		m_file.seekp(end);
+		m_file.flush();
+		if(!m_file.good())
+			throw runtime_error("Unable to write checkpoint " + m_path);
+
+		for(typename vector<typename Tree::PageEntry>::const_iterator page = saving.begin(); page != saving.end(); ++page) {
+			if(!page->second->shared)
+				page->second->dirty = false;
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	CellT Stinkhorn<CellT, Dimensions>::Checkpoint::restore(string const& path, Interpreter& interpreter, vector<Thread*>& threads, string& sourceFile) {
+		std::ifstream file(path.c_str(), std::ios_base::binary | std::ios_base::in);
+		if(!file.good())
+			throw runtime_error("Unable to open checkpoint " + path);
+
+		CheckpointReader in(file);
+		readHeader<CellT, Dimensions>(in, path);
+
+		//Find the records that were finished.
+		std::streamoff at = file.tellg();
+		file.seekg(0, std::ios_base::end);
+		std::streamoff size = file.tellg();
+
+		vector<std::streamoff> records;
+		while(size - at >= std::streamoff(sizeof(uint64))) {
+			uint64 length;
+			file.seekg(at);
+			in.bytes(&length, sizeof length);
+			at += sizeof length;
+			if(!length || length > uint64(size - at))
+				break;
+
+			records.push_back(at);
+			at += length;
+		}
+
+		if(records.empty())
+			throw runtime_error(path + " doesn't hold a whole checkpoint");
+
+		Tree& tree = interpreter.fungeSpace();
+		for(vector<std::streamoff>::const_iterator record = records.begin(); record != records.end(); ++record) {
+			file.seekg(*record);
+			uint64 pages = in.count();
+			for(uint64 i = 0; i < pages; ++i) {
+				Vector address;
+				in.vector(address);
+				typename Tree::PageT* page = tree.find(address, true);
+				in.bytes(page->data, sizeof page->data);
+			}
+		}
+
+		//The rest comes from the last record alone, which the file is now in.
+		Vector min, max;
+		in.vector(min);
+		in.vector(max);
+		tree.set_minmax(min, max);
+
+		CellT nextThreadID = static_cast<CellT>(in.cell());
+		sourceFile = in.string();
+		RefcFingerprint::restoreState(interpreter.registry(), in);
+
+		//The table holds a reference to each fingerprint it created, until the IPs
+		//have theirs.
+		typename FingerprintStack::Contents base;
+		vector<IFingerprint*> builtin;
+		interpreter.baseFingerprints().contents(base);
+		addContents(base, builtin);
+
+		struct Table {
+			vector<IFingerprint*> fingerprints;
+			std::size_t builtin;
+
+			Table(vector<IFingerprint*> const& builtin) : fingerprints(builtin), builtin(builtin.size()) {}
+
+			~Table() {
+				for(std::size_t i = builtin; i < fingerprints.size(); ++i)
+					fingerprints[i]->release();
+			}
+		} table(builtin);
+
+		for(uint64 i = 0, count = in.count(); i < count; ++i) {
+			IdT id = in.count();
+			IFingerprint* fp = interpreter.registry().createFingerprint(id);
+			if(!fp)
+				throw runtime_error(path + " has a fingerprint loaded which this interpreter doesn't have");
+
+			table.fingerprints.push_back(fp);
+			fp->restore(in);
+		}
+
+		for(uint64 i = 0, count = in.count(); i < count; ++i) {
+			std::auto_ptr<Thread> thread(new Thread(interpreter, tree, static_cast<CellT>(in.cell())));
+			Context& ctx = thread->topContext();
+
+			Vector v;
+			in.vector(v);
+			ctx.cursor().position(v);
+			in.vector(v);
+			ctx.cursor().direction(v);
+			in.vector(v);
+			ctx.storageOffset(v);
+			ctx.stringMode(in.flag());
+			ctx.space(in.flag());
+			ctx.hoverMode(in.flag());
+			ctx.switchMode(in.flag());
+			ctx.stack().restore(in);
+
+			typename FingerprintStack::Contents loaded;
+			restoreLayer(in, loaded.stack, table.fingerprints);
+			for(int s = 0; s < 26; ++s)
+				restoreLayer(in, loaded.semantics[s], table.fingerprints);
+			ctx.fingerprints().assign(loaded);
+
+			threads.push_back(thread.release());
+		}
+
+		return nextThreadID;
+	}
+}
+
+INSTANTIATE(class, Checkpoint);
@@ -0,0 +1,141 @@
+#ifndef B98_CHECKPOINT_HPP_INCLUDED
+#define B98_CHECKPOINT_HPP_INCLUDED
+
+#include "stinkhorn.hpp"
+#include "vector.hpp"
+
+#include <csignal>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/atomic.hpp"
+
+namespace stinkhorn {
+	/**
+	 * Writes the parts of a checkpoint. Counts are unsigned varints (seven bits
+	 * to a byte, low bits first), and cells are signed ones, zigzag encoded so
+	 * that small negative numbers are short too. Flags are a byte each.
+	 **/
+	class CheckpointWriter {
+	public:
+		explicit CheckpointWriter(std::ostream& stream) : m_stream(stream) {}
+
+		void count(uint64 value);
+		void cell(int64 value);
+		void flag(bool value);
+		void bytes(void const* data, std::size_t size);
+		void string(std::string const& value);
+
+		//x and y, and z only in Trefunge.
+		template<class CellT, int Dimensions>
+		void vector(vectorN<CellT, Dimensions> const& v) {
+			cell(v.x);
+			cell(v.y);
+			if(Dimensions == 3)
+				cell(getZ(v));
+		}
+
+	private:
+		std::ostream& m_stream;
+	};
+
+	//Reads what a CheckpointWriter wrote, throwing a runtime_error if it runs out.
+	class CheckpointReader {
+	public:
+		explicit CheckpointReader(std::istream& stream) : m_stream(stream), m_end(-1) {}
+
+		uint64 count();
+		///A count of things which take at least each bytes apiece, checked against
+		///what is left of the stream before anything is allocated for them.
+		uint64 count(std::size_t each);
+		int64 cell();
+		bool flag();
+		void bytes(void* data, std::size_t size);
+		std::string string();
+
+		template<class CellT, int Dimensions>
+		void vector(vectorN<CellT, Dimensions>& v) {
+			v.x = static_cast<CellT>(cell());
+			v.y = static_cast<CellT>(cell());
+			if(Dimensions == 3)
+				setZ(v, static_cast<CellT>(cell()));
+		}
+
+	private:
+		std::istream& m_stream;
+		std::streamoff m_end;
+	};
+
+	/**
+	 * Set when a checkpoint is due, by SIGUSR1 or a CheckpointTimer. The
+	 * interpreter looks at it between ticks, and clears it when it saves. It is
+	 * atomic (and lock-free, so the signal handler may set it) because the
+	 * timer sets it from a thread of its own.
+	 **/
+	extern boost::atomic<bool> checkpointWanted;
+
+	//Sets checkpointWanted on SIGUSR1, where there is such a signal.
+	void checkpointOnSignal();
+
+	//Sets checkpointWanted every interval seconds, until destroyed.
+	class CheckpointTimer : boost::noncopyable {
+	public:
+		explicit CheckpointTimer(unsigned interval);
+		~CheckpointTimer();
+
+	private:
+		struct Alarm;
+		boost::thread m_thread;
+	};
+
+	/**
+	 * Saves the whole of a running program to a file (--checkpoint), so that it
+	 * can be carried on with later (--restore): funge-space and its bounds, every
+	 * IP (its position, delta, storage offset, modes, stack stack and loaded
+	 * fingerprints, along with what those fingerprints keep, such as HRTI's mark
+	 * and the vectors REFC has handed out) and the next IP's ID.
+	 *
+	 * The file is a header, then records, each the length of its body and the
+	 * body: the pages it holds, then everything else. The first save writes one
+	 * record with every page. Later ones append a record with just the pages
+	 * written to since, so a checkpoint of a large program that changes little
+	 * costs little. Once those add up to more than the whole, the next save
+	 * starts the file afresh. A record's length is filled in last, and restore
+	 * stops at the first one without a length, so a save that was cut short is
+	 * passed over.
+	 *
+	 * What the program has read from its input, and SOCK's sockets, are not
+	 * saved.
+	 **/
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::Checkpoint
+		: boost::noncopyable
+	{
+	public:
+		explicit Checkpoint(std::string const& path);
+
+		//threads are the interpreter's IPs, in its order.
+		void save(Interpreter& interpreter, std::vector<Thread*> const& threads, CellT nextThreadID);
+
+		//Puts the program saved at path back into interpreter, which must not have
+		//loaded one, appending its IPs to threads. Returns the next IP's ID, and
+		//sets sourceFile to the name of the program's source file.
+		static CellT restore(std::string const& path, Interpreter& interpreter, std::vector<Thread*>& threads, std::string& sourceFile);
+
+	private:
+		void start(Interpreter& interpreter, std::vector<Thread*> const& threads, CellT nextThreadID);
+		void append(Interpreter& interpreter, std::vector<Thread*> const& threads, CellT nextThreadID, bool all);
+
+		std::string m_path;
+		std::fstream m_file;
+
+		//How long the file was after the last save that wrote every page.
+		std::streamoff m_whole;
+	};
+}
+
+#endif
@@ -7,16 +7,16 @@ template<class CellT, int Dimensions>
 Stinkhorn<CellT, Dimensions>::Context::Context(Thread& pwner, Context* parent, Tree& funge_space)
 	:
 	m_quitting(false), 
-	m_storage_offset(),
-	m_space(false),
-	m_string_mode(false),
+	m_flags(pwner.table().flags(pwner.slot())),
+	m_storage_offset(pwner.table().storageOffset(pwner.slot())),
 	m_owner(pwner),
 	m_parent(parent), 
 	m_funge_space(funge_space),
-	m_cursor(funge_space),
-	m_fp_stack(pwner.interpreter().registry())
+	m_cursor(funge_space, pwner.table(), pwner.slot()),
+	m_fp_stack(pwner.interpreter().baseFingerprints())
 {
 	assert(0 == m_stack.topStackSize());
+	pwner.table().stack(pwner.slot()) = &m_stack;
 }
 
 template<class CellT, int Dimensions>
@@ -43,4 +43,9 @@ bool Stinkhorn<CellT, Dimensions>::Context::execute(CellT instruction) {
 	return m_fp_stack.execute(instruction, *this);
 }
 
+template<class CellT, int Dimensions>
+typename Stinkhorn<CellT, Dimensions>::IFingerprint* Stinkhorn<CellT, Dimensions>::Context::dispatch(CellT instruction) {
+	return m_fp_stack.dispatch(instruction, *this);
+}
+
 INSTANTIATE(class, Context);
@@ -19,24 +19,33 @@ public:
 
 	//Accessors (can invoke debugger, can be redefined easily)
 public:
-	bool stringMode() { return m_string_mode; }
-	void stringMode(bool value) { m_string_mode = value; }
+	bool stringMode() { return flag(ThreadTable::StringMode); }
+	void stringMode(bool value) { flag(ThreadTable::StringMode, value); }
 
 	bool quitFlag() { return m_quitting; }
 	void setQuitFlag() { m_quitting = true; }
 
-	bool space() { return m_space; }
-	void space(bool value) { m_space = value; }
+	bool space() { return flag(ThreadTable::Space); }
+	void space(bool value) { flag(ThreadTable::Space, value); }
+
+	//Hover mode and switch mode belong to the MODE fingerprint.
+	bool hoverMode() { return flag(ThreadTable::HoverMode); }
+	void hoverMode(bool value) { flag(ThreadTable::HoverMode, value); }
+
+	bool switchMode() { return flag(ThreadTable::SwitchMode); }
+	void switchMode(bool value) { flag(ThreadTable::SwitchMode, value); }
 
 	Vector const& storageOffset() { return m_storage_offset; }
 	void storageOffset(Vector const& new_storage_offset) { m_storage_offset = new_storage_offset; }
 
 public:
 	bool execute(CellT c);
+	IFingerprint* dispatch(CellT c);
 
 	StackStackT& stack() { return m_stack; }
 	Cursor& cursor() { return m_cursor; }
 	Tree& fungeSpace() { return m_funge_space; }
+	FingerprintStack& fingerprints() { return m_fp_stack; }
 
 public:
 	Context* parent() { return m_parent; }
@@ -48,9 +57,20 @@ public:
 	bool pushFingerprint(IdT id);
 	bool popFingerprint(IdT id);
 
+	//Instructions which read from (or write to) a descriptor call this first. If
+	//it returns true, the IP has been parked until the descriptor is ready, and
+	//the instruction should return without doing anything.
+	bool waitFor(int descriptor, bool writing = false) { return interpreter().park(m_owner, descriptor, writing); }
+
+private:
+	bool flag(unsigned bit) { return (m_flags & bit) != 0; }
+	void flag(unsigned bit, bool value) { m_flags = value ? m_flags | bit : m_flags & ~bit; }
+
 private:
-	bool m_string_mode, m_quitting, m_space;
-	Vector m_storage_offset;
+	//The modes and the storage offset live in the IP's slot of the ThreadTable.
+	bool m_quitting;
+	unsigned char& m_flags;
+	Vector& m_storage_offset;
 
 private:
 	FingerprintStack m_fp_stack;
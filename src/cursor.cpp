@@ -1,16 +1,38 @@
 #include "cursor.hpp"
 #include "octree.hpp"
+#include "stack.hpp"
+#include "speculation.hpp"
+
+#include <algorithm>
 
 using stinkhorn::Stinkhorn;
 
 template<class CellT, int Dimensions>
 Stinkhorn<CellT, Dimensions>::Cursor::Cursor(Tree& tree) :
-	m_position(0, 0, 0),
-	m_direction(1, 0, 0),
-	m_tree(tree)
+	m_page(m_own.page),
+	m_page_copies(m_own.page_copies),
+	m_page_address(m_own.page_address),
+	m_position(m_own.position),
+	m_direction(m_own.direction),
+	m_tree(tree),
+	m_log(0)
+{
+	m_page_address = m_position >> PageT::bits;
+	findPage();
+}
+
+template<class CellT, int Dimensions>
+Stinkhorn<CellT, Dimensions>::Cursor::Cursor(Tree& tree, ThreadTable& table, typename ThreadTable::Slot slot) :
+	m_page(table.page(slot)),
+	m_page_copies(table.pageCopies(slot)),
+	m_page_address(table.pageAddress(slot)),
+	m_position(table.position(slot)),
+	m_direction(table.direction(slot)),
+	m_tree(tree),
+	m_log(0)
 {
 	m_page_address = m_position >> PageT::bits;
-	m_page = m_tree.find(m_page_address);
+	findPage();
 }
 
 // When in hyperspace, the function looks for a semicolon to drop out of hyperspace.
@@ -26,6 +48,8 @@ bool Stinkhorn<CellT, Dimensions>::Cursor::advance_fast(const Vector& from, Vect
 		page = m_page;
 	} else {
 		page = m_tree.find(page_address);
+		if(m_log)
+			m_log->read(page_address);
 	}
 
 	while(page) {
@@ -47,9 +71,13 @@ bool Stinkhorn<CellT, Dimensions>::Cursor::advance_fast(const Vector& from, Vect
 		
 		page_address = pos >> PageT::bits;
 		page = m_tree.find(page_address);
+		if(m_log)
+			m_log->read(page_address);
 	}
 
 	// We've hit a gap in funge-space!
+	if(m_log)
+		m_log->search();
 	return m_tree.advance_cursor(from, m_direction, to, in_hyperspace ? teleport_instruction : any_instruction, can_wrap);
 }
 
@@ -80,13 +108,153 @@ bool Stinkhorn<CellT, Dimensions>::Cursor::advance(bool follow_teleports, bool c
 	return false;
 }
 
+template<class CellT, int Dimensions>
+bool Stinkhorn<CellT, Dimensions>::Cursor::readString(StackStackT& stack, bool& space) {
+	for(;;) {
+		getPage();
+
+		if(m_page) {
+			Vector pos = m_position;
+			for(;;) {
+				CellT c = m_page->get(pos & PageT::mask);
+				if(c == '\"') {
+					m_position = pos;
+					return true;
+				}
+
+				if(c == ' ') {
+					space = true;
+				} else {
+					if(space) {
+						stack.push(' ');
+						space = false;
+					}
+					stack.push(c);
+				}
+
+				Vector next = pos + m_direction;
+				if(next >> PageT::bits != m_page_address)
+					break;
+				pos = next;
+			}
+			m_position = pos;
+		} else {
+			//No page means we're standing on a space.
+			space = true;
+		}
+
+		Vector old_position = m_position;
+		if(!advance(false))
+			return false;
+
+		//Skipping over spaces (or a gap in funge-space) still counts as a space.
+		if(m_position - m_direction != old_position)
+			space = true;
+	}
+}
+
+template<class CellT, int Dimensions>
+bool Stinkhorn<CellT, Dimensions>::Cursor::readRow(String& str, CellT max_x) {
+	for(;;) {
+		Vector pos = m_position;
+		if(pos.x > max_x)
+			return false;
+
+		//The rest of this page's row, stopping at max_x.
+		CellT last_x = std::min<CellT>(max_x, m_page_address.x * PageT::size + PageT::mask);
+		std::size_t count = static_cast<std::size_t>(last_x - pos.x) + 1;
+
+		getPage();
+		if(m_page) {
+			for(std::size_t i = 0; i < count; ++i) {
+				CellT c = m_page->get(pos & PageT::mask);
+				if(c == 0) {
+					position(pos);
+					return true;
+				}
+				str += c;
+				++pos.x;
+			}
+		} else {
+			str.append(count, CellT(' '));
+		}
+
+		position(Vector(last_x + 1, pos.y, getZ(pos)));
+	}
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Cursor::writeRow(CellT const* first, CellT const* last) {
+	writeCells(first, last);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Cursor::writeBytes(unsigned char const* first, unsigned char const* last) {
+	writeCells(first, last);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Cursor::readBytes(unsigned char* first, unsigned char* last) {
+	while(first != last) {
+		Vector pos = m_position;
+		std::size_t room = static_cast<std::size_t>(PageT::size - (pos.x & PageT::mask));
+		std::size_t count = std::min(room, static_cast<std::size_t>(last - first));
+
+		getPage();
+		if(m_page) {
+			Vector cell = pos & PageT::mask;
+			for(std::size_t i = 0; i < count; ++i, ++cell.x)
+				first[i] = static_cast<unsigned char>(m_page->get(cell));
+		} else {
+			std::fill(first, first + count, static_cast<unsigned char>(' '));
+		}
+
+		first += count;
+		position(pos + Vector(static_cast<CellT>(count), 0, 0));
+	}
+}
+
+//Copies [first, last) into the page rows eastwards from the cursor, converting
+//each element to a cell.
+template<class CellT, int Dimensions>
+template<class T>
+void Stinkhorn<CellT, Dimensions>::Cursor::writeCells(T const* first, T const* last) {
+	while(first != last) {
+		Vector pos = m_position;
+		std::size_t room = static_cast<std::size_t>(PageT::size - (pos.x & PageT::mask));
+		std::size_t count = std::min(room, static_cast<std::size_t>(last - first));
+
+		//Like put(), don't create a page just to fill it with spaces, and copy a
+		//shared one before writing to it.
+		getPage();
+		if(m_page ? m_page->shared : std::count(first, first + count, CellT(' ')) != static_cast<std::ptrdiff_t>(count))
+			findPage(true);
+
+		if(m_page) {
+			if(m_page->usage & PageT::Usage::code)
+				m_tree.code_modified = true;
+			m_page->touch();
+			Vector cell = pos & PageT::mask;
+			for(T const* i = first; i != first + count; ++i, ++cell.x)
+				m_page->set(cell, static_cast<CellT>(*i));
+			m_tree.update_minmax(pos);
+			m_tree.update_minmax(pos + Vector(static_cast<CellT>(count - 1), 0, 0));
+		}
+
+		first += count;
+		position(pos + Vector(static_cast<CellT>(count), 0, 0));
+	}
+}
+
 template<class CellT, int Dimensions>
 void Stinkhorn<CellT, Dimensions>::Cursor::position(Vector const& new_position) {
 	Vector new_page_address = new_position >> PageT::bits;
 
 	if(m_page_address != new_page_address) {
 		m_page_address = new_page_address;
-		m_page = m_tree.find(m_page_address);
+		findPage();
+		if(m_log)
+			m_log->read(m_page_address);
 	}
 
 	m_position = new_position;
@@ -95,11 +263,14 @@ void Stinkhorn<CellT, Dimensions>::Cursor::position(Vector const& new_position)
 template<class CellT, int Dimensions>
 CellT Stinkhorn<CellT, Dimensions>::Cursor::get(Vector const& location) {   
 	if((location >> PageT::bits) == m_page_address) {
+		getPage();
 		if(m_page) {
 			return m_page->get(location & PageT::mask);
 		}
 	}
 
+	if(m_log)
+		m_log->read(location >> PageT::bits);
 	return m_tree.get(location);
 }
 
@@ -114,7 +285,16 @@ void Stinkhorn<CellT, Dimensions>::Cursor::put(Vector const& location, CellT val
 		getPage();
 
 		if(m_page) {
-			m_page->get(location & PageT::mask) = value;
+			if(m_page->shared)
+				findPage(true);
+			if(m_log)
+				m_log->write(location);
+
+			//Pages nothing can execute don't need telling about.
+			if(m_page->usage & PageT::Usage::code)
+				m_tree.code_modified = true;
+			m_page->touch();
+			m_page->set(location & PageT::mask, value);
 			m_tree.update_minmax(location);
 			return;
 		} else if (value == ' ') {
@@ -122,9 +302,18 @@ void Stinkhorn<CellT, Dimensions>::Cursor::put(Vector const& location, CellT val
 		}
 	}
 
+	if(m_log)
+		m_log->write(location);
 	m_tree.put(location, value);
 }
 
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Cursor::log(AccessLog* log) {
+	m_log = log;
+	if(m_log)
+		m_log->read(m_page_address);
+}
+
 template<class CellT, int Dimensions>
 CellT Stinkhorn<CellT, Dimensions>::Cursor::currentCharacter() {
 	getPage();
@@ -137,6 +326,7 @@ CellT Stinkhorn<CellT, Dimensions>::Cursor::currentCharacter() {
 template<class CellT, int Dimensions>
 void Stinkhorn<CellT, Dimensions>::Cursor::teleport() {
 	Vector new_position(m_position + m_direction);
+	getPage();
 	if(m_page) {
 		while(new_position >> PageT::bits == m_page_address) {
 			CellT c = m_page->get(new_position & PageT::mask);
@@ -149,27 +339,35 @@ void Stinkhorn<CellT, Dimensions>::Cursor::teleport() {
 		}
 	}
 
+	if(m_log)
+		m_log->search();
 	bool success = m_tree.advance_cursor(m_position, m_direction, new_position, teleport_instruction);
 	if(success)
 		m_position = new_position;
 }
 
 template<class CellT, int Dimensions>
-stinkhorn::vector3<CellT> Stinkhorn<CellT, Dimensions>::Cursor::leftwards90Z() {
+typename Stinkhorn<CellT, Dimensions>::Vector Stinkhorn<CellT, Dimensions>::Cursor::leftwards90Z() {
 	Vector d = direction();
 	return Vector(d.y, -d.x, 0);
 }
 
 template<class CellT, int Dimensions>
-stinkhorn::vector3<CellT> Stinkhorn<CellT, Dimensions>::Cursor::rightwards90Z() {
+typename Stinkhorn<CellT, Dimensions>::Vector Stinkhorn<CellT, Dimensions>::Cursor::rightwards90Z() {
 	Vector d = direction();
 	return Vector(-d.y, d.x, 0);
 }
 
 template<class CellT, int Dimensions>
 void Stinkhorn<CellT, Dimensions>::Cursor::getPage() {
-	if(!m_page)
-		m_page = m_tree.find(m_page_address);
+	if(!m_page || m_page_copies != m_tree.pages_copied())
+		findPage();
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Cursor::findPage(bool create) {
+	m_page = m_tree.find(m_page_address, create);
+	m_page_copies = m_tree.pages_copied();
 }
 
 INSTANTIATE(class, Cursor);
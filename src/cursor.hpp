@@ -5,6 +5,7 @@
 
 #include "config.hpp"
 #include "vector.hpp"
+#include "thread.hpp"
 
 namespace stinkhorn {
 	/**
@@ -15,6 +16,10 @@ namespace stinkhorn {
 
 	 * The cursor caches the current page in funge space on which it stands. This
 	 * avoids costly tree lookups.
+	 *
+	 * An IP's cursor keeps its position, direction and page in the IP's slot of
+	 * the ThreadTable, where the scheduler can see them; any other cursor,
+	 * including a copy of an IP's, keeps them to itself.
 	 */
 	template<class CellT, int Dimensions>
 	class Stinkhorn<CellT, Dimensions>::Cursor {
@@ -23,13 +28,17 @@ namespace stinkhorn {
 
 	public:
 		Cursor(Tree& tree);
+		Cursor(Tree& tree, ThreadTable& table, typename ThreadTable::Slot slot);
 
 		Cursor(Cursor& other) :
+			m_own(other),
+			m_page(m_own.page),
+			m_page_copies(m_own.page_copies),
+			m_page_address(m_own.page_address),
+			m_position(m_own.position),
+			m_direction(m_own.direction),
 			m_tree(other.m_tree),
-			m_position(other.m_position),
-			m_direction(other.m_direction),
-			m_page_address(other.m_page_address),
-			m_page(other.m_page)
+			m_log(other.m_log)
 		{}
 
 		//Getter/setter for the cursor's position. Note that setting the position
@@ -55,6 +64,28 @@ namespace stinkhorn {
 		//are no instructions found in the path of the cursor.
 		bool advance(bool follow_teleports = true, bool can_wrap = true);
 
+		//Reads a string-mode run beginning at the cursor's position, pushing cells
+		//onto the stack exactly as ticking through them in string mode would (runs
+		//of spaces collapse into one, pending until the next non-space cell), and
+		//stops with the cursor on the closing quote. The current page is scanned
+		//directly; leaving it, wrapping and gaps go through advance(). Returns false
+		//if there is nowhere left to go.
+		bool readString(StackStackT& stack, bool& space);
+
+		//For STRN's G and P: reads the cells eastwards from the cursor's position
+		//up to the first 0 onto the end of str, and writes [first, last) eastwards
+		//from it. Both go a page row at a time. readRow leaves the cursor on the 0,
+		//or returns false if it passes max_x without finding one; writeRow leaves it
+		//just past the last cell written.
+		bool readRow(String& str, CellT max_x);
+		void writeRow(CellT const* first, CellT const* last);
+
+		//For SOCK's R and W: writeBytes is writeRow for bytes, widening them into
+		//cells, and readBytes fills [first, last) by narrowing the cells eastwards
+		//from the cursor, 0s and all.
+		void writeBytes(unsigned char const* first, unsigned char const* last);
+		void readBytes(unsigned char* first, unsigned char* last);
+
 		//Teleports the cursor to the next ; in the funge-space. If one is not found, 
 		//simply arrives at itself, effectively acting as if the instruction was a z.
 		void teleport();
@@ -77,18 +108,47 @@ namespace stinkhorn {
 		void put(Vector const& location, CellT value);
 		void put(CellT value);
 
+		//While log is set, the pages the cursor reads and the cells it writes are
+		//noted in it (see Speculator). readString, readRow and writeRow don't log.
+		void log(AccessLog* log);
+
 	protected:
 		// Like the funge-space advance_cursor, but using page cache more cleverly.
 		bool advance_fast(const Vector& from, Vector& to, bool in_hyperspace, bool can_wrap);
 
+		//Finds the page again if it is missing, or may have been copied (see
+		//Tree::pages_copied).
 		void getPage();
 
+		//Finds the page at m_page_address, for writing to if create is set.
+		void findPage(bool create = false);
+
+		template<class T>
+		void writeCells(T const* first, T const* last);
+
 	private:
-		PageT* m_page;
-		Vector m_page_address,
-			   m_position,
-			   m_direction;
+		Cursor& operator=(Cursor const&);
+
+		//Where a cursor that isn't an IP's keeps what the references below refer to.
+		struct State {
+			PageT* page;
+			unsigned page_copies;
+			Vector page_address, position, direction;
+
+			State() : page(0), page_copies(0), position(0, 0, 0), direction(1, 0, 0) {}
+			State(Cursor const& other)
+				: page(other.m_page), page_copies(other.m_page_copies), page_address(other.m_page_address)
+				, position(other.m_position), direction(other.m_direction)
+			{}
+		} m_own;
+
+		PageT*& m_page;
+		unsigned& m_page_copies;
+		Vector& m_page_address,
+			  & m_position,
+			  & m_direction;
 		Tree& m_tree;
+		AccessLog* m_log;
 	};
 }
 
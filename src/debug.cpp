@@ -509,7 +509,7 @@ namespace stinkhorn {
 			middle.x = toInt(args[0]);
 			middle.y = toInt(args[1]);
 			if(args.size() >= 3 && Dimensions == 3)
-				middle.z = toInt(args[2]);
+				setZ(middle, toInt(args[2]));
 		}
 
 		cx = std::abs(cx);
@@ -622,7 +622,7 @@ namespace stinkhorn {
 				pos.x = boost::lexical_cast<CellT>(args.at(1));
 				pos.y = boost::lexical_cast<CellT>(args.at(2));
 				if(Dimensions == 3)
-					pos.z = boost::lexical_cast<CellT>(args.at(3));
+					setZ(pos, boost::lexical_cast<CellT>(args.at(3)));
 
 				positional_breakpoints.push_back(pos);
 				cerr << "added (" << positional_breakpoints.size() - 1 << ")\n";
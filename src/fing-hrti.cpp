@@ -1,5 +1,6 @@
 #include "fingerprint.hpp"
 #include "context.hpp"
+#include "checkpoint.hpp"
 #include <ctime>
 
 #if defined(WIN32) && !defined(B98_WIN32_DONT_USE_QPC)
@@ -46,6 +47,12 @@ namespace stinkhorn {
 		return static_cast<CellT>(value);
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::TimerFingerprint::markAgo(CellT elapsed) {
+		if(mark())
+			self->marked.QuadPart -= elapsed * self->frequency.QuadPart / 1000000;
+	}
+
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::TimerFingerprint::handleInstruction(CellT instruction, Context& ctx) {    
 		StackStackT& stack = ctx.stack();
@@ -131,6 +138,12 @@ namespace stinkhorn {
 		return 1000000 / CLOCKS_PER_SEC * (clock() - self->marked);
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::TimerFingerprint::markAgo(CellT elapsed) {
+		mark();
+		self->marked -= static_cast<clock_t>(elapsed / (1000000 / CLOCKS_PER_SEC));
+	}
+
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::TimerFingerprint::handleInstruction(CellT instruction, Context& ctx) {    
 		StackStackT& stack = ctx.stack();
@@ -187,6 +200,23 @@ namespace stinkhorn {
 	Stinkhorn<CellT, Dimensions>::TimerFingerprint::~TimerFingerprint() {
 	}
 
+	//A restored mark is as long ago as it was when saved, so T carries on from
+	//where it was.
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::TimerFingerprint::save(CheckpointWriter& out) {
+		CellT elapsed = elapsedTime();
+		out.flag(elapsed != -1);
+		if(elapsed != -1)
+			out.cell(elapsed);
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::TimerFingerprint::restore(CheckpointReader& in) {
+		self->is_marked = false;
+		if(in.flag())
+			markAgo(static_cast<CellT>(in.cell()));
+	}
+
 	template<class CellT, int Dimensions>
 	IdT Stinkhorn<CellT, Dimensions>::TimerFingerprint::id() {
 		return TIMER_FINGERPRINT;
@@ -0,0 +1,41 @@
+#include "fingerprint.hpp"
+#include "context.hpp"
+
+namespace stinkhorn {
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::ModeFingerprint::handleInstruction(CellT instruction, Context& ctx) {
+		StackStackT& stack = ctx.stack();
+
+		switch(instruction) {
+			case 'H':
+				ctx.hoverMode(!ctx.hoverMode());
+				return true;
+
+			case 'I':
+				stack.invertMode(!stack.invertMode());
+				return true;
+
+			case 'Q':
+				stack.queueMode(!stack.queueMode());
+				return true;
+
+			case 'S':
+				ctx.switchMode(!ctx.switchMode());
+				return true;
+		}
+
+		return false;
+	}
+
+	template<class CellT, int Dimensions>
+	IdT Stinkhorn<CellT, Dimensions>::ModeFingerprint::id() {
+		return MODE_FINGERPRINT;
+	}
+
+	template<class CellT, int Dimensions>
+	char const* Stinkhorn<CellT, Dimensions>::ModeFingerprint::handledInstructions() {
+		return "HIQS";
+	}
+}
+
+INSTANTIATE(struct, ModeFingerprint);
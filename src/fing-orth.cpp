@@ -82,7 +82,7 @@ namespace stinkhorn {
 				{
 					String str;
 					stack.readString(str);
-					writeString(std::cout, str);
+					writeString(ctx.interpreter().output(), str);
 					return true;
 				}
 		}
@@ -14,13 +14,19 @@ typedef int socklen_t;
 #include <netinet/ip.h> 
 #include <netinet/tcp.h> 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
 typedef int SOCKET;
 #endif
 
-#include <boost/scoped_array.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <map>
+#include <vector>
 
 namespace stinkhorn {
 	template<class CellT, int Dimensions>
@@ -73,6 +79,144 @@ namespace stinkhorn {
 		CellT cellFromSocket(SOCKET socket) {
 			return socket;
 		}
+
+		//SOCK's sockets don't block: an IP which would have to wait for one is
+		//parked instead (see Interpreter::park), so the others go on running.
+		void setNonBlocking(SOCKET socket) {
+#ifdef B98_WINDOWS
+			u_long on = 1;
+			::ioctlsocket(socket, FIONBIO, &on);
+#else
+			::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL) | O_NONBLOCK);
+#endif
+		}
+
+		bool wouldBlock() {
+#ifdef B98_WINDOWS
+			return ::WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+#endif
+		}
+
+		//When an IP can't be parked (it is the only one running), the instruction
+		//waits here instead, as it would have on a blocking socket.
+		void waitUntilReady(SOCKET socket, bool writing) {
+#ifdef B98_WINDOWS
+			fd_set set;
+			FD_ZERO(&set);
+			FD_SET(socket, &set);
+			::select(0, writing ? 0 : &set, writing ? &set : 0, 0, 0);
+#else
+			pollfd fd;
+			fd.fd = socket;
+			fd.events = writing ? POLLOUT : POLLIN;
+			fd.revents = 0;
+			while(::poll(&fd, 1, -1) < 0 && errno == EINTR)
+				;
+#endif
+		}
+
+		//Fills in the address B and C take, returning false if it is invalid.
+		template<class CellT>
+		bool socketAddress(CellT family, CellT port, CellT address, sockaddr_in& addr) {
+			if(port < 0 || port > 65535 || (family != 1 && family != 2))
+				return false;
+
+			addr.sin_family = family;
+			addr.sin_port = port;
+			addr.sin_addr.s_addr = address;
+			return true;
+		}
+
+		bool connectionMade() {
+#ifdef B98_WINDOWS
+			return ::WSAGetLastError() == WSAEISCONN;
+#else
+			return errno == EISCONN;
+#endif
+		}
+
+		bool stillConnecting() {
+#ifdef B98_WINDOWS
+			int error = ::WSAGetLastError();
+			return error == WSAEWOULDBLOCK || error == WSAEALREADY || error == WSAEINVAL;
+#else
+			return errno == EINPROGRESS || errno == EALREADY || errno == EAGAIN;
+#endif
+		}
+
+		//Starts connecting, or sees how a connection already started is going:
+		//1 once it is made, 0 while it is still being made, and -1 if it failed.
+		int tryConnect(SOCKET socket, sockaddr_in const& addr) {
+			int error = 0;
+			socklen_t length = sizeof error;
+			if(-1 == ::getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) || error)
+				return -1;
+
+			if(0 == ::connect(socket, reinterpret_cast<sockaddr const*>(&addr), sizeof addr) || connectionMade())
+				return 1;
+			return stillConnecting() ? 0 : -1;
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	struct Stinkhorn<CellT, Dimensions>::SockFingerprint::State : IFingerprintState {
+		//Bytes on their way between a socket and funge-space.
+		typedef std::vector<unsigned char> Buffer;
+
+		//A W which has sent some of its bytes, and parked its IP until there is
+		//room for the rest. Its arguments are already off the stack by then.
+		struct Write {
+			SOCKET socket;
+			Buffer* bytes;
+			std::size_t sent;
+		};
+
+		//By IP. Only that IP touches its Write once it is made, so it does so
+		//without the lock, while it sends.
+		std::map<Context const*, Write> writes;
+
+		//Buffers no R or W is using. Each takes one, growing it if it must, and
+		//gives it back, so a program moving bytes in a loop allocates them once.
+		std::vector<Buffer*> spare;
+
+		Buffer* take(std::size_t size) {
+			Buffer* buffer;
+			if(spare.empty()) {
+				buffer = new Buffer;
+			} else {
+				buffer = spare.back();
+				spare.pop_back();
+			}
+
+			buffer->resize(size);
+			return buffer;
+		}
+
+		void give(Buffer* buffer) {
+			spare.push_back(buffer);
+		}
+
+		~State() {
+			for(typename std::map<Context const*, Write>::iterator w = writes.begin(); w != writes.end(); ++w)
+				delete w->second.bytes;
+			for(std::size_t i = 0; i < spare.size(); ++i)
+				delete spare[i];
+		}
+	};
+
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::SockFingerprint::State&
+	Stinkhorn<CellT, Dimensions>::SockFingerprint::state(FingerprintRegistry& registry) {
+		boost::shared_ptr<IFingerprintState> state_ptr(registry.stateForType(typeid(State)));
+		if(!state_ptr.get()) {
+			state_ptr.reset(new State);
+			registry.setStateForType(typeid(State), state_ptr);
+		}
+
+		//The registry keeps it alive for as long as the interpreter.
+		return dynamic_cast<State&>(*state_ptr);
 	}
 
 	//Notes:
@@ -92,11 +236,19 @@ namespace stinkhorn {
 					return true;
 				}
 
-				SOCKET socket = socketFromCell(stack.pop());
+				//The socket stays on the stack while the IP is parked.
+				if(ctx.waitFor(socketFromCell(stack.nth(0))))
+					return true;
+
+				SOCKET listener = socketFromCell(stack.pop());
 				sockaddr_in addr = {0};
 				socklen_t addrlen = sizeof(addr);
-				socket = ::accept(socket, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+				SOCKET socket;
+				while((socket = ::accept(listener, reinterpret_cast<sockaddr*>(&addr), &addrlen)) == -1 && wouldBlock())
+					waitUntilReady(listener, false);
+
 				if(socket != -1) {
+					setNonBlocking(socket);
 					stack.push(addr.sin_port);
 					stack.push(addr.sin_addr.s_addr);
 					stack.push(cellFromSocket<CellT>(socket));
@@ -114,27 +266,44 @@ namespace stinkhorn {
 				}
 
 				sockaddr_in addr = {0};
-				CellT family, port, address = stack.pop();			
-				
-				port = stack.pop();
-				if(port < 0 || port > 65535) 
-					{ cr.reflect(); return true; }
-				
-				family = stack.pop();
-				if(family == 1)
-					addr.sin_family = AF_UNIX;
-				else if(family == 2)
-					addr.sin_family = AF_INET;
-				else
-					{ cr.reflect(); return true; }
-				
-				SOCKET socket = socketFromCell(stack.pop());
-				
-				addr.sin_family = family;
-				addr.sin_port = port;
-				addr.sin_addr.s_addr = address;
+				SOCKET socket = socketFromCell(stack.nth(3));
+				bool valid = socketAddress(stack.nth(2), stack.nth(1), stack.nth(0), addr);
+
+				//C starts connecting with its arguments still on the stack, so that
+				//until the connection is made, the IP can be parked, and then execute
+				//C again to see how it went.
+				int connected = 0;
+				if(valid && instruction == 'C') {
+					connected = tryConnect(socket, addr);
+					if(connected == 0 && ctx.waitFor(socket, true))
+						return true;
+				}
 
-				if(-1 == (instruction == 'B' ? ::bind : ::connect)(socket, reinterpret_cast<sockaddr*>(&addr), sizeof addr))
+				//An invalid port is found before the family is taken.
+				stack.pop();
+				CellT port = stack.pop();
+				if(!valid) {
+					if(port >= 0 && port <= 65535)
+						stack.pop();
+					cr.reflect();
+					return true;
+				}
+				stack.pop();
+				stack.pop();
+
+				if(instruction == 'B') {
+					if(-1 == ::bind(socket, reinterpret_cast<sockaddr*>(&addr), sizeof addr))
+						cr.reflect();
+					return true;
+				}
+
+				//Only when the IP couldn't be parked.
+				while(connected == 0) {
+					waitUntilReady(socket, true);
+					connected = tryConnect(socket, addr);
+				}
+
+				if(connected < 0)
 					cr.reflect();
 				return true;
 			}
@@ -227,6 +396,9 @@ namespace stinkhorn {
 					return true;
 				}
 
+				if(ctx.waitFor(socketFromCell(stack.nth(0))))
+					return true;
+
 				SOCKET socket = socketFromCell(stack.pop());
 				int length = static_cast<int>(stack.pop());
 				Vector to = stack.popVector(Dimensions) + storage_offset;
@@ -234,20 +406,29 @@ namespace stinkhorn {
 				if(length < 0)
 					{ cr.reflect(); return true; }
 
-				boost::scoped_array<unsigned char> data(new unsigned char[length]);
-				int bytes = recv(socket, reinterpret_cast<char*>(data.get()), length, 0);
+				FingerprintRegistry& registry = ctx.owner().interpreter().registry();
+				typename State::Buffer* data;
+				{
+					boost::recursive_mutex::scoped_lock hold(registry.stateLock());
+					//At least a byte, so that there is a first one to point at.
+					data = state(registry).take(std::max(length, 1));
+				}
+
+				unsigned char* first = &(*data)[0];
+				int bytes;
+				while((bytes = ::recv(socket, reinterpret_cast<char*>(first), length, 0)) < 0 && wouldBlock())
+					waitUntilReady(socket, false);
 
 				if(bytes >= 0) {
 					stack.push(bytes);
 					Cursor putter(cr);
 					putter.position(to);
-					for(int i = 0; i < bytes; ++i) {
-						putter.put(putter.position(), data[i]);
-						putter.position(putter.position() + Vector(1, 0, 0));
-					}
+					putter.writeBytes(first, first + bytes);
 				} else 
 					cr.reflect();
 
+				boost::recursive_mutex::scoped_lock hold(registry.stateLock());
+				state(registry).give(data);
 				return true;
 			}
 
@@ -275,9 +456,10 @@ namespace stinkhorn {
 				else { cr.reflect(); return true; }
 
 				SOCKET socket = ::socket(pf, type, protocol);
-				if(socket != -1)
+				if(socket != -1) {
+					setNonBlocking(socket);
 					stack.push(cellFromSocket<CellT>(socket));
-				else
+				} else
 					cr.reflect();
 				return true;
 			}
@@ -289,23 +471,62 @@ namespace stinkhorn {
 					return true;
 				}
 
-				SOCKET socket = socketFromCell(stack.pop());
-				int length = static_cast<int>(stack.pop());
-				Vector from = stack.popVector(Dimensions) + storage_offset;
+				FingerprintRegistry& registry = ctx.owner().interpreter().registry();
+				typename State::Write* write;
+				{
+					boost::recursive_mutex::scoped_lock hold(registry.stateLock());
+					State& sockets = state(registry);
+
+					//An IP parked part way through a W comes back to send the rest.
+					typename std::map<Context const*, typename State::Write>::iterator w = sockets.writes.find(&ctx);
+					if(w != sockets.writes.end()) {
+						write = &w->second;
+					} else {
+						if(ctx.waitFor(socketFromCell(stack.nth(0)), true))
+							return true;
+
+						SOCKET socket = socketFromCell(stack.pop());
+						int length = static_cast<int>(stack.pop());
+						Vector from = stack.popVector(Dimensions) + storage_offset;
+
+						if(length < 0)
+							{ cr.reflect(); return true; }
+
+						typename State::Write start = { socket, sockets.take(length), 0 };
+						write = &sockets.writes.insert(std::make_pair(&ctx, start)).first->second;
+
+						Cursor getter(cr);
+						getter.position(from);
+						if(length)
+							getter.readBytes(&(*write->bytes)[0], &(*write->bytes)[0] + length);
+					}
+				}
 
-				boost::scoped_array<unsigned char> data(new unsigned char[length]);
-				Cursor getter(cr);
-				getter.position(from);
-				for(int i = 0; i < length; ++i) {
-					data[i] = getter.get(getter.position());
-					getter.position(getter.position() + Vector(1, 0, 0));
+				//A non-blocking send takes what fits in the socket's buffer. Until
+				//there is room for the rest, the IP is parked, so the others go on
+				//running, and then executes W again. Only an error stops it short.
+				typename State::Buffer& bytes = *write->bytes;
+				while(write->sent < bytes.size()) {
+					int sent = ::send(write->socket, reinterpret_cast<char*>(&bytes[0]) + write->sent, bytes.size() - write->sent, 0);
+					if(sent >= 0)
+						write->sent += sent;
+					else if(!wouldBlock())
+						break;
+					else if(ctx.waitFor(write->socket, true))
+						return true;
+					else
+						waitUntilReady(write->socket, true);
 				}
 
-				int bytes = ::send(socket, reinterpret_cast<char*>(data.get()), length, 0);
-				if(bytes < 0)
+				if(write->sent == 0 && !bytes.empty())
 					cr.reflect();
 				else
-					stack.push(bytes);
+					stack.push(static_cast<CellT>(write->sent));
+
+				boost::recursive_mutex::scoped_lock hold(registry.stateLock());
+				State& sockets = state(registry);
+				sockets.give(write->bytes);
+				sockets.writes.erase(&ctx);
 				return true;
 			}
 		}
@@ -326,46 +547,25 @@ namespace stinkhorn {
 
 		switch(instruction) {
 			case 'A': 
-			{
-				//This is probably quite optimisable by sticking it inside of the StackStack instead of here.
-				String first, second;
-				stack.readString(first);
-				stack.readString(second);
-				first.append(second);
-				stack.pushString(first);
+				stack.strnAppend();
 				return true;
-			}
 
 			case 'C':
-			{
-				String first, second;
-				stack.readString(first);
-				stack.readString(second);
-				stack.push(first.compare(second));
+				stack.push(stack.strnCompare());
 				return true;
-			}
 
 			case 'D':
 			{
 				String str;
 				stack.readString(str);
-				writeString(std::cout, str);
+				writeString(ctx.interpreter().output(), str);
 				return true;
 			}
 
 			case 'F':
-			{
-				String first, second;
-				stack.readString(first);
-				stack.readString(second);
-				typename String::size_type i = first.find(second);
-				if(i == String::npos) {
+				if(!stack.strnFind())
 					stack.push(0);
-				} else {
-					stack.pushString(first.substr(i));
-				}
 				return true;
-			}
 
 			case 'G': 
 			{
@@ -375,32 +575,26 @@ namespace stinkhorn {
 				Vector min, max;
 				ctx.fungeSpace().get_minmax(min, max);
 
-				while(true) {
-					Vector pos = getter.position();
-
-					//Guard against going off the edge of funge-space.
-					//Required to get to the end of mycology, even though it is UNDEF.
-					if(pos.x > max.x) {
-						cr.reflect();
-						return true;
-					}
-
-					CellT c = getter.currentCharacter();
-					if(c)
-						str += c;
-					else
-						break;
-					getter.position(pos + Vector(1, 0, 0));
+				//Guard against going off the edge of funge-space.
+				//Required to get to the end of mycology, even though it is UNDEF.
+				if(!getter.readRow(str, max.x)) {
+					cr.reflect();
+					return true;
 				}
+
 				stack.pushString(str);
 				return true;
 			}
 
 			case 'I': 
 			{
+				if(ctx.waitFor(0))
+					return true;
+
+				std::istream& input = ctx.interpreter().input();
 				std::string in;
-				getline(std::cin, in);
-				if(!std::cin) {
+				getline(input, in);
+				if(!input) {
 					cr.reflect();
 				} else {
 					String str(in.begin(), in.end());
@@ -411,34 +605,22 @@ namespace stinkhorn {
 
 			case 'L':
 			{
-				String str;
 				CellT n = stack.pop();
-				stack.readString(str);
-				if(n < 0) {
+				if(!stack.strnLeft(n))
 					cr.reflect();
-				} else {
-					str = str.substr(0, n);
-					stack.pushString(str);
-				}
 				return true;
 			}
 
 			case 'M':
 			{
-				String str;
 				CellT n = stack.pop();
 				CellT s = stack.pop();
-				stack.readString(str);
 
 				//000M is self-contradictory - it should both return 0 (because we are requesting zero characters)
 				//and reflect (because the start is beyond the end of the string). However, since the behaviour is
 				//not terribly well-defined anyway, it's probably better to choose returning the empty string.
-				if(n < 0 || s < 0 || (!str.empty() && s >= (CellT)str.size())) {
+				if(!stack.strnMid(s, n))
 					cr.reflect();
-				} else {
-					str = str.substr(s, n);
-					stack.pushString(str);
-				}
 				return true;
 			}
 
@@ -457,10 +639,7 @@ namespace stinkhorn {
 				Cursor putter(cr);
 				putter.position(to + ctx.storageOffset());
 
-				for(typename String::size_type i = 0; i < str.size(); ++i) {
-					putter.put(putter.position(), str[i]);
-					putter.position(putter.position() + Vector(1, 0, 0));
-				}
+				putter.writeRow(str.data(), str.data() + str.size());
 				putter.put(putter.position(), 0);
 				return true;
 			}
@@ -468,16 +647,8 @@ namespace stinkhorn {
 			case 'R':
 			{
 				CellT n = stack.pop();
-				String str;
-				stack.readString(str);
-
-				if(n < 0) {
+				if(!stack.strnRight(n))
 					cr.reflect();
-				} else {
-					str = str.substr(std::max<typename String::size_type>(str.size() - n, 0));
-					stack.pushString(str);
-				}
-
 				return true;
 			}
 
@@ -1,6 +1,7 @@
 #include "fingerprint.hpp"
 #include "cursor.hpp"
 #include "context.hpp"
+#include "checkpoint.hpp"
 #include <vector>
 #include <limits>
 
@@ -13,6 +14,7 @@ namespace stinkhorn {
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::RefcFingerprint::handleInstruction(CellT instruction, Context &ctx) {
 		FingerprintRegistry& registry = ctx.owner().interpreter().registry();
+		boost::recursive_mutex::scoped_lock hold(registry.stateLock());
 		boost::shared_ptr<IFingerprintState> state_ptr(registry.stateForType(typeid(State)));
 
 		if(!state_ptr.get()) {
@@ -49,6 +51,34 @@ namespace stinkhorn {
 		return true;
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::RefcFingerprint::saveState(FingerprintRegistry& registry, CheckpointWriter& out) {
+		boost::recursive_mutex::scoped_lock hold(registry.stateLock());
+		boost::shared_ptr<IFingerprintState> state_ptr(registry.stateForType(typeid(State)));
+		State* state = dynamic_cast<State*>(state_ptr.get());
+
+		out.count(state ? state->vectors.size() : 0);
+		if(state) {
+			for(typename std::vector<Vector>::const_iterator v = state->vectors.begin(); v != state->vectors.end(); ++v)
+				out.vector(*v);
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::RefcFingerprint::restoreState(FingerprintRegistry& registry, CheckpointReader& in) {
+		std::size_t count = static_cast<std::size_t>(in.count(Dimensions));
+		if(!count)
+			return;
+
+		boost::shared_ptr<State> state(new State);
+		state->vectors.resize(count);
+		for(typename std::vector<Vector>::iterator v = state->vectors.begin(); v != state->vectors.end(); ++v)
+			in.vector(*v);
+
+		boost::recursive_mutex::scoped_lock hold(registry.stateLock());
+		registry.setStateForType(typeid(State), state);
+	}
+
 	template<class CellT, int Dimensions>
 	IdT Stinkhorn<CellT, Dimensions>::RefcFingerprint::id() {
 		return REFC_FINGERPRINT;
@@ -7,14 +7,14 @@
 
 namespace stinkhorn { namespace {
 	template<class T, int D>
-	void debug_funge_space_area_numeric(typename Stinkhorn<T, D>::Tree& fs, vector3<T> const& from, vector3<T> const& size) {
+	void debug_funge_space_area_numeric(typename Stinkhorn<T, D>::Tree& fs, vectorN<T, D> const& from, vectorN<T, D> const& size) {
 		typename Stinkhorn<T, D>::Cursor cr(fs);
 
-		T x, y, z;
-		for(z = 0; z < size.z; ++z) {
+		T x, y, z, depth = D == 2 ? 1 : getZ(size);
+		for(z = 0; z < depth; ++z) {
 			for(y = 0; y < size.y; ++y) {
 				for(x = 0; x < size.x; ++x) {
-					vector3<T> r(x, y, z);
+					vectorN<T, D> r(x, y, z);
 
 					cr.position(r + from);					
 					std::cerr << cr.currentCharacter() << ' ';
@@ -40,23 +40,23 @@ namespace stinkhorn {
 		Vector size = ctx.stack().popVector(Dimensions);
 		const Vector from = ctx.stack().popVector(Dimensions);
 
-		if(Dimensions == 2)
-			size.z = 1;
+		//A 2D vector has no z component, so treat its area as one cell deep.
+		const CellT depth = Dimensions == 2 ? 1 : getZ(size);
 
 		//Probably a programmer error
-		if(size.x < 0 || size.y < 0 || size.z < 0) {
+		if(size.x < 0 || size.y < 0 || depth < 0) {
 			ctx.cursor().reflect();
 			return;
 		}
 
-		if(size.x == 0 || size.y == 0 || size.z == 0)
+		if(size.x == 0 || size.y == 0 || depth == 0)
 			return; //Nothing to do
 
 		Cursor source_cursor(ctx.cursor());
 		Cursor dest_cursor(source_cursor);
 
 		CellT x, y, z;
-		for(z = 0; z < size.z; ++z) {
+		for(z = 0; z < depth; ++z) {
 			for(y = 0; y < size.y; ++y) {
 				for(x = 0; x < size.x; ++x) {
 					Vector offset(x, y, z);
@@ -86,20 +86,20 @@ namespace stinkhorn {
 
 		CellT value = ctx.stack().pop();
 
-		if(Dimensions == 2)
-			size.z = 1;
+		//A 2D vector has no z component, so treat its area as one cell deep.
+		const CellT depth = Dimensions == 2 ? 1 : getZ(size);
 
 		//Probably a programmer error
-		if(size.x < 0 || size.y < 0 || size.z < 0) {
+		if(size.x < 0 || size.y < 0 || depth < 0) {
 			ctx.cursor().reflect();
 			return;
 		}
 
-		if(size.x == 0 || size.y == 0 || size.z == 0)
+		if(size.x == 0 || size.y == 0 || depth == 0)
 			return; //Nothing to do
 
 		CellT x, y, z;
-		for(z = 0; z < size.z; ++z) {
+		for(z = 0; z < depth; ++z) {
 			for(y = 0; y < size.y; ++y) {
 				for(x = 0; x < size.x; ++x) {
 					Vector pos = Vector(x, y, z) + from;
@@ -133,8 +133,8 @@ namespace stinkhorn {
 				initial.x = movement_direction.x > 0 ? max.x : min.x;
 			} else if(movement_direction.y) {
 				initial.y = movement_direction.y > 0 ? max.y : min.y;
-			} else if(movement_direction.z) {
-				initial.z = movement_direction.z > 0 ? max.z : min.z;
+			} else if(getZ(movement_direction)) {
+				setZ(initial, getZ(movement_direction) > 0 ? getZ(max) : getZ(min));
 			} else {
 				if(ctx.interpreter().warnings()) {
 					std::cerr << "TOYS: J or O instruction passed invalid movement direction " << movement_direction << std::endl;
@@ -384,7 +384,7 @@ namespace stinkhorn {
 						stack.push(value);
 
 						if(Dimensions > 2)
-							stack.push(pos.z);
+							stack.push(getZ(pos));
 						stack.push(pos.y);
 						stack.push(pos.x);
 
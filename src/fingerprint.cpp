@@ -9,6 +9,7 @@
 #include <ctime>   //clock
 #include <cctype>  //isupper
 #include <cstring> //strstr
+#include <cstdlib> //system
 #include <algorithm>
 
 using namespace boost;
@@ -17,11 +18,13 @@ using namespace std;
 namespace stinkhorn {
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::FingerprintRegistry::addSource(IFingerprintSource* source) {
+		recursive_mutex::scoped_lock hold(lock);
 		sources.push_back(source);
 	}
 
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::FingerprintRegistry::removeSource(IFingerprintSource* source) {
+		recursive_mutex::scoped_lock hold(lock);
 		typename vector<IFingerprintSource*>::iterator itr = remove(sources.begin(), sources.end(), source);
 		sources.erase(itr, sources.end());
 	}
@@ -30,6 +33,7 @@ namespace stinkhorn {
 	typename Stinkhorn<CellT, Dimensions>::IFingerprint* 
 	Stinkhorn<CellT, Dimensions>::FingerprintRegistry::createFingerprint(IdT id) 
 	{
+		recursive_mutex::scoped_lock hold(lock);
 		for(typename vector<IFingerprintSource*>::iterator itr = sources.begin();
 			itr != sources.end();
 			++itr)
@@ -45,6 +49,7 @@ namespace stinkhorn {
 	template<class CellT, int Dimensions>
 	shared_ptr<typename Stinkhorn<CellT, Dimensions>::IFingerprintState> 
 	Stinkhorn<CellT, Dimensions>::FingerprintRegistry::stateForType(type_info const& type) {
+		recursive_mutex::scoped_lock hold(lock);
 		return this->states[&type];
 	}
 
@@ -52,9 +57,15 @@ namespace stinkhorn {
 	void Stinkhorn<CellT, Dimensions>::FingerprintRegistry::setStateForType(type_info const& type, 
 		shared_ptr<IFingerprintState> const& value) 
 	{
+		recursive_mutex::scoped_lock hold(lock);
 		this->states[&type] = value;
 	}
 
+	template<class CellT, int Dimensions>
+	recursive_mutex& Stinkhorn<CellT, Dimensions>::FingerprintRegistry::stateLock() {
+		return lock;
+	}
+
 	template<class CellT, int Dimensions>
 	typename Stinkhorn<CellT, Dimensions>::IFingerprint*
 	Stinkhorn<CellT, Dimensions>::DefaultFingerprintSource::createFingerprint(IdT id) 
@@ -70,6 +81,7 @@ namespace stinkhorn {
 			case BOOL_FINGERPRINT: return new BoolFingerprint;
 			case SOCK_FINGERPRINT: return new SockFingerprint;
 			case STRN_FINGERPRINT: return new StrnFingerprint;
+			case MODE_FINGERPRINT: return new ModeFingerprint;
 		}
 		return 0;
 	}
@@ -90,21 +102,20 @@ namespace stinkhorn {
 				ctx.space(false);
 				return true;
 
-				//TODO: These will need tweaking to work in hover mode
 			case '>':
-				cr.direction(Vector(1, 0, 0));
+				go(ctx, Vector(1, 0, 0));
 				return true;
 
 			case '<':
-				cr.direction(Vector(-1, 0, 0));
+				go(ctx, Vector(-1, 0, 0));
 				return true;
 
 			case 'v':
-				cr.direction(Vector(0, 1, 0));
+				go(ctx, Vector(0, 1, 0));
 				return true;
 
 			case '^':
-				cr.direction(Vector(0, -1, 0));
+				go(ctx, Vector(0, -1, 0));
 				return true;
 
 			case '?': 
@@ -133,11 +144,11 @@ namespace stinkhorn {
 				return true;
 
 			case '_':
-				cr.direction(Vector( (stack.pop() ? -1 : 1 ), 0, 0) );
+				go(ctx, Vector( (stack.pop() ? -1 : 1 ), 0, 0) );
 				return true;
 
 			case '|':
-				cr.direction(Vector( 0, (stack.pop() ? -1 : 1 ), 0) );
+				go(ctx, Vector( 0, (stack.pop() ? -1 : 1 ), 0) );
 				return true;
 
 			case '0': stack.push(0); return true;
@@ -153,10 +164,14 @@ namespace stinkhorn {
 
 			case '&': 
 				{
+					if(ctx.waitFor(0))
+						return true;
+
+					std::istream& input = ctx.interpreter().input();
 					CellT x;
-					cin >> x;
+					input >> x;
 
-					if(cin)
+					if(input)
 						stack.push(x);
 					else
 						cr.reflect();
@@ -166,8 +181,12 @@ namespace stinkhorn {
 
 			case '~': 
 				{
-					CellT c = cin.get();
-					if(cin)
+					if(ctx.waitFor(0))
+						return true;
+
+					std::istream& input = ctx.interpreter().input();
+					CellT c = input.get();
+					if(input)
 						stack.push(c);
 					else
 						cr.reflect();
@@ -176,13 +195,13 @@ namespace stinkhorn {
 
 			case '.': 
 				{
-					cout << static_cast<long>(stack.pop()) << ' ';
+					ctx.interpreter().output() << static_cast<long>(stack.pop()) << ' ';
 					return true;
 				}
 
 			case ',':
 				{
-					cout << char(stack.pop());
+					ctx.interpreter().output() << char(stack.pop());
 					return true;
 				}
 
@@ -216,7 +235,7 @@ namespace stinkhorn {
 					CellT b = stack.pop();
 					if(b == 0) {
 						stack.pop();
-						stack.push(askForDivideByZero());
+						stack.push(askForDivideByZero(ctx));
 					} else {
 						stack.push(stack.pop() / b);
 					}
@@ -231,7 +250,7 @@ namespace stinkhorn {
 					CellT b = stack.pop();
 					if(b == 0) {
 						stack.pop();
-						stack.push(askForDivideByZero());
+						stack.push(askForDivideByZero(ctx));
 					} else {
 						stack.push(stack.pop() % b);
 					}
@@ -295,13 +314,23 @@ namespace stinkhorn {
 	}
 
 	template<class CellT, int Dimensions>
-	CellT Stinkhorn<CellT, Dimensions>::Befunge93Fingerprint::askForDivideByZero() {
+	CellT Stinkhorn<CellT, Dimensions>::Befunge93Fingerprint::askForDivideByZero(Context& ctx) {
 		cerr << "A division by zero has occurred. What do you want the result of this calculation to be?\n";
 		CellT x;
-		cin >> x;
+		ctx.interpreter().input() >> x;
 		return x;
 	}
 
+	//In hover mode (see the MODE fingerprint) the arrows add to the delta instead of setting it.
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Befunge93Fingerprint::go(Context& ctx, Vector const& delta) {
+		Cursor& cr = ctx.cursor();
+		if(ctx.hoverMode())
+			cr.direction(cr.direction() + delta);
+		else
+			cr.direction(delta);
+	}
+
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::Befunge93Fingerprint::onlySemantics() {
 		return false;
@@ -318,12 +347,36 @@ namespace stinkhorn {
 		return false;
 	}
 
+	namespace {
+		//The instruction that replaces each of [, ], {, }, ( and ) in switch mode.
+		template<class CellT>
+		CellT switchPartner(CellT instruction) {
+			switch(instruction) {
+				case '[': return ']';
+				case ']': return '[';
+				case '{': return '}';
+				case '}': return '{';
+				case '(': return ')';
+				case ')': return '(';
+			}
+			return 0;
+		}
+	}
+
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::handleInstruction(CellT instruction, Context& ctx) {
 		bool failure = false;
 		Cursor& cr = ctx.cursor();
 		StackStackT& stack = ctx.stack();
 
+		//In switch mode (see the MODE fingerprint) the paired instructions overwrite
+		//themselves with their partners as they are executed.
+		if(ctx.switchMode()) {
+			CellT partner = switchPartner(instruction);
+			if(partner)
+				cr.put(partner);
+		}
+
 		switch(instruction) {
 			/* Now, I'm not entirely sure how # works in funge-98. The spec says:
 			*     The # "Trampoline" instruction moves the IP one position beyond
@@ -453,8 +506,7 @@ namespace stinkhorn {
 					assert(cr.position() == k_pos);
 					assert(instruction != ' ' && instruction != ';');
 
-					while(count--)
-						ctx.owner().execute(instruction);
+					iterate(instruction, count, ctx);
 
 					//This code is no longer necessary IF k does not move past the instruction.
 					//if(k_pos == cr.position() && initial_dir == cr.direction())
@@ -552,6 +604,14 @@ namespace stinkhorn {
 				{
 					CellT info = stack.pop();
 					size_t ss = stack.topStackSize();
+
+					//A single item can be worked out without pushing all the others, unless
+					//queue/invert mode would make the pushes land somewhere unusual.
+					if(info >= 10 && !stack.invertMode() && !stack.queueMode()) {
+						stack.push(infoCell(static_cast<size_t>(info - 1), ctx)); //cast: info > 0
+						return true;
+					}
+
 					if(info <= 0) {
 						int x = 20;
 						while(x)
@@ -649,7 +709,7 @@ namespace stinkhorn {
 
 					Vector location;
 					if(Dimensions > 2)
-						location.z = stack.pop();
+						setZ(location, stack.pop());
 
 					location.y = stack.pop();    
 					location.x = stack.pop();
@@ -694,12 +754,12 @@ namespace stinkhorn {
 						stack.push(size.x - 1);
 						stack.push(size.y - 1);
 						if(Dimensions > 2)
-							stack.push(size.z - 1);
+							stack.push(getZ(size) - 1);
 
 						stack.push(location.x);
 						stack.push(location.y);
 						if(Dimensions > 2)
-							stack.push(location.z);
+							stack.push(getZ(location));
 
 						return true;
 					}
@@ -722,16 +782,16 @@ namespace stinkhorn {
 					flags = static_cast<int>(stack.pop());
 
 					if(Dimensions > 2)
-						location.z = stack.pop();
+						setZ(location, stack.pop());
 					location.y = stack.pop();    
 					location.x = stack.pop();
 
 					if(Dimensions > 2)
-						size.z = stack.pop();
+						setZ(size, stack.pop());
 					size.y = stack.pop();    
 					size.x = stack.pop();
 
-					if(size.x < 0 || size.y < 0 || size.z < 0) {
+					if(size.x < 0 || size.y < 0 || getZ(size) < 0) {
 						failure = true;
 						break;
 					}
@@ -797,7 +857,7 @@ namespace stinkhorn {
 
 					std::string command;
 					stack.readString(command);
-					int rv = system(command.c_str());
+					int rv = std::system(command.c_str());
 					stack.push(rv);
 					return true;
 				}
@@ -819,6 +879,87 @@ namespace stinkhorn {
 		return this->Stinkhorn<CellT, Dimensions>::Befunge93Fingerprint::handleInstruction(instruction, ctx);
 	}
 
+	/**
+	Executes instruction count times on behalf of k. Instructions which only move
+	cells around on the stack (and #) are done in one step; the rest are sent 
+	directly to whichever fingerprint handled the first execution, rather than
+	searching the fingerprint stack every time.
+
+	Pushing digits, $ and n come out the same in invert and queue mode (which
+	pushRepeated and discard follow). : and \ only do when both modes are on or
+	both off, so that pop and push work at the same end of the stack.
+	**/
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::iterate(CellT instruction, CellT count, Context& ctx) {
+		Cursor& cr = ctx.cursor();
+		StackStackT& stack = ctx.stack();
+		std::size_t n = static_cast<std::size_t>(count); //cast: count > 0
+
+		switch(instruction) {
+			case '$':
+				stack.discard(n);
+				return;
+
+			case '0': case '1': case '2': case '3': case '4':
+			case '5': case '6': case '7': case '8': case '9':
+				stack.pushRepeated(instruction - '0', n);
+				return;
+
+			case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
+				stack.pushRepeated(instruction - 'a' + 10, n);
+				return;
+
+			case 'n':
+				stack.clearTopStack();
+				return;
+
+			case '#':
+				cr.position(cr.position() + cr.direction() * count);
+				return;
+
+			case 'z':
+				return;
+		}
+
+		if(stack.invertMode() == stack.queueMode()) {
+			switch(instruction) {
+				case ':':
+					stack.pushRepeated(stack.pop(), n + 1);
+					return;
+
+				case '\\':
+					//Swapping is its own inverse once there are two cells to swap.
+					if(stack.topStackSize() < 2) {
+						ctx.execute(instruction);
+						n--;
+					}
+					if(n % 2)
+						ctx.execute(instruction);
+					return;
+			}
+		}
+
+		//These change the fingerprint stack, so the handler can't be kept.
+		if(instruction == '(' || instruction == ')') {
+			while(count--)
+				ctx.execute(instruction);
+			return;
+		}
+
+		IFingerprint* fp = ctx.dispatch(instruction);
+		if(!fp)
+			return; //Nobody handles it, so there's nothing to repeat.
+
+		//If it turns the instruction down part-way, the rest go the long way round.
+		for(--count; count; --count) {
+			if(!fp->handleInstruction(instruction, ctx))
+				break;
+		}
+
+		for(; count; --count)
+			ctx.execute(instruction);
+	}
+
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::doInfo(int info, Context& ctx, bool all, size_t initial_top_stack_size) {
 		StackStackT& stack = ctx.stack();
@@ -898,7 +1039,7 @@ namespace stinkhorn {
 					stack.push(p.x);
 					stack.push(p.y);
 					if(Dimensions > 2)
-						stack.push(p.z);
+						stack.push(getZ(p));
 					return;
 				}
 
@@ -908,7 +1049,7 @@ namespace stinkhorn {
 					stack.push(d.x);
 					stack.push(d.y);
 					if(Dimensions > 2)
-						stack.push(d.z);
+						stack.push(getZ(d));
 					return;
 				}
 
@@ -918,7 +1059,7 @@ namespace stinkhorn {
 					stack.push(so.x);
 					stack.push(so.y);
 					if(Dimensions > 2)
-						stack.push(so.z);
+						stack.push(getZ(so));
 					return;
 				}
 
@@ -930,7 +1071,7 @@ namespace stinkhorn {
 					stack.push(min.x);
 					stack.push(min.y);
 					if(Dimensions > 2)
-						stack.push(min.z);
+						stack.push(getZ(min));
 					return;
 				}
 
@@ -950,7 +1091,7 @@ namespace stinkhorn {
 					stack.push(size.x);
 					stack.push(size.y);
 					if(Dimensions > 2)
-						stack.push(size.z);
+						stack.push(getZ(size));
 					return;
 				}
 
@@ -994,42 +1135,125 @@ namespace stinkhorn {
 				}
 
 				
+			//Command line arguments and environment variables (8-bit) don't change while the
+			//program runs, so they are pushed from cells encoded the first time they're asked for.
 			case 19: 
 				{
-					stack.push(0);
-					stack.push(0);
-
-					vector<string> args;
-					ctx.owner().interpreter().getArguments(args);
-					for(string::size_type i = 0; i < args.size(); ++i) {
-						string& arg = args[i];
-						stack.push(0);
-						for(string::size_type j = arg.length(); j; --j)
-							stack.push(arg[j - 1]);
-					}
+					InfoCache& cache = infoCache(ctx);
+					stack.pushRange(cache.arguments.begin(), cache.arguments.end());
 					return;
 				}
 
-			//Environment variables (8-bit)
 			case 20: 
 				{
-					char** envp = ctx.owner().interpreter().environment();
-					
-					stack.push(0);
+					InfoCache& cache = infoCache(ctx);
+					stack.pushRange(cache.environment.begin(), cache.environment.end());
+					return;
+				}
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	struct Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::InfoCache : IFingerprintState {
+		//Cells in the order they are pushed, so the last one ends up on top.
+		std::vector<CellT> arguments, environment;
+	};
+
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::InfoCache&
+	Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::infoCache(Context& ctx)
+	{
+		FingerprintRegistry& registry = ctx.owner().interpreter().registry();
+		recursive_mutex::scoped_lock hold(registry.stateLock());
+		boost::shared_ptr<IFingerprintState> state_ptr(registry.stateForType(typeid(InfoCache)));
+
+		if(!state_ptr.get()) {
+			InfoCache* cache = new InfoCache;
+			state_ptr.reset(cache);
+			registry.setStateForType(typeid(InfoCache), state_ptr);
+
+			cache->arguments.push_back(0);
+			cache->arguments.push_back(0);
+
+			vector<string> args;
+			ctx.owner().interpreter().getArguments(args);
+			for(string::size_type i = 0; i < args.size(); ++i) {
+				string& arg = args[i];
+				cache->arguments.push_back(0);
+				for(string::size_type j = arg.length(); j; --j)
+					cache->arguments.push_back(arg[j - 1]);
+			}
+
+			cache->environment.push_back(0);
+
+			for(char** envp = ctx.owner().interpreter().environment(); *envp; ++envp) {
+				char* entry = *envp;
+				size_t length = strlen(entry);
+				for(size_t i = 0; i <= length; ++i) //Include the null terminator.
+					cache->environment.push_back(entry[length - i]);
+			}
+		}
 
-					for(; *envp; ++envp) {
-						char* entry = *envp;
-						if(!entry)
-							break;
+		return dynamic_cast<InfoCache&>(*state_ptr);
+	}
+
+	//The number of cells doInfo pushes for an item.
+	template<class CellT, int Dimensions>
+	size_t Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::infoSize(int info, Context& ctx) {
+		switch(info) {
+			case 10: case 11: case 12: case 13: case 14:
+				return Dimensions;
+			case 18:
+				return ctx.stack().stackCount();
+			case 19:
+				return infoCache(ctx).arguments.size();
+			case 20:
+				return infoCache(ctx).environment.size();
+		}
+		return 1;
+	}
 
-						size_t length = strlen(entry);
-						for(size_t i = 0; i <= length; ++i) //Include the null terminator.
-							stack.push(entry[length - i]);
+	/**
+	Works out what nth(index) would be if all of y's items were pushed, without
+	pushing them. Items that don't live in the cache are at most a vector long, 
+	so they are pushed on their own and picked from the stack. Past the end of
+	the items, y reads the stack from before it was executed.
+	**/
+	template<class CellT, int Dimensions>
+	CellT Stinkhorn<CellT, Dimensions>::Befunge98Fingerprint::infoCell(size_t index, Context& ctx) {
+		StackStackT& stack = ctx.stack();
+
+		for(int info = 1; info <= 20; ++info) {
+			size_t size = infoSize(info, ctx);
+			if(index >= size) {
+				index -= size;
+				continue;
+			}
+
+			//Cells are counted from the top, so index 0 is the last one pushed.
+			switch(info) {
+				case 18:
+					{
+						vector<size_t> stack_sizes;
+						stack.getStackSizes(back_inserter(stack_sizes));
+						return CellT(stack_sizes[size - 1 - index]);
 					}
 
-					return;
-				}
+				case 19:
+					return infoCache(ctx).arguments[size - 1 - index];
+
+				case 20:
+					return infoCache(ctx).environment[size - 1 - index];
+			}
+
+			size_t ss = stack.topStackSize();
+			doInfo(info, ctx, false, 0);
+			CellT c = stack.nth(index);
+			stack.resizeTopStack(ss);
+			return c;
 		}
+
+		return stack.nth(index);
 	}
 
 	template<class CellT, int Dimensions>
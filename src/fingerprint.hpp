@@ -5,6 +5,8 @@
 
 #include "boost/shared_ptr.hpp"
 #include "boost/intrusive_ptr.hpp"
+#include "boost/detail/atomic_count.hpp"
+#include "boost/thread/recursive_mutex.hpp"
 #include <cassert>
 #include <typeinfo>
 #include <map>
@@ -20,6 +22,7 @@ namespace stinkhorn {
 			REFC_FINGERPRINT = 0x52454643,
 			ORTH_FINGERPRINT = 0x4F525448,
 			MODU_FINGERPRINT = 0x4D4F4455,
+			MODE_FINGERPRINT = 0x4D4F4445,
 			ROMA_FINGERPRINT = 0x524f4d41,
 			//RC/Funge-98 fingerprints
 			// http://www.elf-emulation.com/funge/rcsfingers.html
@@ -97,9 +100,15 @@ namespace stinkhorn {
 			return id == this->id();				
 		}
 
+		//A checkpoint (see checkpoint.hpp) saves whatever a loaded fingerprint
+		//keeps, and restores it into a new one. Most keep nothing.
+		virtual void save(CheckpointWriter&) {}
+		virtual void restore(CheckpointReader&) {}
+
 		void addRef() { 
-			referenceCount++;
-			assert(referenceCount); //Perhaps this should be in release mode too
+			long count = ++referenceCount;
+			assert(count); //Perhaps this should be in release mode too
+			(void)count;
 		}
 
 		unsigned long release() { 
@@ -114,7 +123,8 @@ namespace stinkhorn {
 		virtual ~IFingerprint() {}
 	
 	private:
-		unsigned long referenceCount;
+		//IPs share their fingerprints, and under --parallel they may be on different threads.
+		boost::detail::atomic_count referenceCount;
 	};
 
 	template<class CellT, int Dimensions>
@@ -122,10 +132,13 @@ namespace stinkhorn {
 		: public IFingerprint
 	{
 		bool handleInstruction(CellT instruction, Context& ctx);
-		CellT askForDivideByZero();
+		CellT askForDivideByZero(Context& ctx);
 		IdT id();
 		bool onlySemantics();
 		bool is(IdT id);
+
+	protected:
+		void go(Context& ctx, Vector const& delta);
 	};
 
 	template<class CellT, int Dimensions>
@@ -134,7 +147,13 @@ namespace stinkhorn {
 	{
 		bool handleInstruction(CellT instruction, Context& ctx);
 	private:
+		struct InfoCache;
+
 		void doInfo(int info, Context& ctx, bool all, std::size_t initial_top_stack_size);
+		std::size_t infoSize(int info, Context& ctx);
+		CellT infoCell(std::size_t index, Context& ctx);
+		InfoCache& infoCache(Context& ctx);
+		void iterate(CellT instruction, CellT count, Context& ctx);
 	};
 
 	template<class CellT, int Dimensions>
@@ -158,8 +177,15 @@ namespace stinkhorn {
 		bool mark();
 		CellT elapsedTime();
 
+		void save(CheckpointWriter& out);
+		void restore(CheckpointReader& in);
+
 	private:
 		struct state;
+
+		//Marks the time elapsed microseconds ago.
+		void markAgo(CellT elapsed);
+
 		std::auto_ptr<state> self;
 	};
 
@@ -189,6 +215,11 @@ namespace stinkhorn {
 		char const* handledInstructions();
 
 		struct State;
+
+		//The vectors R has handed out belong to the interpreter, not to any one
+		//REFC, so a checkpoint saves them separately.
+		static void saveState(FingerprintRegistry& registry, CheckpointWriter& out);
+		static void restoreState(FingerprintRegistry& registry, CheckpointReader& in);
 	};
 
 	template<class CellT, int Dimensions>
@@ -213,6 +244,15 @@ namespace stinkhorn {
 		char const* handledInstructions();
 	};
 
+	template<class CellT, int Dimensions>
+	struct Stinkhorn<CellT, Dimensions>::ModeFingerprint
+		: public IFingerprint
+	{
+		bool handleInstruction(CellT instruction, Context& ctx);
+		IdT id();
+		char const* handledInstructions();
+	};
+
 	template<class CellT, int Dimensions>
 	struct Stinkhorn<CellT, Dimensions>::ModuFingerprint
 		: public IFingerprint 
@@ -242,6 +282,14 @@ namespace stinkhorn {
 		bool handleInstruction(CellT instruction, Context& ctx);
 		char const* handledInstructions();
 		IdT id() { return SOCK_FINGERPRINT; }
+
+		//The buffers R and W move bytes through, and the W's still sending, which
+		//belong to the interpreter rather than to any one SOCK.
+		struct State;
+
+	private:
+		//Call with the registry's stateLock held.
+		static State& state(FingerprintRegistry& registry);
 	};
 
 	template<class CellT, int Dimensions>
@@ -294,7 +342,12 @@ namespace stinkhorn {
 		boost::shared_ptr<IFingerprintState> stateForType(std::type_info const& type);
 		void setStateForType(std::type_info const& type, boost::shared_ptr<IFingerprintState> const& value);
 
+		///Held while using interpreter-global state, which IPs running under
+		///--parallel may otherwise change at the same time.
+		boost::recursive_mutex& stateLock();
+
 	private:
+		boost::recursive_mutex lock;
 		std::map<std::type_info const*, boost::shared_ptr<IFingerprintState> > states;
 		std::vector<IFingerprintSource*> sources;
 	};
@@ -1,37 +1,53 @@
 #include "fingerprint_stack.hpp"
 
 #include <algorithm>
-#include <iomanip>
 
-using std::map;
 using std::vector;
-using std::setbase;
-using std::setw;
 
 namespace stinkhorn {
 	template<class CellT, int Dimensions>
-	Stinkhorn<CellT, Dimensions>::FingerprintStack::FingerprintStack(FingerprintRegistry& registry) 
-		: registry(registry) 
+	Stinkhorn<CellT, Dimensions>::FingerprintStack::FingerprintStack(FingerprintRegistry& registry)
+		: layers(new Layers), registry(&registry)
 	{
 	}
 
 	template<class CellT, int Dimensions>
-	Stinkhorn<CellT, Dimensions>::FingerprintStack::~FingerprintStack() {
+	Stinkhorn<CellT, Dimensions>::FingerprintStack::Layers::Layers(Layers const& other)
+		: stack(other.stack)
+	{
+		for(typename vector<IFingerprint*>::iterator itr = stack.begin(); itr != stack.end(); ++itr)
+			(*itr)->addRef();
+
+		for(int i = 0; i < 26; ++i) {
+			semantics[i] = other.semantics[i];
+			for(typename vector<IFingerprint*>::iterator itr = semantics[i].begin(); itr != semantics[i].end(); ++itr)
+				(*itr)->addRef();
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::FingerprintStack::Layers::~Layers() {
 		//Unload all semantics
 		for(int i = 0; i < 26; ++i) {
 			while(!semantics[i].empty()) {
-				release(semantics[i].top());
-				semantics[i].pop();
+				semantics[i].back()->release();
+				semantics[i].pop_back();
 			}
 		}
 
-		//Note: no re-allocation will occur here, since vector doesn't shrink
 		while(!stack.empty()) {
-			release(stack.back());
+			stack.back()->release();
 			stack.pop_back();
 		}
+	}
 
-		//'all' does not addRef its members
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::FingerprintStack::Layers&
+	Stinkhorn<CellT, Dimensions>::FingerprintStack::own()
+	{
+		if(!layers.unique())
+			layers.reset(new Layers(*layers));
+		return *layers;
 	}
 
 	namespace {
@@ -47,21 +63,30 @@ namespace stinkhorn {
 		};
 	}
 
+	//Finds a loaded instance of the fingerprint, so that loading it again doesn't
+	//duplicate it.
 	template<class CellT, int Dimensions>
-	typename Stinkhorn<CellT, Dimensions>::IFingerprint* 
-	Stinkhorn<CellT, Dimensions>::FingerprintStack::get(IdT id) 
+	typename Stinkhorn<CellT, Dimensions>::IFingerprint*
+	Stinkhorn<CellT, Dimensions>::FingerprintStack::get(IdT id)
 	{
-		typename vector<IFingerprint*>::iterator itr = find_if(all.begin(), all.end(), id_equals<IFingerprint>(id));
-		if(itr == all.end())
-			return 0;
+		Layers const& l = *layers;
 
-		return *itr;
+		typename vector<IFingerprint*>::const_iterator itr = find_if(l.stack.begin(), l.stack.end(), id_equals<IFingerprint>(id));
+		if(itr != l.stack.end())
+			return *itr;
+
+		for(int i = 0; i < 26; ++i) {
+			itr = find_if(l.semantics[i].begin(), l.semantics[i].end(), id_equals<IFingerprint>(id));
+			if(itr != l.semantics[i].end())
+				return *itr;
+		}
+
+		return 0;
 	}
 
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::FingerprintStack::push(IFingerprint* builtin) {
-		all.push_back(builtin);
-		stack.push_back(builtin);
+		own().stack.push_back(builtin);
 		builtin->addRef();
 		return true;
 	}
@@ -70,18 +95,18 @@ namespace stinkhorn {
 	bool Stinkhorn<CellT, Dimensions>::FingerprintStack::push(IdT id) {
 		IFingerprint* fp = get(id);
 
-		if(!fp) {
-			fp = this->registry.createFingerprint(id);
-
-			if(fp)
-				all.push_back(fp);
-		}
+		if(fp)
+			fp->addRef();
+		else
+			fp = this->registry->createFingerprint(id);
 
 		if(!fp)
 			return false;
 
+		Layers& l = own();
+
 		if(!fp->onlySemantics()) {
-			stack.push_back(fp);
+			l.stack.push_back(fp);
 			fp->addRef();
 		}
 
@@ -89,30 +114,15 @@ namespace stinkhorn {
 		for(; *instructions; instructions++) {
 			int sem = *instructions - 'A';
 			assert(sem >= 0 && sem < 26);
-			semantics[sem].push(fp);
+			l.semantics[sem].push_back(fp);
 			fp->addRef();
 		}
 
-		std::vector<IFingerprint*> stack;
-		release(fp);
+		fp->release();
 
 		return true;
 	}
 
-	template<class CellT, int Dimensions>
-	void Stinkhorn<CellT, Dimensions>::FingerprintStack::release(IFingerprint* fp) {
-		char const* hi = fp->handledInstructions();
-		IdT id = fp->id();
-		unsigned long c = fp->release();
-		if(c == 0) {
-			//std::cerr << "[FP: 0x" << setbase(16) << setw(8) << id <<  " ] Releasing fingerprint (supported: " << hi << ")\n";
-			typename vector<IFingerprint*>::iterator itr = remove(all.begin(), all.end(), fp);
-			all.erase(itr, all.end());
-		} else {
-			//std::cerr << "[FP: 0x" << setbase(16) << setw(8) << id <<  " ] Not yet releasing fingerprint (supported: " << hi << ", ref count: " << c << " )\n";
-		}
-	}
-
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::FingerprintStack::pop(IdT id) {
 		IFingerprint* fp = get(id);
@@ -121,33 +131,72 @@ namespace stinkhorn {
 		if(!fp)
 			return true;
 
+		//Keep fp alive until it's out of the stack.
+		fp->addRef();
+		Layers& l = own();
+
 		char const* instructions = fp->handledInstructions();
 		for(; *instructions; instructions++) {
 			int sem = *instructions - 'A';
 			assert(sem >= 0 && sem < 26);
-			assert(!semantics[sem].empty());
-			IFingerprint* boundFP = semantics[sem].top(); 
-			semantics[sem].pop();
-			release(boundFP); //Release the fingerprint at the top of the stack, not fp (they might be the same, might not).
+			if(l.semantics[sem].empty())
+				continue;
+			IFingerprint* boundFP = l.semantics[sem].back();
+			l.semantics[sem].pop_back();
+			boundFP->release(); //Release the fingerprint at the top of the stack, not fp (they might be the same, might not).
 		}
 
 		//Remove fp from the stack if it's in there.
-		typename vector<IFingerprint*>::iterator itr = std::remove(stack.begin(), stack.end(), fp);
-		if(itr != stack.end())
-			release(fp);
-		stack.erase(itr, stack.end());
+		typename vector<IFingerprint*>::iterator itr = std::remove(l.stack.begin(), l.stack.end(), fp);
+		if(itr != l.stack.end())
+			fp->release();
+		l.stack.erase(itr, l.stack.end());
 
+		fp->release();
 		return true;
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::FingerprintStack::contents(Contents& contents) const {
+		contents.stack = layers->stack;
+		for(int i = 0; i < 26; ++i)
+			contents.semantics[i] = layers->semantics[i];
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::FingerprintStack::assign(Contents const& contents) {
+		Layers* l = new Layers;
+		layers.reset(l);
+
+		l->stack = contents.stack;
+		for(typename vector<IFingerprint*>::iterator itr = l->stack.begin(); itr != l->stack.end(); ++itr)
+			(*itr)->addRef();
+
+		for(int i = 0; i < 26; ++i) {
+			l->semantics[i] = contents.semantics[i];
+			for(typename vector<IFingerprint*>::iterator itr = l->semantics[i].begin(); itr != l->semantics[i].end(); ++itr)
+				(*itr)->addRef();
+		}
+	}
+
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::FingerprintStack::execute(CellT instruction, Context& ctx) {
+		return dispatch(instruction, ctx) != 0;
+	}
+
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::IFingerprint*
+	Stinkhorn<CellT, Dimensions>::FingerprintStack::dispatch(CellT instruction, Context& ctx)
+	{
+		//( and ) may replace the layers, but they return straight away afterwards.
+		Layers const& l = *layers;
+
 		if(instruction >= 'A' && instruction <= 'Z') {
 			int sem = static_cast<int>(instruction - 'A');
-			if(!semantics[sem].empty()) {
-				IFingerprint* fp = semantics[sem].top();
+			if(!l.semantics[sem].empty()) {
+				IFingerprint* fp = l.semantics[sem].back();
 				if(fp->handleInstruction(instruction, ctx))
-					return true;
+					return fp;
 			}
 		}
 
@@ -155,13 +204,14 @@ namespace stinkhorn {
 		//isn't very well defined at all, but let's keep it uncrashing for now.
 		//It should be warning-worthy though.
 		typename vector<IFingerprint*>::size_type i = 0;
-		while(i < stack.size()) {
-			if(stack.rbegin()[i]->handleInstruction(instruction, ctx))
-				return true;
+		while(i < l.stack.size()) {
+			IFingerprint* fp = l.stack.rbegin()[i];
+			if(fp->handleInstruction(instruction, ctx))
+				return fp;
 			++i;
 		}
 
-		return false;
+		return 0;
 	}
 }
 
@@ -5,34 +5,65 @@
 
 #include "fingerprint.hpp"
 #include <vector>
-#include <stack>
+
+#include "boost/shared_ptr.hpp"
 
 namespace stinkhorn {
+	/**
+	 * The fingerprints an IP has loaded. Copying a FingerprintStack is cheap: the
+	 * copies share one set of layers until one of them executes ( or ), at which
+	 * point it takes its own. Every IP starts out as a copy of the interpreter's
+	 * (see Interpreter::baseFingerprints), so an IP that never loads a fingerprint
+	 * costs a pointer.
+	 */
 	template<class CellT, int Dimensions>
 	class Stinkhorn<CellT, Dimensions>::FingerprintStack {
 	public:
 		FingerprintStack(FingerprintRegistry& registry);
-		~FingerprintStack();
 
 		IFingerprint* get(IdT id);
 
 		bool execute(CellT c, Context& ctx);
 
+		//Like execute, but returns the fingerprint which handled the instruction (or 0 if
+		//none did), so that further instances of it can be sent straight there.
+		IFingerprint* dispatch(CellT c, Context& ctx);
+
 		bool push(IdT id);
 		bool push(IFingerprint* builtin);
 		bool pop(IdT id);
 
-	protected:
-		void release(IFingerprint* fp);
+		//What the layers hold, for checkpoints (see checkpoint.hpp).
+		struct Contents {
+			std::vector<IFingerprint*> stack;
+			std::vector<IFingerprint*> semantics[26];
+		};
+
+		void contents(Contents& contents) const;
+
+		//Replaces the layers with contents, taking a reference to each fingerprint.
+		void assign(Contents const& contents);
 
 	private:
-		std::vector<IFingerprint*> stack;
+		//Holds a reference to each fingerprint in it, and is never changed once it
+		//is shared.
+		struct Layers {
+			std::vector<IFingerprint*> stack;
+			std::vector<IFingerprint*> semantics[26]; ///<the top of each is at the back
+
+			Layers() {}
+			Layers(Layers const& other);
+			~Layers();
+
+		private:
+			Layers& operator=(Layers const&);
+		};
+
+		//The layers, copied first if they're shared.
+		Layers& own();
 
-		//This is kept so that we can avoid duplicating existing fingerprints. 
-		//It also seems better than scanning the list of loaded semantics.
-		std::vector<IFingerprint*> all;
-		FingerprintRegistry& registry;
-		std::stack<IFingerprint*, std::vector<IFingerprint*> > semantics[26];
+		boost::shared_ptr<Layers> layers;
+		FingerprintRegistry* registry;
 	};
 }
 
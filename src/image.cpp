@@ -0,0 +1,354 @@
+#include "config.hpp"
+#include "image.hpp"
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef B98_WINDOWS
+#	include <windows.h>
+#else
+#	include <sys/types.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+using std::string;
+using std::vector;
+using std::runtime_error;
+
+namespace stinkhorn {
+	ProgramSource::ProgramSource(Options const& options) {
+		if(!options.sourceFile.empty()) {
+			m_file.open(options.sourceFile.c_str(), std::ios_base::binary | std::ios_base::in);
+			if(!m_file.good())
+				throw std::runtime_error("Unable to open source file for reading");
+			m_stream = &m_file;
+		} else {
+			std::copy(options.sourceLines.begin(), options.sourceLines.end(),
+				std::ostream_iterator<string>(m_lines, "\n"));
+			m_stream = &m_lines;
+		}
+
+		if(options.showSourceLines) {
+			std::ostream& os = std::cerr;
+			os << "Source dump:\n";
+			std::copy(options.sourceLines.begin(), options.sourceLines.end(), std::ostream_iterator<string>(os, "\n"));
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::ProgramImage::ProgramImage(Options const& options) :
+		m_analysis(m_tree)
+	{
+		ProgramSource source(options);
+		load(source.stream(), options.befunge93);
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::ProgramImage::ProgramImage(std::istream& source, bool befunge93) :
+		m_analysis(m_tree)
+	{
+		load(source, befunge93);
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::ProgramImage::load(std::istream& source, bool befunge93) {
+		Vector size;
+		m_tree.read_file_into(Vector(), source, Tree::FileFlags::no_form_feeds, size);
+		m_analysis.analyse(befunge93);
+
+		//From here on, the pages are read-only.
+		m_tree.share_pages();
+	}
+
+	namespace {
+		char const Magic[8] = { 'S', 'T', 'N', 'K', 'I', 'M', 'A', 'G' };
+		uint64 const Version = 1;
+		uint32 const ByteOrder = 0x01020304;
+
+		//The page addresses start on a cache line, and the pages themselves on a
+		//page of memory, so that they can be used where they are mapped.
+		uint64 const DirectoryAlignment = 64, PageAlignment = 4096;
+
+		uint64 alignUp(uint64 offset, uint64 alignment) {
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		void pad(std::ostream& os, uint64 from, uint64 to) {
+			for(; from < to; ++from)
+				os.put(0);
+		}
+
+		template<class PageEntryT, class TreeT>
+		struct PageOrder {
+			bool operator()(PageEntryT const& lhs, PageEntryT const& rhs) const {
+				return TreeT::address_before(lhs.first, rhs.first);
+			}
+		};
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::MappedImage::write(string const& path, ProgramImage& image, bool befunge93, string const& sourceFile) {
+		typedef typename Tree::PageEntry PageEntry;
+		typedef TreePage PageT;
+
+		Tree& tree = image.fungeSpace();
+		vector<PageEntry> pages;
+		tree.list_pages(pages);
+		std::sort(pages.begin(), pages.end(), PageOrder<PageEntry, Tree>());
+
+		Vector lowest, highest;
+		for(typename vector<PageEntry>::const_iterator page = pages.begin(); page != pages.end(); ++page) {
+			Vector const& a = page->first;
+			if(page == pages.begin())
+				lowest = highest = a;
+			lowest = Vector(std::min(lowest.x, a.x), std::min(lowest.y, a.y), std::min(getZ(lowest), getZ(a)));
+			highest = Vector(std::max(highest.x, a.x), std::max(highest.y, a.y), std::max(getZ(highest), getZ(a)));
+		}
+
+		Vector min, max;
+		tree.get_minmax(min, max);
+
+		std::ostringstream header(std::ios_base::binary | std::ios_base::out);
+		CheckpointWriter out(header);
+		out.count(Version);
+		out.count(sizeof(CellT) * CHAR_BIT);
+		out.count(Dimensions);
+		out.count(PageT::bits);
+		out.count(sizeof(PageT));
+		out.bytes(&ByteOrder, sizeof ByteOrder);
+		out.flag(befunge93);
+		out.string(sourceFile);
+		out.count(pages.size());
+		out.vector(lowest);
+		out.vector(highest);
+		out.vector(min);
+		out.vector(max);
+		image.analysis().save(out);
+
+		string const headerBytes = header.str();
+		uint64 const headerEnd = sizeof Magic + 2 * sizeof(uint64) + headerBytes.size(),
+			directory = alignUp(headerEnd, DirectoryAlignment),
+			directoryEnd = directory + pages.size() * Dimensions * sizeof(CellT),
+			pagesAt = alignUp(directoryEnd, PageAlignment);
+
+		std::ofstream file(path.c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+		if(!file.good())
+			throw runtime_error("Unable to write image " + path);
+
+		file.write(Magic, sizeof Magic);
+		file.write(reinterpret_cast<char const*>(&directory), sizeof directory);
+		file.write(reinterpret_cast<char const*>(&pagesAt), sizeof pagesAt);
+		file.write(headerBytes.data(), headerBytes.size());
+		pad(file, headerEnd, directory);
+
+		for(typename vector<PageEntry>::const_iterator page = pages.begin(); page != pages.end(); ++page) {
+			CellT const address[] = { page->first.x, page->first.y, getZ(page->first) };
+			file.write(reinterpret_cast<char const*>(address), Dimensions * sizeof(CellT));
+		}
+		pad(file, directoryEnd, pagesAt);
+
+		//Each page is written just as it would be in memory, padding and all, but
+		//already marked shared, so that nothing writes to it where it is mapped.
+		vector<char> raw(sizeof(PageT));
+		PageT* copy = reinterpret_cast<PageT*>(&raw[0]);
+		for(typename vector<PageEntry>::const_iterator page = pages.begin(); page != pages.end(); ++page) {
+			std::memcpy(copy->data, page->second->data, sizeof copy->data);
+			copy->usage = page->second->usage;
+			copy->shared = true;
+			copy->dirty = true;
+			file.write(&raw[0], raw.size());
+		}
+
+		file.flush();
+		if(!file.good())
+			throw runtime_error("Unable to write image " + path);
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::MappedImage::MappedImage(string const& path) {
+		typedef TreePage PageT;
+
+		map(path);
+
+		try {
+			uint64 directory, pagesAt;
+			if(m_size < sizeof Magic + sizeof directory + sizeof pagesAt || std::memcmp(m_data, Magic, sizeof Magic) != 0)
+				throw runtime_error(path + " isn't a funge-space image");
+			std::memcpy(&directory, m_data + sizeof Magic, sizeof directory);
+			std::memcpy(&pagesAt, m_data + sizeof Magic + sizeof directory, sizeof pagesAt);
+
+			uint64 const headerAt = sizeof Magic + sizeof directory + sizeof pagesAt;
+			if(directory < headerAt || directory > pagesAt || pagesAt > m_size)
+				throw runtime_error(path + " is cut short or damaged");
+
+			std::istringstream header(string(m_data + headerAt, m_data + directory), std::ios_base::binary | std::ios_base::in);
+			CheckpointReader in(header);
+			uint64 version, cellBits, dimensions, pageBits, pageSize, count;
+			uint32 order;
+			try {
+				version = in.count();
+				cellBits = in.count();
+				dimensions = in.count();
+				pageBits = in.count();
+				pageSize = in.count();
+				in.bytes(&order, sizeof order);
+
+				m_befunge93 = in.flag();
+				m_sourceFile = in.string();
+				count = in.count();
+				in.vector(m_lowest);
+				in.vector(m_highest);
+				in.vector(m_min);
+				in.vector(m_max);
+			} catch(runtime_error&) {
+				throw runtime_error(path + " is cut short or damaged");
+			}
+
+			if(version != Version)
+				throw runtime_error(path + " was made by a different version of stinkhorn");
+			if(cellBits != sizeof(CellT) * CHAR_BIT || dimensions != Dimensions || pageBits != uint64(PageT::bits))
+				throw runtime_error(path + " was made with a different cell size or number of dimensions");
+			if(order != ByteOrder || pageSize != sizeof(PageT))
+				throw runtime_error(path + " was made on a machine, or by a build, that lays pages out differently");
+
+			//What is left is the analysis, which load reads.
+			m_analysis.assign(m_data + headerAt + std::size_t(header.tellg()), m_data + directory);
+
+			if(count > (m_size - pagesAt) / sizeof(PageT) || directory + count * Dimensions * sizeof(CellT) > pagesAt)
+				throw runtime_error(path + " is cut short or damaged");
+
+			m_pages.addresses = reinterpret_cast<CellT const*>(m_data + directory);
+			m_pages.pages = reinterpret_cast<PageT*>(const_cast<char*>(m_data + pagesAt));
+			m_pages.count = static_cast<std::size_t>(count);
+			check(path);
+		} catch(...) {
+			unmap();
+			throw;
+		}
+	}
+
+	//The tree trusts what it finds in the mapping: that the addresses are in
+	//order, for its binary search, and within the bounds it was sized for, and
+	//that every page is marked shared, so that it is copied rather than written
+	//to (or freed) where it is mapped. An image that breaks any of that is
+	//refused before the tree sees it.
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::MappedImage::check(string const& path) {
+		typedef TreePage PageT;
+
+		for(std::size_t i = 0; i < m_pages.count; ++i) {
+			CellT const* cells = m_pages.addresses + i * Dimensions;
+			Vector address(cells[0], cells[1], Dimensions == 3 ? cells[2] : 0);
+			if(address.x < m_lowest.x || address.y < m_lowest.y || getZ(address) < getZ(m_lowest) ||
+				address.x > m_highest.x || address.y > m_highest.y || getZ(address) > getZ(m_highest))
+				throw runtime_error(path + " is damaged: a page lies outside the image's bounds");
+
+			if(i) {
+				CellT const* previous = cells - Dimensions;
+				if(!Tree::address_before(Vector(previous[0], previous[1], Dimensions == 3 ? previous[2] : 0), address))
+					throw runtime_error(path + " is damaged: its pages are out of order or repeated");
+			}
+
+			//Looked at as bytes, since a bool holding anything else is undefined.
+			STATIC_ASSERT(sizeof(bool) == 1);
+			PageT const& page = m_pages.pages[i];
+			unsigned char shared, dirty;
+			std::memcpy(&shared, &page.shared, 1);
+			std::memcpy(&dirty, &page.dirty, 1);
+			if(shared != 1 || dirty > 1)
+				throw runtime_error(path + " is damaged: a page isn't marked shared");
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::MappedImage::~MappedImage() {
+		unmap();
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::MappedImage::load(Tree& tree, Analysis& analysis, bool befunge93) {
+		if(befunge93 != m_befunge93)
+			throw runtime_error(m_befunge93 ? "the image was made with --befunge-93, and must be run with it" : "the image was made without --befunge-93, and must be run without it");
+
+		tree.map_pages(m_pages, m_lowest, m_highest, m_min, m_max);
+
+		std::istringstream saved(m_analysis, std::ios_base::binary | std::ios_base::in);
+		CheckpointReader in(saved);
+		try {
+			analysis.restore(in);
+		} catch(runtime_error&) {
+			throw runtime_error("the image's analysis is cut short or damaged");
+		}
+	}
+
+	//The mapping is read-only: a page is copied (see Tree::find) before it is
+	//written to.
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::MappedImage::map(string const& path) {
+#ifdef B98_WINDOWS
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if(file == INVALID_HANDLE_VALUE)
+			throw runtime_error("Unable to open image " + path);
+
+		LARGE_INTEGER size;
+		HANDLE mapping = 0;
+		void* data = 0;
+		if(GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+			mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+			if(mapping)
+				data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+
+		if(!data) {
+			if(mapping)
+				CloseHandle(mapping);
+			CloseHandle(file);
+			throw runtime_error("Unable to map image " + path);
+		}
+
+		m_file = file;
+		m_mapping = mapping;
+		m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+		int file = ::open(path.c_str(), O_RDONLY);
+		if(file < 0)
+			throw runtime_error("Unable to open image " + path);
+
+		struct stat info;
+		void* data = MAP_FAILED;
+		if(::fstat(file, &info) == 0 && info.st_size > 0)
+			data = ::mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file);
+
+		if(data == MAP_FAILED)
+			throw runtime_error("Unable to map image " + path);
+
+		m_size = static_cast<std::size_t>(info.st_size);
+#endif
+		m_data = static_cast<char const*>(data);
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::MappedImage::unmap() {
+#ifdef B98_WINDOWS
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_file);
+#else
+		::munmap(const_cast<char*>(m_data), m_size);
+#endif
+	}
+}
+
+INSTANTIATE(class, ProgramImage);
+INSTANTIATE(class, MappedImage);
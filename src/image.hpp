@@ -0,0 +1,129 @@
+#ifndef B98_IMAGE_HPP_INCLUDED
+#define B98_IMAGE_HPP_INCLUDED
+
+#include "stinkhorn.hpp"
+#include "options.hpp"
+#include "octree.hpp"
+#include "cursor.hpp"
+#include "analysis.hpp"
+
+#include <cstddef>
+#include <fstream>
+#include <iosfwd>
+#include <sstream>
+#include <string>
+
+#include "boost/noncopyable.hpp"
+
+namespace stinkhorn {
+	/**
+	 * The program named in the options: the source file, or failing that, the
+	 * lines given with --source-line (which are dumped to stderr first, if
+	 * asked).
+	 **/
+	class ProgramSource : boost::noncopyable {
+	public:
+		ProgramSource(Options const& options);
+
+		std::istream& stream() {
+			return *m_stream;
+		}
+
+	private:
+		std::ifstream m_file;
+		std::stringstream m_lines;
+		std::istream* m_stream;
+	};
+
+	/**
+	 * A program as it is once loaded: funge-space's pages and what the analysis
+	 * found in them. Interpreters start from an image by borrowing its pages
+	 * (see Tree::borrow_pages) rather than reading the source again, and copy
+	 * only the pages they write to, so repeated runs of one program (--bench,
+	 * or an embedding host) begin at once.
+	 *
+	 * An image never changes once loaded, so any number of interpreters can
+	 * share it, on any threads, but it must outlive them all.
+	 **/
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::ProgramImage
+		: boost::noncopyable
+	{
+	public:
+		//Loads the program named in the options, or the one in source.
+		explicit ProgramImage(Options const& options);
+		ProgramImage(std::istream& source, bool befunge93);
+
+		Tree& fungeSpace() {
+			return m_tree;
+		}
+
+		Analysis const& analysis() const {
+			return m_analysis;
+		}
+
+	private:
+		void load(std::istream& source, bool befunge93);
+
+		Tree m_tree;
+		Analysis m_analysis;
+	};
+
+	/**
+	 * A funge-space image file, which --make-image writes and --image runs: a
+	 * loaded program's pages, laid out just as TreePage lays them out in
+	 * memory, along with what the analysis found in them. The file is mapped
+	 * into memory rather than read, and a tree takes each page straight from
+	 * the mapping the first time it looks for it (see Tree::map_pages),
+	 * copying it only if it is written to. So however big the program is,
+	 * nothing is parsed, and only the pages it uses are ever read from disk.
+	 *
+	 * The file is a header (the cell size, dimensions, page size and byte
+	 * order it was made for, the bounds, and the analysis), the page addresses
+	 * in order, and the pages. An image only suits a build that lays pages out
+	 * the same way, and is refused by any other.
+	 *
+	 * Like a ProgramImage, it never changes, and must outlive the trees using
+	 * its pages.
+	 **/
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::MappedImage
+		: boost::noncopyable
+	{
+	public:
+		explicit MappedImage(std::string const& path);
+		~MappedImage();
+
+		//Writes the program in image to path. befunge93 is what the analysis
+		//assumed, which the interpreter running the image must too.
+		static void write(std::string const& path, ProgramImage& image, bool befunge93, std::string const& sourceFile);
+
+		//Starts tree, which must be empty, and analysis off from the image.
+		void load(Tree& tree, Analysis& analysis, bool befunge93);
+
+		//The source file the image was made from.
+		std::string const& sourceFile() const {
+			return m_sourceFile;
+		}
+
+	private:
+		void map(std::string const& path);
+		void unmap();
+		void check(std::string const& path);
+
+		char const* m_data;
+		std::size_t m_size;
+#ifdef B98_WINDOWS
+		void* m_file;
+		void* m_mapping;
+#endif
+
+		typename Tree::MappedPages m_pages;
+		Vector m_lowest, m_highest, m_min, m_max;
+		bool m_befunge93;
+		std::string m_sourceFile;
+		std::string m_analysis; ///<saved by Analysis::save
+	};
+}
+
+#endif
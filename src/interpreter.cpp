@@ -3,40 +3,152 @@
 #include "interpreter.hpp"
 #include "context.hpp"
 #include "fingerprint.hpp"
+#include "fingerprint_stack.hpp"
 #include "thread.hpp"
-#include <list>
+#include "analysis.hpp"
+#include "speculation.hpp"
+#include "image.hpp"
+#include "checkpoint.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+#include "boost/atomic.hpp"
 #include <iostream>
 #include <iterator>
 #include <stdexcept>
 #include <vector>
+#include <algorithm>
+#include <functional>
 #include <fstream>
 #include <sstream>
+#include <cstdio>
+
+#ifndef B98_WINDOWS
+#	include <poll.h>
+#	include <errno.h>
+#endif
 
 using std::cerr;
 using std::string;
 using std::vector;
 using std::auto_ptr;
-using std::ostream_iterator;
-using std::stringstream;
-using std::ifstream;
-using std::istream;
 
 namespace stinkhorn {
 	template<class CellT, int Dimensions>
 	struct Stinkhorn<CellT, Dimensions>::Interpreter::PrivateData {
+		typedef typename ThreadTable::Slot Slot;
+
+		//With --image, the image file, whose pages the tree uses (and so which
+		//goes after it).
+		std::auto_ptr<MappedImage> image;
+
 		Tree tree;
+		Analysis analysis;
 		FingerprintRegistry registry;
 		DefaultFingerprintSource default_source;
+		FingerprintStack base_fingerprints;
 
 		Options& options;
-		typename std::list<Thread*> threads;
+		std::istream* input;
+		std::ostream* output;
+
+		//Where the IPs keep what tick looks at. Their Threads are deleted before
+		//it is.
+		ThreadTable table;
+
+		//The running IPs' slots, in reverse order of execution, so that an IP
+		//spawned by spawnThread (which runs first from the next tick) goes on the
+		//end. An IP that stops is replaced with NoSlot and the gaps are closed up
+		//after each tick.
+		std::vector<Slot> threads;
+		static const Slot NoSlot = Slot(-1);
+		//Atomic because singleThreaded reads it while --parallel workers change it.
+		boost::atomic<std::size_t> liveThreads;
 		CellT nextThreadID;
 
+		//How many of the IPs are parked (see park), and how many ticks have gone
+		//by since the scheduler last checked on them.
+		std::size_t parkedThreads;
+		unsigned ticksSincePoll;
+
+		//Set while runFor is counting ticks.
+		bool budgeted;
+
+		//The stack of the last IP to stop, for stack() once they all have.
+		StackStackT lastStack;
+
+		//With --checkpoint, where the program is saved, and with
+		//--checkpoint-every, what says when.
+		std::auto_ptr<Checkpoint> checkpoint;
+		std::auto_ptr<CheckpointTimer> checkpointTimer;
+
+		//The IPs in threads, in the same order, for Checkpoint and Speculator.
+		void listThreads(vector<Thread*>& list) {
+			list.clear();
+			for(typename vector<Slot>::iterator t = threads.begin(); t != threads.end(); ++t)
+				list.push_back(table.thread(*t));
+		}
+
+		void addThreads(typename vector<Thread*>::const_iterator first, typename vector<Thread*>::const_iterator last) {
+			for(; first != last; ++first)
+				threads.push_back((*first)->slot());
+		}
+
+		void deleteThreads() {
+			for(typename vector<Slot>::iterator t = threads.begin(); t != threads.end(); ++t)
+				delete table.thread(*t);
+			threads.clear();
+		}
+
+		//Under --parallel, threads only holds the IPs which no worker has taken
+		//yet. lock guards it along with nextThreadID and changes to liveThreads,
+		//and spawned wakes workers which have run out of IPs.
+		boost::mutex lock;
+		boost::condition_variable spawned;
+		unsigned workers;
+		//Read by the workers between ticks without taking the lock.
+		boost::atomic<bool> waiting, stopping;
+
+		//Why the workers stopped early, to be rethrown once they have all finished.
+		bool quitting, failed;
+		QuitProgram quit;
+		std::string failure;
+
+		struct Worker {
+			Interpreter* interpreter;
+
+			void operator()() {
+				interpreter->runWorker();
+			}
+		};
+
 		PrivateData(Options& options) 
-			: options(options)
+			: analysis(tree), base_fingerprints(registry), options(options), input(&std::cin), output(&std::cout)
 		{
 			nextThreadID = 1;
+			liveThreads = 0;
+			parkedThreads = 0;
+			ticksSincePoll = 0;
+			budgeted = false;
+			workers = 1;
+			waiting = false;
+			stopping = false;
+			quitting = failed = false;
 			registry.addSource(&default_source);
+
+			IFingerprint* f;
+
+			if(options.befunge93)
+				f = new Befunge93Fingerprint;
+			else if(options.trefunge)
+				f = new TrefungeFingerprint;
+			else
+				f = new Befunge98Fingerprint;
+
+			base_fingerprints.push(f);
+
+			//It is now the fingerprint stack's responsibility.
+			f->release();
 		}
 	};
 
@@ -53,73 +165,555 @@ namespace stinkhorn {
 
 	template<class CellT, int Dimensions>
 	Stinkhorn<CellT, Dimensions>::Interpreter::~Interpreter() {
-		while(!self->threads.empty()) {
-			delete self->threads.front();
-			self->threads.pop_front();
-		}
-
+		self->deleteThreads();
 		delete self;
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::reset() {
+		PrivateData* old = self;
+		self = new PrivateData(old->options);
+		self->input = old->input;
+		self->output = old->output;
+
+		old->deleteThreads();
+
+		self->tree.take_pages(old->tree);
+		delete old;
+	}
+
+	template<class CellT, int Dimensions>
+	std::istream& Stinkhorn<CellT, Dimensions>::Interpreter::input() {
+		return *self->input;
+	}
+
+	template<class CellT, int Dimensions>
+	std::ostream& Stinkhorn<CellT, Dimensions>::Interpreter::output() {
+		return *self->output;
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::redirect(std::istream& input, std::ostream& output) {
+		self->input = &input;
+		self->output = &output;
+	}
+
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::Interpreter::run() {
-		assert(self && (!self->options.sourceFile.empty() || !self->options.sourceLines.empty()));
+		Options& options = self->options;
+		assert(self && (!options.sourceFile.empty() || !options.sourceLines.empty() || !options.restoreFile.empty() || !options.imageFile.empty()));
 
 		//todo: catch exceptions and beautify them
 
-		stringstream lines_stream;
-		ifstream file_stream;
-		istream* stream = 0;
-
-		if(!self->options.sourceFile.empty()) {
-			//Load the source file now
-			file_stream.open(self->options.sourceFile.c_str(), std::ios_base::binary | std::ios_base::in);
-			if(!file_stream.good())
-				throw std::runtime_error("Unable to open source file for reading");
-			stream = &file_stream;
+		if(!options.restoreFile.empty()) {
+			//y gives the source file's name, which needn't be given again.
+			string sourceFile;
+			vector<Thread*> restored;
+			self->nextThreadID = Checkpoint::restore(options.restoreFile, *this, restored, sourceFile);
+			self->addThreads(restored.begin(), restored.end());
+			self->liveThreads = self->threads.size();
+			if(options.sourceFile.empty())
+				options.sourceFile = sourceFile;
+		} else if(!options.imageFile.empty()) {
+			self->image.reset(new MappedImage(options.imageFile));
+			load(*self->image);
+			if(options.sourceFile.empty())
+				options.sourceFile = self->image->sourceFile();
 		} else {
-			std::copy(self->options.sourceLines.begin(), self->options.sourceLines.end(),
-				std::ostream_iterator<string>(lines_stream, "\n"));
+			ProgramSource source(options);
+			load(source.stream());
+		}
 
-			stream = &lines_stream;
+		if(!options.checkpointFile.empty()) {
+			self->checkpoint.reset(new Checkpoint(options.checkpointFile));
+			checkpointOnSignal();
+			if(options.checkpointInterval)
+				self->checkpointTimer.reset(new CheckpointTimer(options.checkpointInterval));
 		}
 
-		if(self->options.showSourceLines) {
-			std::ostream& os = std::cerr;
-			os << "Source dump:\n";
-			std::copy(self->options.sourceLines.begin(), self->options.sourceLines.end(), ostream_iterator<string>(os, "\n"));
+		runLoaded();
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::run(ProgramImage& image) {
+		load(image);
+		runLoaded();
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::runLoaded() {
+		if(self->options.analyze) {
+			self->analysis.report(std::cout);
+			return;
 		}
 
-		assert(stream);
+		this->doRun();
+	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::load(std::istream& source) {
 		Vector size;
 		//TODO: Why no_form_feeds?
-		self->tree.read_file_into(Vector(), *stream, Tree::FileFlags::no_form_feeds, size);
+		self->tree.read_file_into(Vector(), source, Tree::FileFlags::no_form_feeds, size);
 
-		if(stream == &file_stream)
-			file_stream.close();
-		stream = 0;
+		self->analysis.analyse(isBefunge93());
+	}
 
-		this->doRun();
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::load(ProgramImage& image) {
+		self->tree.borrow_pages(image.fungeSpace());
+		self->analysis.adopt(image.analysis());
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::load(MappedImage& image) {
+		image.load(self->tree, self->analysis, isBefunge93());
+	}
+
+	/**
+	Under a budget, every tick has to be counted, so the IPs don't take the
+	shortcuts that do many ticks' work at once (see Thread::unobserved), and a
+	lone IP only runs on its own for what is left of the budget.
+	**/
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::Interpreter::runFor(std::size_t ticks) {
+		startFirstThread();
+
+		struct Budget {
+			bool& budgeted;
+			Budget(bool& budgeted) : budgeted(budgeted) { budgeted = true; }
+			~Budget() { budgeted = false; }
+		} budget(self->budgeted);
+
+		while(self->liveThreads && ticks) {
+			if(self->liveThreads == 1) {
+				ticks -= runAlone(ticks);
+			} else {
+				tick();
+				--ticks;
+			}
+		}
+
+		return self->liveThreads != 0;
+	}
+
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::StackStackT& Stinkhorn<CellT, Dimensions>::Interpreter::stack() {
+		//The first IP to tick is the last in the list.
+		if(self->threads.empty())
+			return self->lastStack;
+		return *self->table.stack(self->threads.back());
 	}
 
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::Interpreter::doRun() {
-		self->threads.push_back(new Thread(*this, self->tree, self->nextThreadID++));
-		while(!self->threads.empty()) {
-			// This is only valid if the advance() operation doesn't remove the thread itself from the list.
-			typename std::list<Thread*>::iterator itr = self->threads.begin();
-			while(itr != self->threads.end()) {
-				if(!(*itr)->advance())
-					itr = self->threads.erase(itr);
-				else
-					itr++;
+		if(self->options.parallel) {
+			doRunParallel();
+			return;
+		}
+
+		if(self->options.speculate) {
+			doRunSpeculative();
+			return;
+		}
+
+		startFirstThread();
+
+		while(self->liveThreads) {
+			if(checkpointWanted)
+				saveCheckpoint();
+
+			if(self->liveThreads == 1)
+				runAlone(std::size_t(-1));
+			else
+				tick();
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::startFirstThread() {
+		//A restored program has had IPs before.
+		if(self->nextThreadID == 1) {
+			self->threads.push_back((new Thread(*this, self->tree, self->nextThreadID++))->slot());
+			self->liveThreads = 1;
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::saveCheckpoint() {
+		checkpointWanted = false;
+		if(!self->checkpoint.get())
+			return;
+
+		//So that the output so far is all there, should the program be restored.
+		self->output->flush();
+		vector<Thread*> threads;
+		self->listThreads(threads);
+		self->checkpoint->save(*this, threads, self->nextThreadID);
+	}
+
+	//With one IP, there is nobody to take turns with, so it runs without going
+	//back to the scheduler until it spawns another (with t) or stops (with @ or
+	//q). An IP spawned during its last tick doesn't run until the next one, just
+	//as tick would have it.
+	template<class CellT, int Dimensions>
+	std::size_t Stinkhorn<CellT, Dimensions>::Interpreter::runAlone(std::size_t limit) {
+		vector<typename PrivateData::Slot>& threads = self->threads;
+		assert(self->liveThreads == 1 && threads.size() == 1);
+
+		Thread* thread = self->table.thread(threads.front());
+		if(thread->parked()) {
+			//It may as well block now.
+			thread->unpark();
+			--self->parkedThreads;
+		}
+
+		for(std::size_t ticks = 1; ; ++ticks) {
+			if(!thread->advance()) {
+				//Any IPs it spawned went on after it.
+				threads.erase(threads.begin());
+				retire(thread);
+				return ticks;
 			}
+
+			if(self->liveThreads != 1 || ticks == limit || checkpointWanted)
+				return ticks;
 		}
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::retire(Thread* thread) {
+		if(self->liveThreads == 1)
+			self->lastStack = thread->topContext().stack();
+
+		delete thread;
+		--self->liveThreads;
+	}
+
+	/**
+	IPs that have been spawned in the same place often go on to run the same code
+	on different stacks. When several IPs which are next to each other in the tick
+	order stand on the same cell with the same delta, and the instruction there
+	only works on the stack, the first one executes it and finds the next cell as
+	usual, and the rest execute it together (see ThreadTable::execute) and move
+	straight to the same cell. Nothing between them in the tick can change
+	funge-space or another IP's stack, so the order the IPs execute in is
+	unchanged.
+
+	Groups are found afresh every tick, so IPs which go different ways at a _ or
+	| simply stop standing together. Which IPs are parked, and which stand
+	together, is read from the ThreadTable's arrays, without going through the
+	IPs' objects.
+	**/
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::tick() {
+		typedef typename PrivateData::Slot Slot;
+		static const unsigned PollInterval = 64;
+		vector<Slot>& threads = self->threads;
+		ThreadTable& table = self->table;
+
+		//IPs spawned during the tick go on the end, past where this starts.
+		for(std::size_t i = threads.size(); i-- > 0; ) {
+			Slot slot = threads[i];
+			if(table.flags(slot) & ThreadTable::Parked)
+				continue;
+
+			Thread* leader = table.thread(slot);
+			CellT c;
+			if(i > 0 && leader->stackOnlyInstruction(c) && table.beside(threads[i - 1], slot)) {
+				std::size_t last = i - 1;
+				while(last > 0 && table.beside(threads[last - 1], slot))
+					--last;
+
+				leader->advance();
+				table.execute(c, &threads[last], &threads[i]);
+				for(std::size_t j = last; j < i; ++j)
+					table.follow(threads[j], slot);
+
+				i = last;
+			} else if(!leader->advance()) {
+				retire(leader);
+				threads[i] = PrivateData::NoSlot;
+			}
+		}
+
+		threads.erase(std::remove(threads.begin(), threads.end(), Slot(PrivateData::NoSlot)), threads.end());
+
+		if(self->parkedThreads) {
+			if(self->parkedThreads == self->liveThreads) {
+				unparkReady(true);
+			} else if(++self->ticksSincePoll == PollInterval) {
+				self->ticksSincePoll = 0;
+				unparkReady(false);
+			}
+		}
+	}
+
+#ifndef B98_WINDOWS
+	namespace {
+		//True if stdin has already read in input, which poll can't see. Where
+		//there is no telling, IPs don't park on stdin at all.
+		bool stdinBuffered() {
+			if(std::cin.rdbuf()->in_avail() > 0)
+				return true;
+#if defined(__GLIBC__)
+			return stdin->_IO_read_ptr < stdin->_IO_read_end;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+			return stdin->_r > 0;
+#else
+			return false;
+#endif
+		}
+
+		bool canSeeStdinBuffer() {
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		pollfd pollFor(int descriptor, bool writing) {
+			pollfd fd;
+			fd.fd = descriptor;
+			fd.events = writing ? POLLOUT : POLLIN;
+			fd.revents = 0;
+			return fd;
+		}
+	}
+#endif
+
+	/**
+	~, & and I read stdin, and A, R and W in SOCK wait on a socket, which would
+	stop every IP until it was ready. Instead, when it isn't yet and other IPs
+	can run, the IP is parked: it stays on the instruction and
+	the scheduler passes over it, so the rest go on taking turns in the same
+	order as before. Every so often, and whenever every IP is parked, tick polls
+	the parked IPs' descriptors (waiting, in the latter case) and unparks the
+	ones that are ready, which then execute the instruction again. Under
+	--speculate, parked IPs sit out the windows, and are polled after each.
+	Once there is some input, & and I go on to read the rest of the number or
+	line as usual, which can still wait if it arrives in pieces.
+	**/
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::Interpreter::park(Thread& thread, int descriptor, bool writing) {
+#ifdef B98_WINDOWS
+		return false;
+#else
+		//--parallel and --debug run IPs without tick.
+		if(self->liveThreads < 2 || self->options.parallel || self->options.debug)
+			return false;
+
+		//Redirected input never waits on stdin.
+		if(descriptor == 0 && !writing && (self->input != &std::cin || !canSeeStdinBuffer() || stdinBuffered()))
+			return false;
+
+		pollfd fd = pollFor(descriptor, writing);
+		if(::poll(&fd, 1, 0) != 0)
+			return false;
+
+		thread.park(descriptor, writing);
+		++self->parkedThreads;
+		return true;
+#endif
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::unparkReady(bool wait) {
+#ifndef B98_WINDOWS
+		vector<Thread*> parked;
+		vector<pollfd> fds;
+		bool reading_stdin = false;
+		ThreadTable& table = self->table;
+		for(typename vector<typename PrivateData::Slot>::iterator s = self->threads.begin(); s != self->threads.end(); ++s) {
+			if(table.flags(*s) & ThreadTable::Parked) {
+				Thread* t = table.thread(*s);
+				parked.push_back(t);
+				fds.push_back(pollFor(t->parkedOn(), t->parkedForWriting()));
+				reading_stdin = reading_stdin || (t->parkedOn() == 0 && !t->parkedForWriting());
+			}
+		}
+
+		//Another IP may have read stdin since, leaving some of it in the buffer.
+		bool buffered = reading_stdin && stdinBuffered();
+		if(!buffered) {
+			while(::poll(&fds[0], fds.size(), wait ? -1 : 0) < 0 && errno == EINTR)
+				;
+		}
+
+		for(std::size_t i = 0; i < parked.size(); ++i) {
+			bool stdin_ready = buffered && fds[i].fd == 0 && fds[i].events == POLLIN;
+			if(fds[i].revents || stdin_ready) {
+				parked[i]->unpark();
+				--self->parkedThreads;
+			}
+		}
+#endif
+	}
+
+	/**
+	With --speculate, whenever more than one IP is running, they run for a window
+	of ticks on a Speculator's workers. A window that goes through starts the
+	next one twice as long. When the IPs interfere, the next one is half as long,
+	and first they run in turn for a while, which doubles each time they
+	interfere again and halves each time they don't, so IPs that usually do cost
+	little more than running in turn.
+	When one of them stopped early at an instruction which can't be undone, that
+	tick is run in turn, and so are a few more if it stopped very early, since
+	speculating that little isn't worth starting the workers for.
+	**/
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::doRunSpeculative() {
+		static const std::size_t MinWindow = 64, MaxWindow = 4096, MaxBackoff = 1 << 16;
+
+		self->tree.share_between_threads();
+		unsigned cores = std::max(1u, boost::thread::hardware_concurrency());
+		Speculator speculator(self->tree, cores - 1);
+
+		startFirstThread();
+
+		std::size_t window = MinWindow, backoff = MinWindow;
+		while(self->liveThreads) {
+			if(checkpointWanted)
+				saveCheckpoint();
+
+			if(self->liveThreads == 1) {
+				runAlone(std::size_t(-1));
+				continue;
+			}
+
+			//Parked IPs sit the window out, and are checked on after it.
+			vector<Thread*> running;
+			self->listThreads(running);
+			if(self->parkedThreads)
+				running.erase(std::remove_if(running.begin(), running.end(), std::mem_fun(&Thread::parked)), running.end());
+
+			if(running.empty()) {
+				tick(); //which waits for one of them
+				continue;
+			}
+
+			typename Speculator::Result result = speculator.run(running, window);
+			if(self->parkedThreads)
+				unparkReady(false);
+
+			std::size_t in_turn;
+			if(result.rolled_back) {
+				in_turn = backoff;
+				backoff = std::min(MaxBackoff, backoff * 2);
+				window = std::max(MinWindow, window / 2);
+			} else if(result.ticks == window) {
+				in_turn = 0;
+				backoff = std::max(MinWindow, backoff / 2);
+				window = std::min(MaxWindow, window * 2);
+			} else {
+				in_turn = result.ticks < MinWindow ? MinWindow - result.ticks : 1;
+			}
+
+			for(; in_turn && self->liveThreads; --in_turn)
+				tick();
+		}
+	}
+
+	/**
+	Without --parallel, IPs take turns one tick at a time, so the order in which
+	they read and write funge-space is fixed. With it, there is a worker thread
+	for each core and each runs a share of the IPs on its own, as fast as it can.
+	IPs that are spawned go back into the shared list and the next worker to
+	finish a tick takes some of them, so work spreads out as a program forks.
+	Funge-space, the fingerprint registry and spawning lock what they share, but
+	nothing orders the ticks of IPs on different workers.
+	**/
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::doRunParallel() {
+		self->tree.share_between_threads();
+		self->workers = std::max(1u, boost::thread::hardware_concurrency());
+
+		startFirstThread();
+		self->waiting = true;
+
+		typename PrivateData::Worker worker = { this };
+		boost::thread_group group;
+		for(unsigned i = 0; i < self->workers; ++i)
+			group.create_thread(worker);
+		group.join_all();
+
+		if(self->quitting)
+			throw self->quit;
+		if(self->failed)
+			throw std::runtime_error(self->failure);
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Interpreter::runWorker() {
+		//This worker's IPs, in reverse order of execution like self->threads.
+		vector<Thread*> mine;
+
+		try {
+			while(!self->stopping) {
+				if(mine.empty() || self->waiting) {
+					boost::mutex::scoped_lock lock(self->lock);
+					while(mine.empty() && self->threads.empty() && self->liveThreads && !self->stopping)
+						self->spawned.wait(lock);
+
+					if(self->stopping || !self->liveThreads)
+						break;
+
+					//Take an even share of the waiting IPs, but at least one.
+					vector<typename PrivateData::Slot>& threads = self->threads;
+					std::size_t share = std::min(threads.size(), std::max<std::size_t>(1, threads.size() / self->workers));
+					for(std::size_t i = threads.size() - share; i < threads.size(); ++i)
+						mine.push_back(self->table.thread(threads[i]));
+					threads.erase(threads.end() - share, threads.end());
+					self->waiting = !threads.empty();
+				}
+
+				for(std::size_t i = mine.size(); i-- > 0; ) {
+					if(!mine[i]->advance()) {
+						delete mine[i];
+						mine[i] = 0;
+
+						boost::mutex::scoped_lock lock(self->lock);
+						if(!--self->liveThreads)
+							self->spawned.notify_all();
+					}
+				}
+
+				mine.erase(std::remove(mine.begin(), mine.end(), static_cast<Thread*>(0)), mine.end());
+			}
+		} catch(QuitProgram& q) {
+			boost::mutex::scoped_lock lock(self->lock);
+			if(!self->stopping) {
+				self->quitting = true;
+				self->quit = q;
+			}
+			self->stopping = true;
+		} catch(std::exception& e) {
+			boost::mutex::scoped_lock lock(self->lock);
+			if(!self->stopping) {
+				self->failed = true;
+				self->failure = e.what();
+			}
+			self->stopping = true;
+		} catch(...) {
+			boost::mutex::scoped_lock lock(self->lock);
+			if(!self->stopping) {
+				self->failed = true;
+				self->failure = "unknown failure in a worker thread";
+			}
+			self->stopping = true;
+		}
+
+		//Hand back whatever is left, so that the destructor deletes it.
+		boost::mutex::scoped_lock lock(self->lock);
+		self->addThreads(mine.begin(), mine.end());
+		self->spawned.notify_all();
+	}
+
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::Interpreter::spawnThread(const Vector& pos, const Vector& dir, const Vector& storageOffset, const StackStackT& stack) {
+		boost::mutex::scoped_lock lock(self->lock);
+
 		Thread* thread = new Thread(*this, self->tree, self->nextThreadID++);
 		thread->topContext().cursor().position(pos);
 		thread->topContext().cursor().direction(dir);
@@ -127,7 +721,11 @@ namespace stinkhorn {
 		thread->topContext().stack() = stack;
 		thread->topContext().cursor().advance();
 
-		self->threads.push_front(thread);
+		self->threads.push_back(thread->slot());
+		++self->liveThreads;
+
+		self->waiting = true;
+		self->spawned.notify_one();
 	}
 
 	template<class CellT, int Dimensions>
@@ -150,11 +748,28 @@ namespace stinkhorn {
 		return self->options.concurrent;
 	}
 
+	//True when only one IP is running and no debugger is attached, so the order of
+	//ticks can't be observed and an IP may do several ticks' worth of work at once.
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::Interpreter::singleThreaded() const {
+		return !self->options.debug && self->liveThreads == 1 && !self->budgeted;
+	}
+
 	template<class CellT, int Dimensions>
 	typename Stinkhorn<CellT, Dimensions>::Tree& Stinkhorn<CellT, Dimensions>::Interpreter::fungeSpace() {
 		return self->tree;
 	}
 
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::Analysis& Stinkhorn<CellT, Dimensions>::Interpreter::analysis() {
+		return self->analysis;
+	}
+
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::ThreadTable& Stinkhorn<CellT, Dimensions>::Interpreter::threadTable() {
+		return self->table;
+	}
+
 	template<class CellT, int Dimensions>
 	void Stinkhorn<CellT, Dimensions>::Interpreter::getArguments(vector<string>& args) const {
 		args.push_back(self->options.sourceFile);
@@ -182,6 +797,13 @@ namespace stinkhorn {
 		return self->registry;
 	}
 
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::FingerprintStack const&
+	Stinkhorn<CellT, Dimensions>::Interpreter::baseFingerprints() const
+	{
+		return self->base_fingerprints;
+	}
+
 	template<class CellT, int Dimensions>
 	const Options& Stinkhorn<CellT, Dimensions>::Interpreter::options() const {
 		return self->options;
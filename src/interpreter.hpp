@@ -7,6 +7,7 @@
 #include "vector.hpp"
 #include "options.hpp"
 
+#include <iosfwd>
 #include <string>
 #include <vector>
 
@@ -25,17 +26,55 @@ public:
 	~Interpreter();
 
 	Tree& fungeSpace();
+	Analysis& analysis();
+	ThreadTable& threadTable();
 
 	void run();
 
+	//Runs the program in the image, which must outlive the run, instead of
+	//loading the source file.
+	void run(ProgramImage& image);
+
+	//For embedding: load reads the program from source, or starts from an
+	//image (which must outlive the program), then runFor runs it for up to
+	//ticks ticks, and returns false once it has finished. It carries on from
+	//where it stopped when called again.
+	void load(std::istream& source);
+	void load(ProgramImage& image);
+	void load(MappedImage& image);
+	bool runFor(std::size_t ticks);
+
+	//The stack stack of the IP that ticks first, or once they have all stopped,
+	//of the last one to stop.
+	StackStackT& stack();
+
+	//Makes the interpreter as good as new, ready to run the source file named
+	//in the options (which may have changed) from the start. Funge-space's
+	//pages are kept for reuse, and so is where input and output go; the IPs,
+	//their stacks and everything else are deleted and made afresh.
+	void reset();
+
+	//Where the program's input comes from and its output goes: std::cin and
+	//std::cout, unless redirected.
+	std::istream& input();
+	std::ostream& output();
+	void redirect(std::istream& input, std::ostream& output);
+
 	void getArguments(std::vector<std::string>& args) const;
 	char** environment() const;
 
 	void spawnThread(const Vector& position, const Vector& direction, const Vector& storageOffset, const StackStackT& stack);
 
+	//Parks thread, which is about to read from (or write to) descriptor, if that
+	//would block while other IPs could be running. Returns false, and the
+	//instruction goes ahead and blocks, when the descriptor is ready or there is
+	//nobody else to run.
+	bool park(Thread& thread, int descriptor, bool writing);
+
 	bool isBefunge93() const;
 	bool isTrefunge() const;
 	bool isConcurrent() const;
+	bool singleThreaded() const;
 	bool debug() const;
 	bool warnings() const;
 
@@ -44,8 +83,43 @@ public:
 	std::vector<std::string> const& includeDirectories() const;
 	FingerprintRegistry& registry();
 
+	//Just the Befunge-93, Befunge-98 or Trefunge instructions. Each IP starts
+	//with a copy of this, which shares its fingerprints.
+	FingerprintStack const& baseFingerprints() const;
+
 protected:
+	//Runs the program once it is loaded, or just reports the analysis.
+	void runLoaded();
+
+	//Starts the first IP, unless the IPs have been restored from a checkpoint.
+	void startFirstThread();
+
+	//Saves a checkpoint, if the program is being checkpointed, now that one is
+	//due (see checkpointWanted).
+	void saveCheckpoint();
+
 	virtual void doRun();
+
+	//Runs every IP for one tick, in turn.
+	void tick();
+
+	//Runs the only IP until there are more or none, or for limit ticks, and
+	//returns how many it ran.
+	std::size_t runAlone(std::size_t limit);
+
+	//Deletes an IP that has stopped.
+	void retire(Thread* thread);
+
+	//Unparks the IPs whose descriptors are ready, first waiting for one if wait
+	//is set.
+	void unparkReady(bool wait);
+
+	//--parallel: each worker thread runs its own share of the IPs.
+	void doRunParallel();
+	void runWorker();
+
+	//--speculate: windows of ticks run in parallel, and in turn when IPs interfere.
+	void doRunSpeculative();
 };
 
 #endif
@@ -0,0 +1,336 @@
+#include "config.hpp"
+#include "libstinkhorn.h"
+#include "interpreter.hpp"
+#include "image.hpp"
+#include "options.hpp"
+#include "stack.hpp"
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+#include "boost/noncopyable.hpp"
+
+using namespace stinkhorn;
+
+//A program image of any cell size and number of dimensions.
+struct stinkhorn_image : boost::noncopyable {
+	virtual ~stinkhorn_image() {}
+};
+
+namespace {
+	//The program's input, read through a stinkhorn_read. Without one, there is none.
+	class CallbackInput : public std::streambuf {
+	public:
+		CallbackInput() : m_read(0), m_user(0) {
+			setg(m_buffer, m_buffer, m_buffer);
+		}
+
+		void set(stinkhorn_read read, void* user) {
+			m_read = read;
+			m_user = user;
+			setg(m_buffer, m_buffer, m_buffer);
+		}
+
+	protected:
+		int_type underflow() {
+			if(gptr() == egptr()) {
+				std::size_t size = m_read ? m_read(m_user, m_buffer, sizeof m_buffer) : 0;
+				if(!size)
+					return traits_type::eof();
+				setg(m_buffer, m_buffer, m_buffer + size);
+			}
+
+			return traits_type::to_int_type(*gptr());
+		}
+
+	private:
+		stinkhorn_read m_read;
+		void* m_user;
+		char m_buffer[4096];
+	};
+
+	//The program's output, written through a stinkhorn_write when flushed. Without
+	//one, it is thrown away.
+	class CallbackOutput : public std::streambuf {
+	public:
+		CallbackOutput() : m_write(0), m_user(0) {
+			setp(m_buffer, m_buffer + sizeof m_buffer);
+		}
+
+		void set(stinkhorn_write write, void* user) {
+			sync();
+			m_write = write;
+			m_user = user;
+		}
+
+	protected:
+		int_type overflow(int_type c) {
+			sync();
+			if(!traits_type::eq_int_type(c, traits_type::eof())) {
+				*pptr() = traits_type::to_char_type(c);
+				pbump(1);
+			}
+
+			return traits_type::not_eof(c);
+		}
+
+		int sync() {
+			if(m_write && pptr() != pbase())
+				m_write(m_user, pbase(), pptr() - pbase());
+			setp(m_buffer, m_buffer + sizeof m_buffer);
+			return 0;
+		}
+
+	private:
+		stinkhorn_write m_write;
+		void* m_user;
+		char m_buffer[4096];
+	};
+
+	//An interpreter of any cell size and number of dimensions.
+	struct Program : boost::noncopyable {
+		virtual ~Program() {}
+
+		virtual void load(std::istream& source) = 0;
+		virtual void load(stinkhorn_image& image) = 0;
+		virtual bool runFor(std::size_t ticks) = 0;
+		virtual std::size_t stackSize() = 0;
+		virtual long long stackAt(std::size_t index) = 0;
+		virtual void reset() = 0;
+	};
+
+	template<class CellT, int Dimensions>
+	struct ImageOf : stinkhorn_image {
+		typename Stinkhorn<CellT, Dimensions>::ProgramImage image;
+
+		ImageOf(std::istream& source) : image(source, false) {
+		}
+	};
+
+	template<class CellT, int Dimensions>
+	class ProgramOf : public Program {
+	public:
+		ProgramOf(Options& options, std::istream& input, std::ostream& output) : m_interpreter(options) {
+			m_interpreter.redirect(input, output);
+		}
+
+		void load(std::istream& source) {
+			m_interpreter.load(source);
+		}
+
+		void load(stinkhorn_image& image) {
+			ImageOf<CellT, Dimensions>* of = dynamic_cast<ImageOf<CellT, Dimensions>*>(&image);
+			if(!of)
+				throw std::runtime_error("the image's cell size or dimensions don't match the interpreter's");
+			m_interpreter.load(of->image);
+		}
+
+		bool runFor(std::size_t ticks) {
+			return m_interpreter.runFor(ticks);
+		}
+
+		std::size_t stackSize() {
+			return m_interpreter.stack().topStackSize();
+		}
+
+		long long stackAt(std::size_t index) {
+			return m_interpreter.stack().nth(index);
+		}
+
+		void reset() {
+			m_interpreter.reset();
+		}
+
+	private:
+		typename Stinkhorn<CellT, Dimensions>::Interpreter m_interpreter;
+	};
+
+	template<class CellT>
+	Program* createProgram(int dimensions, Options& options, std::istream& input, std::ostream& output) {
+		if(dimensions == 2)
+			return new ProgramOf<CellT, 2>(options, input, output);
+#ifndef B98_NO_TREFUNGE
+		if(dimensions == 3)
+			return new ProgramOf<CellT, 3>(options, input, output);
+#endif
+		return 0;
+	}
+
+	template<class CellT>
+	stinkhorn_image* createImage(int dimensions, std::istream& source) {
+		if(dimensions == 2)
+			return new ImageOf<CellT, 2>(source);
+#ifndef B98_NO_TREFUNGE
+		if(dimensions == 3)
+			return new ImageOf<CellT, 3>(source);
+#endif
+		return 0;
+	}
+
+	//y reports the environment variables; an embedded program sees none.
+	char* noEnvironment[] = { 0 };
+}
+
+struct stinkhorn_interpreter : boost::noncopyable {
+	Options options;
+	CallbackInput inputBuffer;
+	CallbackOutput outputBuffer;
+	std::istream input;
+	std::ostream output;
+	std::auto_ptr<Program> program;
+
+	//Set once the program has run q, which leaves its IPs where they were.
+	bool quit;
+	int exitCode;
+	std::string error;
+
+	stinkhorn_interpreter() : input(&inputBuffer), output(&outputBuffer), quit(false), exitCode(0) {
+		options.environment = noEnvironment;
+	}
+};
+
+extern "C" {
+	stinkhorn_interpreter* stinkhorn_create(int cell_bits, int dimensions) {
+		try {
+			std::auto_ptr<stinkhorn_interpreter> in(new stinkhorn_interpreter);
+			in->options.cellSize = cell_bits;
+			in->options.trefunge = dimensions == 3;
+
+			if(cell_bits == 32)
+				in->program.reset(createProgram<int32>(dimensions, in->options, in->input, in->output));
+#ifndef B98_NO_64BIT_CELLS
+			else if(cell_bits == 64)
+				in->program.reset(createProgram<int64>(dimensions, in->options, in->input, in->output));
+#endif
+
+			return in->program.get() ? in.release() : 0;
+		} catch(...) {
+			return 0;
+		}
+	}
+
+	void stinkhorn_destroy(stinkhorn_interpreter* in) {
+		delete in;
+	}
+
+	void stinkhorn_set_input(stinkhorn_interpreter* in, stinkhorn_read read, void* user) {
+		in->inputBuffer.set(read, user);
+		in->input.clear();
+	}
+
+	void stinkhorn_set_output(stinkhorn_interpreter* in, stinkhorn_write write, void* user) {
+		in->outputBuffer.set(write, user);
+		in->output.clear();
+	}
+
+	void stinkhorn_set_sandbox(stinkhorn_interpreter* in, int sandbox) {
+		in->options.sandbox = sandbox != 0;
+	}
+
+	int stinkhorn_load(stinkhorn_interpreter* in, char const* source, size_t length) {
+		try {
+			std::istringstream stream(std::string(source, length));
+			in->program->load(stream);
+			return 0;
+		} catch(std::exception& e) {
+			in->error = e.what();
+			return -1;
+		} catch(...) {
+			in->error = "unknown internal failure";
+			return -1;
+		}
+	}
+
+	int stinkhorn_load_image(stinkhorn_interpreter* in, stinkhorn_image* image) {
+		try {
+			in->program->load(*image);
+			return 0;
+		} catch(std::exception& e) {
+			in->error = e.what();
+			return -1;
+		} catch(...) {
+			in->error = "unknown internal failure";
+			return -1;
+		}
+	}
+
+	int stinkhorn_run(stinkhorn_interpreter* in, size_t ticks) {
+		if(in->quit)
+			return STINKHORN_FINISHED;
+
+		int result;
+		try {
+			bool running;
+			if(ticks)
+				running = in->program->runFor(ticks);
+			else
+				while((running = in->program->runFor(std::size_t(-1))))
+					;
+
+			result = running ? STINKHORN_RUNNING : STINKHORN_FINISHED;
+		} catch(QuitProgram& q) {
+			in->quit = true;
+			in->exitCode = q.returnCode;
+			result = STINKHORN_FINISHED;
+		} catch(std::exception& e) {
+			in->error = e.what();
+			result = STINKHORN_ERROR;
+		} catch(...) {
+			in->error = "unknown internal failure";
+			result = STINKHORN_ERROR;
+		}
+
+		in->output.flush();
+		return result;
+	}
+
+	int stinkhorn_exit_code(stinkhorn_interpreter* in) {
+		return in->exitCode;
+	}
+
+	char const* stinkhorn_error(stinkhorn_interpreter* in) {
+		return in->error.c_str();
+	}
+
+	size_t stinkhorn_stack_size(stinkhorn_interpreter* in) {
+		return in->program->stackSize();
+	}
+
+	long long stinkhorn_stack_at(stinkhorn_interpreter* in, size_t index) {
+		return in->program->stackAt(index);
+	}
+
+	void stinkhorn_reset(stinkhorn_interpreter* in) {
+		in->output.flush();
+		in->program->reset();
+		in->input.clear();
+		in->output.clear();
+		in->quit = false;
+		in->exitCode = 0;
+		in->error.clear();
+	}
+
+	stinkhorn_image* stinkhorn_image_create(int cell_bits, int dimensions, char const* source, size_t length) {
+		try {
+			std::istringstream stream(std::string(source, length));
+			if(cell_bits == 32)
+				return createImage<int32>(dimensions, stream);
+#ifndef B98_NO_64BIT_CELLS
+			if(cell_bits == 64)
+				return createImage<int64>(dimensions, stream);
+#endif
+			return 0;
+		} catch(...) {
+			return 0;
+		}
+	}
+
+	void stinkhorn_image_destroy(stinkhorn_image* image) {
+		delete image;
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef LIBSTINKHORN_H_INCLUDED
+#define LIBSTINKHORN_H_INCLUDED
+
+/*
+ * The C interface to libstinkhorn, for running Funge-98 programs inside another
+ * program. An interpreter can be reset and used again, which keeps funge-space's
+ * pages (the IPs, their stacks and the fingerprints are freed and made afresh),
+ * so a service can keep a few warm instead of starting a process for each
+ * program:
+ *
+ *     stinkhorn_interpreter* in = stinkhorn_create(32, 2);
+ *     stinkhorn_set_output(in, write_to_response, response);
+ *     stinkhorn_load(in, source, length);
+ *     while(stinkhorn_run(in, 100000) == STINKHORN_RUNNING)
+ *         ...;
+ *     stinkhorn_reset(in);
+ *
+ * A program run many times can be loaded once, into an image, which any number
+ * of interpreters start from without reading the source again. They share its
+ * pages, copying only the ones they write to.
+ *
+ * Nothing here is safe to call on the same interpreter from two threads at
+ * once, but different interpreters are independent, and an image can be used
+ * by interpreters on any number of threads.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct stinkhorn_interpreter stinkhorn_interpreter;
+typedef struct stinkhorn_image stinkhorn_image;
+
+/* What stinkhorn_run returns. */
+enum {
+	STINKHORN_FINISHED = 0, /* every IP has stopped; see stinkhorn_exit_code */
+	STINKHORN_RUNNING = 1,  /* the ticks ran out; stinkhorn_run carries on from here */
+	STINKHORN_ERROR = -1    /* see stinkhorn_error */
+};
+
+/* Reads up to size bytes of the program's input into buffer, and returns how
+ * many it read, or 0 at the end of the input. */
+typedef size_t (*stinkhorn_read)(void* user, char* buffer, size_t size);
+
+/* Writes size bytes of the program's output. */
+typedef void (*stinkhorn_write)(void* user, char const* buffer, size_t size);
+
+/* cell_bits is 32 or 64, and dimensions 2 (Befunge) or 3 (Trefunge). Returns
+ * NULL if this build doesn't support them. */
+stinkhorn_interpreter* stinkhorn_create(int cell_bits, int dimensions);
+void stinkhorn_destroy(stinkhorn_interpreter* in);
+
+/* Until these are set, the program has no input and its output goes nowhere. */
+void stinkhorn_set_input(stinkhorn_interpreter* in, stinkhorn_read read, void* user);
+void stinkhorn_set_output(stinkhorn_interpreter* in, stinkhorn_write write, void* user);
+
+/* Turns off running commands and file and network I/O, as --sandbox does. */
+void stinkhorn_set_sandbox(stinkhorn_interpreter* in, int sandbox);
+
+/* Loads the program, once after stinkhorn_create or stinkhorn_reset. Returns 0,
+ * or -1 on failure. */
+int stinkhorn_load(stinkhorn_interpreter* in, char const* source, size_t length);
+
+/* Loads the program from an image, in place of stinkhorn_load. The image must
+ * have the interpreter's cell size and dimensions, and must not be destroyed
+ * until the interpreter has been reset or destroyed. Returns 0, or -1 on
+ * failure. */
+int stinkhorn_load_image(stinkhorn_interpreter* in, stinkhorn_image* image);
+
+/* Runs the program for up to ticks ticks (0 for as many as it takes). Output is
+ * flushed before it returns. */
+int stinkhorn_run(stinkhorn_interpreter* in, size_t ticks);
+
+/* What the program returned with q, or 0 if it finished with @. */
+int stinkhorn_exit_code(stinkhorn_interpreter* in);
+
+/* Why stinkhorn_load or stinkhorn_run failed. */
+char const* stinkhorn_error(stinkhorn_interpreter* in);
+
+/* The top stack of the IP that ticks first, or once every IP has stopped, of
+ * the last one to stop. Index 0 is the top of the stack. */
+size_t stinkhorn_stack_size(stinkhorn_interpreter* in);
+long long stinkhorn_stack_at(stinkhorn_interpreter* in, size_t index);
+
+/* Makes the interpreter ready for another program, keeping funge-space's pages
+ * and the input, output and sandbox settings. Nothing else it allocated is
+ * kept. */
+void stinkhorn_reset(stinkhorn_interpreter* in);
+
+/* Loads a program into an image, as stinkhorn_create and stinkhorn_load would.
+ * Returns NULL if this build doesn't support the cell size and dimensions, or
+ * the program couldn't be loaded. */
+stinkhorn_image* stinkhorn_image_create(int cell_bits, int dimensions, char const* source, size_t length);
+void stinkhorn_image_destroy(stinkhorn_image* image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,8 +1,10 @@
 #include "config.hpp"
 #include "options.hpp"
 #include "interpreter.hpp"
+#include "batch.hpp"
 #include "debug.hpp"
 #include "cursor.hpp"
+#include "image.hpp"
 
 #include "fingerprint.hpp" //for TimerFingerprint
 
@@ -15,6 +17,40 @@
 using namespace stinkhorn;
 using namespace std;
 
+namespace {
+	//Repeated runs (--bench, --benchn) all start from one image of the program,
+	//loaded by the first.
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::ProgramImage& benchImage(Options& opts) {
+		static typename Stinkhorn<CellT, Dimensions>::ProgramImage image(opts);
+		return image;
+	}
+
+	template<class CellT, int Dimensions, class InterpreterT>
+	void runOnce(Options& opts) {
+		InterpreterT interpreter(opts);
+		if(opts.runCount == 1 || !opts.imageFile.empty())
+			interpreter.run();
+		else
+			interpreter.run(benchImage<CellT, Dimensions>(opts));
+	}
+
+	template<class CellT, int Dimensions>
+	void runOnce(Options& opts) {
+		if(opts.debug)
+			runOnce<CellT, Dimensions, typename Stinkhorn<CellT, Dimensions>::DebugInterpreter>(opts);
+		else
+			runOnce<CellT, Dimensions, typename Stinkhorn<CellT, Dimensions>::Interpreter>(opts);
+	}
+
+	//--make-image loads the program just as a run would, and writes out the result.
+	template<class CellT, int Dimensions>
+	void makeImage(Options& opts) {
+		typename Stinkhorn<CellT, Dimensions>::ProgramImage image(opts);
+		Stinkhorn<CellT, Dimensions>::MappedImage::write(opts.makeImage, image, opts.befunge93, opts.sourceFile);
+	}
+}
+
 int main(int argc, char** argv, char** envp) {
 	Options opts;
 	
@@ -35,45 +71,49 @@ int main(int argc, char** argv, char** envp) {
 
 		if(!opts.shouldRun)
 			return 0;
-		
-		//TODO: support multiple cell sizes
-		for(int i = 0; opts.runCount == -1 ? (timer.elapsedTime() < 2000000) : i < opts.runCount; ++i) {
-			try { 
-				if(opts.debug) {
+
+		if(!opts.batch.empty())
+			return runBatch(opts);
+
+		if(!opts.makeImage.empty()) {
 #ifndef B98_NO_64BIT_CELLS
-					if(opts.cellSize == 64) 
+			if(opts.cellSize == 64)
 #ifndef B98_NO_TREFUNGE
-						if(opts.trefunge)
-							Stinkhorn<int64, 3>::DebugInterpreter(opts).run();
-						else
+				if(opts.trefunge)
+					makeImage<int64, 3>(opts);
+				else
 #endif
-							Stinkhorn<int64, 2>::DebugInterpreter(opts).run();
-					else
+					makeImage<int64, 2>(opts);
+			else
 #endif
 #ifndef B98_NO_TREFUNGE
-						if(opts.trefunge)
-							Stinkhorn<int32, 3>::DebugInterpreter(opts).run();
-						else
+				if(opts.trefunge)
+					makeImage<int32, 3>(opts);
+				else
 #endif
-							Stinkhorn<int32, 2>::DebugInterpreter(opts).run();
-				} else {
+					makeImage<int32, 2>(opts);
+			return 0;
+		}
+		
+		//TODO: support multiple cell sizes
+		for(int i = 0; opts.runCount == -1 ? (timer.elapsedTime() < 2000000) : i < opts.runCount; ++i) {
+			try { 
 #ifndef B98_NO_64BIT_CELLS
-					if(opts.cellSize == 64) 
+				if(opts.cellSize == 64) 
 #ifndef B98_NO_TREFUNGE
-						if(opts.trefunge)
-							Stinkhorn<int64, 3>::Interpreter(opts).run();
-						else
-#endif
-							Stinkhorn<int64, 2>::Interpreter(opts).run();
+					if(opts.trefunge)
+						runOnce<int64, 3>(opts);
 					else
+#endif
+						runOnce<int64, 2>(opts);
+				else
 #endif
 #ifndef B98_NO_TREFUNGE
-						if(opts.trefunge)
-							Stinkhorn<int32, 3>::Interpreter(opts).run();
-						else
+					if(opts.trefunge)
+						runOnce<int32, 3>(opts);
+					else
 #endif
-							Stinkhorn<int32, 2>::Interpreter(opts).run();
-				}
+						runOnce<int32, 2>(opts);
 				++runCount;
 			} catch(QuitProgram&) {
 				++runCount;
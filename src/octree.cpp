@@ -10,15 +10,269 @@ namespace stinkhorn {
 		root = new NodeT();
 
 		max_put = min_put = Vector();
+		code_modified = false;
+		threads_lock = 0;
+		sharing = false;
+		copies = 0;
+		mapped.addresses = 0;
+		mapped.pages = 0;
+		mapped.count = 0;
+		mapped_found = 0;
 
 #if OCTREE_PAGE_CACHE_SIZE > 0
-		std::uninitialized_fill_n(&eden[0][0], EdenSize * EdenSize, (PageT*)0);
+		clear_eden();
 #endif
 	}
 
 	template<class T, int D>
 	Stinkhorn<T, D>::Tree::~Tree() {
+		//Pages borrowed from an image are the image's to free.
+		if(!sharing)
+			take_pages(root);
 		delete root;
+		delete threads_lock;
+
+		for(typename std::vector<PageT*>::iterator page = spare_pages.begin(); page != spare_pages.end(); ++page)
+			delete *page;
+	}
+
+	//Holds the tree's lock, if it has one.
+	template<class T, int D>
+	struct Stinkhorn<T, D>::Tree::Lock {
+		boost::recursive_mutex* mutex;
+
+		Lock(Tree& tree) : mutex(tree.threads_lock) {
+			if(mutex)
+				mutex->lock();
+		}
+
+		~Lock() {
+			if(mutex)
+				mutex->unlock();
+		}
+	};
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::share_between_threads() {
+		if(!threads_lock)
+			threads_lock = new boost::recursive_mutex;
+		publish_minmax();
+	}
+
+#if OCTREE_PAGE_CACHE_SIZE > 0
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::clear_eden() {
+		for(int y = 0; y < EdenSize; ++y) {
+			for(int x = 0; x < EdenSize; ++x)
+				eden[y][x].store(0, boost::memory_order_relaxed);
+		}
+	}
+#endif
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::take_pages(Tree& other) {
+		Lock lock(other);
+		take_pages(other.root);
+		spare_pages.insert(spare_pages.end(), other.spare_pages.begin(), other.spare_pages.end());
+		other.spare_pages.clear();
+
+		delete other.root;
+		other.root = new NodeT();
+		other.root_depth = 1;
+		other.max_put = other.min_put = Vector();
+		other.publish_minmax();
+		other.mapped.count = 0;
+#if OCTREE_PAGE_CACHE_SIZE > 0
+		other.clear_eden();
+#endif
+	}
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::take_pages(NodeT* n) {
+		if(!n)
+			return;
+
+		if(n->data) {
+			if(!n->data->shared)
+				spare_pages.push_back(n->data);
+			n->data = 0;
+		}
+
+		for(int i = 0; i < (1 << D); ++i)
+			take_pages(n->at(Vector(i & 1, (i >> 1) & 1, (i >> 2) & 1)));
+	}
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::share_pages() {
+		sharing = true;
+		share_pages(root);
+	}
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::share_pages(NodeT* n) {
+		if(!n)
+			return;
+
+		if(n->data)
+			n->data->shared = true;
+
+		for(int i = 0; i < (1 << D); ++i)
+			share_pages(n->at(Vector(i & 1, (i >> 1) & 1, (i >> 2) & 1)));
+	}
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::borrow_pages(Tree& image) {
+		assert(image.sharing && !sharing);
+		Lock lock(*this);
+		take_pages(root);
+		delete root;
+		root = borrow_pages(image.root);
+		root_depth = image.root_depth;
+
+		min_put = image.min_put;
+		max_put = image.max_put;
+		publish_minmax();
+		code_modified = image.code_modified.load();
+#if OCTREE_PAGE_CACHE_SIZE > 0
+		for(int y = 0; y < EdenSize; ++y) {
+			for(int x = 0; x < EdenSize; ++x)
+				eden[y][x].store(image.eden[y][x].load(boost::memory_order_relaxed), boost::memory_order_relaxed);
+		}
+#endif
+	}
+
+	//Copies the nodes under n, which point to the same pages as n's.
+	template<class T, int D>
+	typename Stinkhorn<T, D>::Tree::NodeT* Stinkhorn<T, D>::Tree::borrow_pages(NodeT* n) {
+		if(!n)
+			return 0;
+
+		NodeT* copy = new NodeT();
+		copy->data = n->data;
+		for(int i = 0; i < (1 << D); ++i) {
+			Vector index(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+			copy->at(index) = borrow_pages(n->at(index));
+		}
+
+		return copy;
+	}
+
+	template<class T, int D>
+	typename Stinkhorn<T, D>::Tree::PageT* Stinkhorn<T, D>::Tree::copy_page(NodeT* n, Vector const& addr) {
+		PageT* page = new_page();
+		page->copy(*n->data);
+		n->data = page;
+		++copies;
+
+#if OCTREE_PAGE_CACHE_SIZE > 0
+		if(inEden(addr))
+			eden[addr.y][addr.x].store(page, boost::memory_order_release);
+#endif
+		return page;
+	}
+
+	template<class T, int D>
+	bool Stinkhorn<T, D>::Tree::address_before(Vector const& a, Vector const& b) {
+		if(getZ(a) != getZ(b))
+			return getZ(a) < getZ(b);
+		if(a.y != b.y)
+			return a.y < b.y;
+		return a.x < b.x;
+	}
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::map_pages(MappedPages const& pages, Vector const& lowest, Vector const& highest, Vector const& min, Vector const& max) {
+		assert(!sharing);
+		Lock lock(*this);
+		take_pages(root);
+		delete root;
+		root = new NodeT();
+		root_depth = 1;
+#if OCTREE_PAGE_CACHE_SIZE > 0
+		clear_eden();
+#endif
+
+		//The tree is made big enough for every page now, so that find knows an
+		//address outside it isn't in the image either.
+		if(pages.count) {
+			expand_to(lowest);
+			expand_to(highest);
+		}
+
+		min_put = min;
+		max_put = max;
+		publish_minmax();
+		code_modified = false;
+		mapped = pages;
+		mapped_found = 0;
+	}
+
+	//Binary search of the mapped addresses, which find falls back on when a page
+	//isn't in the tree.
+	template<class T, int D>
+	typename Stinkhorn<T, D>::Tree::PageT* Stinkhorn<T, D>::Tree::mapped_page(Vector const& addr) {
+		std::size_t lower = 0, upper = mapped.count;
+		while(lower < upper) {
+			std::size_t middle = lower + (upper - lower) / 2;
+			T const* cells = mapped.addresses + middle * D;
+			Vector address(cells[0], cells[1], D == 3 ? cells[2] : 0);
+
+			if(address_before(address, addr))
+				lower = middle + 1;
+			else if(address_before(addr, address))
+				upper = middle;
+			else
+				return mapped.pages + middle;
+		}
+
+		return 0;
+	}
+
+	//Walking the whole tree needs every page in it.
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::map_all_pages() {
+		for(std::size_t i = 0; i < mapped.count; ++i) {
+			T const* cells = mapped.addresses + i * D;
+			find(Vector(cells[0], cells[1], D == 3 ? cells[2] : 0));
+		}
+
+		mapped.count = 0;
+	}
+
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::list_pages(std::vector<PageEntry>& pages) {
+		Lock lock(*this);
+		if(mapped.count)
+			map_all_pages();
+		T tree_max = T(1) << root_depth;
+		list_pages(root, Vector(-tree_max, -tree_max, -tree_max), Vector(tree_max, tree_max, tree_max), pages);
+	}
+
+	//A page hangs from the node whose bounds have shrunk to just its address.
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::list_pages(NodeT* n, Vector const& lower, Vector const& upper, std::vector<PageEntry>& pages) {
+		if(n->data)
+			pages.push_back(PageEntry(lower, n->data));
+
+		for(int i = 0; i < (1 << D); ++i) {
+			Vector index(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+			if(NodeT* child = n->at(index)) {
+				Vector child_lower, child_upper;
+				choose_child(lower, upper, index, child_lower, child_upper);
+				list_pages(child, child_lower, child_upper, pages);
+			}
+		}
+	}
+
+	template<class T, int D>
+	typename Stinkhorn<T, D>::Tree::PageT* Stinkhorn<T, D>::Tree::new_page() {
+		if(spare_pages.empty())
+			return new PageT();
+
+		PageT* page = spare_pages.back();
+		spare_pages.pop_back();
+		page->clear();
+		return page;
 	}
 
 	/**
@@ -66,30 +320,73 @@ namespace stinkhorn {
 
 	template<class T, int D>
 	void Stinkhorn<T, D>::Tree::update_minmax(Vector const& addr) {
+		if(threads_lock && inside_published(addr))
+			return;
+
+		Lock lock(*this);
 		max_put.x = std::max(addr.x, max_put.x);
 		max_put.y = std::max(addr.y, max_put.y);
-		max_put.z = std::max(addr.z, max_put.z);
+		setZ(max_put, std::max(getZ(addr), getZ(max_put)));
 		
 		min_put.x = std::min(addr.x, min_put.x);
 		min_put.y = std::min(addr.y, min_put.y);
-		min_put.z = std::min(addr.z, min_put.z);
+		setZ(min_put, std::min(getZ(addr), getZ(min_put)));
+		publish_minmax();
+	}
+
+	//Only needed once other threads might be reading the copy.
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::publish_minmax() {
+		if(!threads_lock)
+			return;
+
+		T const bounds[6] = { min_put.x, min_put.y, getZ(min_put), max_put.x, max_put.y, getZ(max_put) };
+		for(int i = 0; i < 6; ++i)
+			published_bounds[i].store(bounds[i], boost::memory_order_relaxed);
+	}
+
+	template<class T, int D>
+	bool Stinkhorn<T, D>::Tree::inside_published(Vector const& addr) const {
+		boost::memory_order const relaxed = boost::memory_order_relaxed;
+		return addr.x >= published_bounds[0].load(relaxed) && addr.y >= published_bounds[1].load(relaxed) && getZ(addr) >= published_bounds[2].load(relaxed)
+			&& addr.x <= published_bounds[3].load(relaxed) && addr.y <= published_bounds[4].load(relaxed) && getZ(addr) <= published_bounds[5].load(relaxed);
 	}
 	
 	template<class T, int D>
 	void Stinkhorn<T, D>::Tree::get_minmax(Vector& min, Vector& max) {
+		Lock lock(*this);
 		min = min_put;
 		max = max_put;
 	}
 
+	template<class T, int D>
+	void Stinkhorn<T, D>::Tree::set_minmax(Vector const& min, Vector const& max) {
+		Lock lock(*this);
+		min_put = min;
+		max_put = max;
+		publish_minmax();
+	}
+
 	template<class T, int D>
 	typename Stinkhorn<T, D>::Tree::PageT* Stinkhorn<T, D>::Tree::find(Vector const& addr, bool create) {
+#if OCTREE_PAGE_CACHE_SIZE > 0
+		//A page is only put in eden once it's ready, and is never freed, so it can
+		//be handed out again without the lock.
+		if(inEden(addr)) {
+			PageT* p = eden[addr.y][addr.x].load(boost::memory_order_acquire);
+			if(p && (!create || !p->shared))
+				return p;
+		}
+#endif
+
+		Lock lock(*this);
 #if OCTREE_PAGE_CACHE_SIZE > 0
 		if(inEden(addr)) {
-			PageT* p = eden[addr.y][addr.x];
-			if(p || !create) {
+			PageT* p = eden[addr.y][addr.x].load(boost::memory_order_relaxed);
+			if(p ? !create || !p->shared : !create && !mapped.count) {
 				return p;
 			}
-			//If it's not found, we still need to create it, which currently still involves dealing with the tree structure.
+			//If it's not found, we still need to create it (or fetch it from a mapped image), which currently still involves dealing with the tree structure.
 		}
 #endif
 		//std::cerr << "find(" << addr << ", " << std::boolalpha << create << ");\n";
@@ -101,8 +398,8 @@ namespace stinkhorn {
 		//If the tree isn't yet deep enough to contain this address, return 0 if we
 		//don't need to create it or deepen the tree and create the node otherwise
 		if(root_depth < sizeof(T) * CHAR_BIT - 1) {
-			if(addr.x >= tree_max || addr.y >= tree_max || addr.z >= tree_max ||
-				addr.x < -tree_max || addr.y < -tree_max || addr.z < -tree_max) {
+			if(addr.x >= tree_max || addr.y >= tree_max || getZ(addr) >= tree_max ||
+				addr.x < -tree_max || addr.y < -tree_max || getZ(addr) < -tree_max) {
 				if(!create)
 					return 0;
 
@@ -136,6 +433,8 @@ namespace stinkhorn {
 				break;
 			else if(depth == 0) {
 				assert(n && n->data);
+				if(create && n->data->shared)
+					return copy_page(n, addr);
 				return n->data;
 			}
 			
@@ -149,7 +448,9 @@ namespace stinkhorn {
 		//If not found but we know where it should be, insert it.
 		//Currently, parent is the deepest existing node on the correct path.
 		if(!n) {
-			if(!create)
+			//A mapped image's page goes into the tree the first time it is looked for.
+			PageT* page = mapped.count ? mapped_page(addr) : 0;
+			if(!page && !create)
 				return 0;
 
 			//idx_ is the index that was used to get to the current node
@@ -170,13 +471,20 @@ namespace stinkhorn {
 			n = parent;
 
 			assert(n);
-			n->data = new PageT();
+			n->data = page ? page : new_page();
 			//std::cerr << "  Creating  0x" << n->data << " for " << addr << "\n";
 			
 #if OCTREE_PAGE_CACHE_SIZE > 0
 			if(inEden(addr))
-				eden[addr.y][addr.x] = n->data;
+				eden[addr.y][addr.x].store(n->data, boost::memory_order_release);
 #endif
+
+			if(page) {
+				if(++mapped_found == mapped.count)
+					mapped.count = 0;
+				if(create)
+					return copy_page(n, addr);
+			}
 		}
 
 		assert(n->data);
@@ -188,12 +496,7 @@ namespace stinkhorn {
 	template<class T, int D>
 	inline typename Stinkhorn<T, D>::Vector Stinkhorn<T, D>::Tree::choose_child(Vector& lower, Vector& upper, Vector const& addr)
 	{
-		assert(addr.x >= lower.x);
-		assert(addr.y >= lower.y);
-		assert(addr.z >= lower.z);
-		assert(addr.x < upper.x);
-		assert(addr.y < upper.y);
-		assert(addr.z < upper.z);
+		assert(inside(addr, lower, upper));
 
 		Vector idx(0, 0, 0);
 
@@ -213,12 +516,13 @@ namespace stinkhorn {
 			upper.y = middle.y;
 		}
 
-		//TODO: Only if D == 3?
-		if(addr.y >= middle.y) {
-			lower.y = middle.y;
-			idx.y = 1;
-		} else {
-			upper.y = middle.y;
+		if(D == 3) {
+			if(getZ(addr) >= getZ(middle)) {
+				setZ(lower, getZ(middle));
+				setZ(idx, 1);
+			} else {
+				setZ(upper, getZ(middle));
+			}
 		}
 
 		return idx;
@@ -226,14 +530,14 @@ namespace stinkhorn {
 
 	namespace {
 #ifdef DEBUG
-		template<class T>
-		void ensure_cubic(vector3<T> const& lower, vector3<T> const& upper) {
-			vector3<T> size = upper - lower;
-			assert(size.x == size.y && size.y == size.z);
+		template<class T, int D>
+		void ensure_cubic(vectorN<T, D> const& lower, vectorN<T, D> const& upper) {
+			vectorN<T, D> size = upper - lower;
+			assert(size.x == size.y && (D == 2 || size.y == getZ(size)));
 		}
 #else
-		template<class T>
-		void ensure_cubic(vector3<T> const& lower, vector3<T> const& upper) { }
+		template<class T, int D>
+		void ensure_cubic(vectorN<T, D> const& lower, vectorN<T, D> const& upper) { }
 #endif
 	}
 
@@ -244,11 +548,11 @@ namespace stinkhorn {
 
 		new_lower.x = index.x ? middle.x : lower.x;
 		new_lower.y = index.y ? middle.y : lower.y;
-		new_lower.z = index.z ? middle.z : lower.z;
+		setZ(new_lower, getZ(index) ? getZ(middle) : getZ(lower));
 
 		new_upper.x = !index.x ? middle.x : upper.x;
 		new_upper.y = !index.y ? middle.y : upper.y;
-		new_upper.z = !index.z ? middle.z : upper.z;
+		setZ(new_upper, !getZ(index) ? getZ(middle) : getZ(upper));
 
 		ensure_cubic(new_lower, new_upper);
 	}
@@ -278,8 +582,8 @@ namespace stinkhorn {
 
 							Vector opposite = Vector(1, 1, 1) - v;
 							if(D == 2) {
-								assert(v.z == 0);
-								opposite.z = 0;
+								assert(getZ(v) == 0);
+								setZ(opposite, 0);
 							}
 
 							m->at(opposite) = n;
@@ -307,17 +611,19 @@ namespace stinkhorn {
 	//Expands the tree so that it can contain the specified page address. If the specified address can't
 	//currently be contained, new roots are added until that is the case.
 	//We take the largest of the address components. Positive values have 1 added to them, see abs1 for
-	//rationale.
+	//rationale. An address the tree can already contain leaves it as it is.
 	template<class T, int D>
 	void Stinkhorn<T, D>::Tree::expand_to(Vector const& addr) {
-		T largest = std::max<T>(std::max<T>(abs1(addr.x), abs1(addr.y)), abs1(addr.z) );
+		T largest = std::max<T>(std::max<T>(abs1(addr.x), abs1(addr.y)), abs1<T>(getZ(addr)) );
 		T bits = log2(largest);
-		increase_depth(bits);
+		if(bits > root_depth)
+			increase_depth(bits);
 	}
 
 	//These are the "easy" versions of the functions which are expected to be used
 	//when there is no cached page data. These will be much slower than Cursor::get
 	//if the page address is not in the initial page cache (eden).
+	//Neither takes the lock itself: find and update_minmax do, when they must.
 	template<class T, int D>
 	T Stinkhorn<T, D>::Tree::get(Vector const& location) {
 		Vector address = location >> PageT::bits;
@@ -338,7 +644,10 @@ namespace stinkhorn {
 		PageT* p = find(address, true);
 		assert(p);
 
-		p->get(location & PageT::mask) = value;
+		if(p->usage & PageT::Usage::code)
+			code_modified = true;
+		p->touch();
+		p->set(location & PageT::mask, value);
 	}
 
 	/**
@@ -356,6 +665,7 @@ namespace stinkhorn {
 	template<class T, int D>
 	bool Stinkhorn<T, D>::Tree::read_file_into(Vector const& location, std::istream& stream, int flags, Vector& size)
 	{
+		Lock lock(*this);
 		bool binary = flags & FileFlags::binary;
 		bool ff = ((flags & FileFlags::no_form_feeds) == 0) && !binary;
 		bool lf = true && !binary;
@@ -414,11 +724,11 @@ namespace stinkhorn {
 						if(r.y + 1 - r0.y + page_offset.y * PageT::size > size.y)
 							size.x = r.y + 1 - r0.y + page_offset.y * PageT::size;
 
-						r = Vector(r0.x, r0.y, r.z + 1);
+						r = Vector(r0.x, r0.y, getZ(r) + 1);
 
-						if(r.z == PageT::size) {
-							page_offset.z++;
-							r.z = 0;
+						if(getZ(r) == PageT::size) {
+							setZ(page_offset, getZ(page_offset) + 1);
+							setZ(r, 0);
 						}
 
 						page_offset.x = page_offset.y = 0;
@@ -442,8 +752,8 @@ namespace stinkhorn {
 						if(r.x + 1 - r0.x + page_offset.x * PageT::size > size.x)
 							size.x = r.x + 1 - r0.x + page_offset.x * PageT::size;
 
-						r = Vector(r0.x, r.y + 1, r.z);
-						assert(r.x < PageT::size && r.y <= PageT::size && r.z < PageT::size);
+						r = Vector(r0.x, r.y + 1, getZ(r));
+						assert(r.x < PageT::size && r.y <= PageT::size && getZ(r) < PageT::size);
 
 						//This should happen only when we need to refresh the cache
 						if(r.y == PageT::size) {
@@ -458,14 +768,18 @@ namespace stinkhorn {
 
 					else {
 						assert(p);
-						assert(r.x < PageT::size && r.y < PageT::size && r.z < PageT::size);
+						assert(r.x < PageT::size && r.y < PageT::size && getZ(r) < PageT::size);
 						assert((!lf || c != '\n') && (!ff || c != '\f'));
-						if(c != ' ')
-							p->get(r) = c;
+						if(c != ' ') {
+							if(p->usage & PageT::Usage::code)
+								code_modified = true;
+							p->touch();
+							p->set(r, c);
+						}
 
 						maxput.x = std::max<T>(maxput.x, r.x + page_offset.x * PageT::size);
 						maxput.y = std::max<T>(maxput.y, r.y + page_offset.y * PageT::size);
-						maxput.z = std::max<T>(maxput.z, r.z + page_offset.z * PageT::size);
+						setZ(maxput, std::max<T>(getZ(maxput), getZ(r) + getZ(page_offset) * PageT::size));
 
 						++r.x;
 						if(r.x == PageT::size) {
@@ -488,14 +802,14 @@ namespace stinkhorn {
 				size.x = r.x + 1 - r0.x + page_offset.x * PageT::size;
 			if(r.y - r0.y + 1 + page_offset.y * PageT::size > size.y)
 				size.y = r.y + 1 - r0.y + page_offset.y * PageT::size;
-			if(r.z - r0.z + 1 + page_offset.z * PageT::size > size.z)
-				size.z = r.z + 1 - r0.z + page_offset.z * PageT::size;
+			if(getZ(r) - getZ(r0) + 1 + getZ(page_offset) * PageT::size > getZ(size))
+				setZ(size, getZ(r) + 1 - getZ(r0) + getZ(page_offset) * PageT::size);
 		}
 	    
 		if(size.y == 0)
 			size.y = 1;
-		if(size.z == 0)
-			size.z = 1;
+		if(getZ(size) == 0)
+			setZ(size, 1);
 
 		update_minmax(location);
 		update_minmax(maxput);
@@ -505,11 +819,12 @@ namespace stinkhorn {
 	}
 
 	namespace {
-		template<class PageT>
-		void debug_page_contents(PageT* p) {
+		template<class T, int D>
+		void debug_page_contents(typename Stinkhorn<T, D>::TreePage* p) {
+			typedef typename Stinkhorn<T, D>::TreePage PageT;
 			for(int y = 0; y < PageT::size; y++) {
 				for(int x = 0; x < PageT::size; x++) {
-					int c = p->get(vector3<int>(x,y,0));
+					int c = p->get(vectorN<T, D>(x,y,0));
 					if(c <= 32) c = '.';
 					if(c > 255 || c < 0) c = '.';
 					std::cerr.put(char(c));
@@ -522,6 +837,9 @@ namespace stinkhorn {
 	template<class T, int D>
 	bool Stinkhorn<T, D>::Tree::write_file_from(Vector const& from, Vector const& original_to, std::ostream& stream, int flags)
 	{
+		Lock lock(*this);
+		if(mapped.count)
+			map_all_pages();
 		bool linear = flags & 0x1;
 
 		Vector r, r0;
@@ -529,10 +847,10 @@ namespace stinkhorn {
 		r = r0;
 	    
 		Vector to = original_to;
-		if(to.z == from.z)
-			to.z++;
+		if(getZ(to) == getZ(from))
+			setZ(to, getZ(to) + 1);
 		
-		bool is2d = to.z - from.z <= 1;
+		bool is2d = getZ(to) - getZ(from) <= 1;
 	    
 		std::string spaces;
 		std::deque<PageT*> pages;
@@ -569,8 +887,12 @@ namespace stinkhorn {
 				}
 	            
 				if(page_offset.y >= max_offset.y && (r.y >= (to.y & PageT::mask))) {
+					//A 2D space has only the one plane.
+					if(D == 2)
+						break;
+
 					r.y = r0.y;
-					r.z++;
+					setZ(r, getZ(r) + 1);
 					r.x = r0.x;
 					p = 0;
 					page_offset.x = 0;
@@ -581,14 +903,14 @@ namespace stinkhorn {
 						spaces += "\f";
 				}
 	            
-				if(r.z == PageT::size) {
-					page_offset.z++;
-					r.z = 0;
+				if(getZ(r) == PageT::size) {
+					setZ(page_offset, getZ(page_offset) + 1);
+					setZ(r, 0);
 					p = 0;
 					pages.clear();
 				}
 	            
-				if(page_offset.z >= max_offset.z && (r.z >= (to.z & PageT::mask))) {
+				if(D == 3 && getZ(page_offset) >= getZ(max_offset) && (getZ(r) >= (getZ(to) & PageT::mask))) {
 					break;
 				}
 	            
@@ -666,10 +988,10 @@ namespace stinkhorn {
 		 * FT is a template parameter so that we don't need to know the type of the
 		 * Tree.
 		 */
-		template<class T>
-		bool intersection(FindTypes find_type, int dimensions, vector3<T> const& ray_point, 
-			vector3<T> const& ray_direction, vector3<T> const& cube_lower, vector3<T> const& cube_upper, 
-			vector3<T>& location, T& distance)
+		template<class T, int D>
+		bool intersection(FindTypes find_type, int dimensions, vectorN<T, D> const& ray_point, 
+			vectorN<T, D> const& ray_direction, vectorN<T, D> const& cube_lower, vectorN<T, D> const& cube_upper, 
+			vectorN<T, D>& location, T& distance)
 		{
 			ensure_cubic(cube_lower, cube_upper);
 
@@ -677,10 +999,8 @@ namespace stinkhorn {
 			//advance the point along the ray and return that, if it's still inside
 			//the cube.
 			if(find_type == nearest) {
-				vector3<T> p(ray_point + ray_direction);
-				if(p.x >= cube_lower.x && p.y >= cube_lower.y && p.z >= cube_lower.z
-				   && p.x < cube_upper.x && p.y < cube_upper.y && p.z < cube_upper.z)
-				{
+				vectorN<T, D> p(ray_point + ray_direction);
+				if(inside(p, cube_lower, cube_upper)) {
 					distance = 1;
 					location = p;
 					return true;
@@ -708,7 +1028,7 @@ namespace stinkhorn {
 				T& current_steps;
 				bool& found;
 				FindTypes find_type;
-				vector3<T> const& cube_lower,
+				vectorN<T, D> const& cube_lower,
 								& cube_upper,
 								& ray_point,
 								& ray_direction;
@@ -727,12 +1047,9 @@ namespace stinkhorn {
 	                
 					//Make sure it really is intersecting, and not some other cube
 					//off to the side of the ray
-					vector3<T> ep = ray_point + steps * ray_direction;
-					if(ep.x <  cube_lower.x || ep.y <  cube_lower.y || ep.z <  cube_lower.z ||
-					   ep.x >= cube_upper.x || ep.y >= cube_upper.y || ep.z >= cube_upper.z)
-					{
+					vectorN<T, D> ep = ray_point + steps * ray_direction;
+					if(!inside(ep, cube_lower, cube_upper))
 						return;
-					}
 	                
 					if(steps > 0) {
 						if((steps < current_steps || current_steps == 0) && find_type == nearest)
@@ -748,8 +1065,8 @@ namespace stinkhorn {
 				}
 
 				face_checker(FindTypes find_type, T& current_steps, bool& found,
-							 vector3<T> const& cube_lower, vector3<T> const& cube_upper,
-							 vector3<T> const& ray_point, vector3<T> const& ray_direction):
+							 vectorN<T, D> const& cube_lower, vectorN<T, D> const& cube_upper,
+							 vectorN<T, D> const& ray_point, vectorN<T, D> const& ray_direction):
 					find_type(find_type), current_steps(current_steps), found(found), 
 					cube_lower(cube_lower), cube_upper(cube_upper),
 					ray_point(ray_point), ray_direction(ray_direction)
@@ -772,10 +1089,10 @@ namespace stinkhorn {
 			//As far as I ca see, it's impossible to hit these faces in 2D mode, ever.
 			//Perhaps a check on the ray's direction would be appropriate.
 			if(dimensions == 3) {
-				fc.check_face(face_checker::lower_face, cube_lower.z, 
-							  cube_upper.z, ray_point.z, ray_direction.z);
-				fc.check_face(face_checker::upper_face, cube_lower.z, 
-							  cube_upper.z, ray_point.z, ray_direction.z);
+				fc.check_face(face_checker::lower_face, getZ(cube_lower), 
+							  getZ(cube_upper), getZ(ray_point), getZ(ray_direction));
+				fc.check_face(face_checker::upper_face, getZ(cube_lower), 
+							  getZ(cube_upper), getZ(ray_point), getZ(ray_direction));
 			}
 	        
 			if(found) {
@@ -794,11 +1111,11 @@ namespace stinkhorn {
 		template<class T, int D>
 		struct cubedef {
 			typename Stinkhorn<T, D>::Tree::NodeT* node;
-			vector3<T> lower, upper, p;
+			vectorN<T, D> lower, upper, p;
 
 			cubedef(): node(0) {}
 
-			cubedef(typename Stinkhorn<T, D>::Tree::NodeT* node, vector3<T> const& lower, vector3<T> const& upper)
+			cubedef(typename Stinkhorn<T, D>::Tree::NodeT* node, vectorN<T, D> const& lower, vectorN<T, D> const& upper)
 				: node(node), lower(lower), upper(upper) 
 			{}
 
@@ -838,16 +1155,14 @@ namespace stinkhorn {
 		Vector r = point;
 
 		bool found = false;
-		while(r.x >= lower.x && r.y >= lower.y && r.z >= lower.z && 
-			r.x < upper.x && r.y < upper.y && r.z < upper.z)
-		{
+		while(inside(r, lower, upper)) {
 			//Convert from the position in space to an index into the vector, and
 			//make absolutely sure that it's valid index. (Shouldn't this be done in
 			//the getter anyway?)
 			Vector index = r - lower;
 			assert(n->data);
 			assert(index.x < PageT::size && index.y < PageT::size 
-				  && index.z < PageT::size);
+				  && getZ(index) < PageT::size);
 	        
 			bool found;
 			char c = static_cast<char>(n->data->get(index));
@@ -908,17 +1223,13 @@ namespace stinkhorn {
 		typedef cubedef<T,D> CubeT;
 		std::map<T, CubeT> kids;
 
-		//Find the non-null children of n
-		//TODO: Only check one of the two Z-halves in 2D.
-		for(int k = 0; k < 2; ++k) {
+		//Find the non-null children of n. A 2D node has no Z-halves to look at.
+		for(int k = 0; k < D - 1; ++k) {
 			for(int i = 0; i < 2; ++i) {
 				for(int j = 0; j < 2; ++j) {
 					Vector idx(i, j, k);
-					Vector idx_fixed(idx); //We don't want the Z-less index to actually be used for choose_child
-					if(D == 2) //HACK: It should work, but is kind of inefficient since we're checking twice as many cubes.
-						idx_fixed.z = 0;
 
-					NodeT* child = n->at(idx_fixed);
+					NodeT* child = n->at(idx);
 					if(!child)
 						continue;
 
@@ -987,7 +1298,7 @@ namespace stinkhorn {
 
 	/**
 	 * The purpose of this function is for line wrapping in Funge-98's Lahey-space
-	 * model. The first two vector3 parameters, @point and @direction, form a line
+	 * model. The first two vector parameters, @point and @direction, form a line
 	 * in 3D space. The function determines the first non-space character in the
 	 * funge-space which lies on a step on the line.
 	 *
@@ -997,8 +1308,11 @@ namespace stinkhorn {
 	bool Stinkhorn<T, D>::Tree::find_instruction_on_line(FindTypes find_type, SearchFor searching_for,
 		Vector const& point, Vector const& direction, Vector& result)
 	{
+		Lock lock(*this);
+		if(mapped.count)
+			map_all_pages();
 		//If the dimension is 2, we can't have 3D vectors. That would just be silly.
-		assert( !(D == 2 && direction.z != 0) );
+		assert( !(D == 2 && getZ(direction) != 0) );
 	    
 		T half_width = 1 << root_depth;
 		half_width <<= PageT::bits;
@@ -1023,6 +1337,7 @@ namespace stinkhorn {
 	bool Stinkhorn<T, D>::Tree::advance_cursor(Vector const& current_position, Vector const& current_direction,
 		Vector& new_position, SearchFor searching_for, bool allow_backward)
 	{
+		Lock lock(*this);
 		//if the IP is stuck, we're probably on an instruction (unless another thread has
 		//been modifying the code). If we're on an instruction, we can just stay on that 
 		//instruction for as long as we like.
@@ -4,6 +4,8 @@
 #include "stinkhorn.hpp"
 #include "vector.hpp"
 
+#include "boost/thread/recursive_mutex.hpp"
+#include "boost/atomic.hpp"
 #include <cmath>
 #include <cassert>
 #include <string>
@@ -11,6 +13,9 @@
 #include <iomanip>
 #include <deque>
 #include <map>
+#include <utility>
+#include <vector>
+#include <algorithm>
 
 #ifdef max
 #undef max
@@ -49,32 +54,80 @@ namespace stinkhorn {
 	protected:
 		static const T page_area = size * size * (Dimensions==2 ? 1 : size);
 	public:
+		///What the load-time analysis (see analysis.hpp) found on the page.
+		struct Usage {
+			static const unsigned char
+				code = 1, ///<an IP can pass over it
+				data = 2; ///<a g or p with constant coordinates reads or writes it
+		};
 
+		///The cells. Under --parallel several threads read and write them at
+		///once, so outside of loading and saving they are only touched through
+		///get and set, which access each one atomically.
 		T data[page_area];
+		unsigned char usage;
+
+		///Set on a program image's pages, which trees share (see
+		///Tree::borrow_pages). Nothing writes to a shared page; a tree copies it
+		///first, and writes to the copy.
+		bool shared;
+
+		///Set whenever the page is written to (see touch), and cleared once a
+		///checkpoint has saved it (see Checkpoint), which then only saves it
+		///again if it is set.
+		bool dirty;
 
 		/**
 		 * We use operator new() in this form because the more widely used form
 		 * of new[] constructs every element in the array, which would be
 		 * redundant, since we need to initialise the array with 32 (' ')
 		 */
-		TreePage() {
+		TreePage() : usage(0), shared(false), dirty(true) {
 			std::uninitialized_fill(data, data + page_area, T(' '));
 		}
 
 		~TreePage() {
 		}
 
-		T& get(Vector const& index) {
-			assert(Dimensions == 3 || index.z == 0);
-			return data[index.x + size * (index.y + size * index.z)];
+		///Makes a page as good as new, for reuse.
+		void clear() {
+			std::fill(data, data + page_area, T(' '));
+			usage = 0;
+			dirty = true;
 		}
 
+		///Makes this page a private copy of a shared one.
+		void copy(TreePage const& page) {
+			std::copy(page.data, page.data + page_area, data);
+			usage = page.usage;
+			dirty = true;
+		}
+
+		//The loads and stores are relaxed: a cell is a single word, so on the
+		//usual targets these are the same plain moves as before, but two IPs
+		//on different threads may now share a cell without undefined behaviour.
+		//(atomic_ref only takes a non-const cell, but a load doesn't write it.)
 		T get(Vector const& index) const {
-			assert(Dimensions == 3 || index.z == 0);
-			return data[index.x + size * (index.y + size * index.z)];
+			return boost::atomic_ref<T>(const_cast<T&>(data[offset(index)])).load(boost::memory_order_relaxed);
+		}
+
+		void set(Vector const& index, T value) {
+			boost::atomic_ref<T>(data[offset(index)]).store(value, boost::memory_order_relaxed);
+		}
+
+		///Marks the page as written to since the last checkpoint.
+		void touch() {
+			boost::atomic_ref<bool> d(dirty);
+			if(!d.load(boost::memory_order_relaxed))
+				d.store(true, boost::memory_order_relaxed);
 		}
 
 	private:
+		static std::size_t offset(Vector const& index) {
+			assert(Dimensions == 3 || getZ(index) == 0);
+			return index.x + size * (index.y + size * getZ(index));
+		}
+
 		//Purposely not instantiated, because these could lead to bad things.
 		//Now we can't call these accidentally without getting compile/link 
 		//errors.
@@ -124,7 +177,7 @@ namespace stinkhorn {
 			delete children[1][1][1];
 		}
 
-		TreeNode<CellT, 3>*& at(vector3<CellT> const& index) {
+		TreeNode<CellT, 3>*& at(vectorN<CellT, 3> const& index) {
 			return children[index.x][index.y][index.z];
 		}
 	};
@@ -149,8 +202,7 @@ namespace stinkhorn {
 			delete children[1][1];
 		}
 
-		TreeNode<CellT, 2>*& at(vector3<CellT> const& index) {
-			assert(index.z == 0);
+		TreeNode<CellT, 2>*& at(vectorN<CellT, 2> const& index) {
 			return children[index.x][index.y];
 		}
 	};
@@ -212,12 +264,76 @@ namespace stinkhorn {
 
 		void update_minmax(Vector const& put);
 		void get_minmax(Vector& min, Vector& max);
+		void set_minmax(Vector const& min, Vector const& max); ///<For putting back speculative writes
 
 		static T log2(T v);
+
+		///Set by the first write to a page that the analysis found code on, after
+		///which the analysis no longer describes funge-space.
+		boost::atomic<bool> code_modified;
+
+		///Called before IPs start running on more than one thread (--parallel and
+		///--speculate). From then on the node structure and bounds are changed
+		///under a lock. Pages are never freed, so cells on a page already found
+		///are not locked (TreePage reads and writes each one atomically), and
+		///neither is finding a page in eden again, or a put inside the bounds.
+		///Pages outside eden are still found under the lock.
+		void share_between_threads();
+
+		///Takes other's pages, leaving it empty, and hands them out (cleared) as
+		///this tree needs new ones. Reusing an interpreter reuses its pages this way.
+		void take_pages(Tree& other);
+
+		///Makes every page shared and read-only, so that other trees can borrow
+		///them (see ProgramImage). This tree must not change again, and must
+		///outlive the trees borrowing its pages.
+		void share_pages();
+
+		///Starts this tree, which must be empty, off as a copy of image, sharing
+		///its pages. find(..., true) copies a shared page the first time it is
+		///asked for one to write to, so only the pages written are duplicated.
+		void borrow_pages(Tree& image);
+
+		///How many shared pages have been copied. Each copy moves a page, so a
+		///cursor holding one finds it again when this changes.
+		unsigned pages_copied() const {
+			return copies.load(boost::memory_order_acquire);
+		}
+
+		///Every page, along with its address, in no particular order.
+		typedef std::pair<Vector, PageT*> PageEntry;
+		void list_pages(std::vector<PageEntry>& pages);
+
+		///The pages of a funge-space image mapped into memory (see MappedImage):
+		///count page addresses, Dimensions cells each, in address_before order,
+		///and the pages at them, in the same order.
+		struct MappedPages {
+			T const* addresses;
+			PageT* pages;
+			std::size_t count;
+		};
+
+		static bool address_before(Vector const& a, Vector const& b);
+
+		///Starts this tree, which must be empty, off with mapped's pages, which
+		///cover lowest to highest (page addresses) and hold cells from min to max.
+		///Each page only goes into the tree when find first looks for it, so a
+		///huge image costs no more to start from than a small one. Like borrowed
+		///pages, they are shared, and copied before they are written to.
+		void map_pages(MappedPages const& mapped, Vector const& lowest, Vector const& highest, Vector const& min, Vector const& max);
 	    
 	protected:
 		void increase_depth(T new_depth);
 		void expand_to(Vector const& address);
+
+		PageT* new_page();
+		void take_pages(NodeT* n);
+		void share_pages(NodeT* n);
+		NodeT* borrow_pages(NodeT* n);
+		PageT* copy_page(NodeT* n, Vector const& addr);
+		PageT* mapped_page(Vector const& addr);
+		void map_all_pages();
+		void list_pages(NodeT* n, Vector const& lower, Vector const& upper, std::vector<PageEntry>& pages);
 	    
 		Vector choose_child(Vector& lower, Vector& upper, Vector const& target);
 		void choose_child(Vector const& lower, Vector const& upper, Vector const& index, Vector& new_lower, Vector& new_upper);
@@ -227,8 +343,9 @@ namespace stinkhorn {
 
 	private:
 #if OCTREE_PAGE_CACHE_SIZE > 0
-		PageT* eden[EdenSize][EdenSize];
-		bool inEden(Vector addr) { return addr.z == 0 && addr.x >= 0 && addr.x < EdenSize && addr.y >= 0 && addr.y < EdenSize; }
+		boost::atomic<PageT*> eden[EdenSize][EdenSize];
+		void clear_eden();
+		bool inEden(Vector addr) { return getZ(addr) == 0 && addr.x >= 0 && addr.x < EdenSize && addr.y >= 0 && addr.y < EdenSize; }
 #endif
 
 		T root_depth;
@@ -237,6 +354,28 @@ namespace stinkhorn {
 
 		//Upper and lower bounds that have actually been assigned a value
 		Vector min_put, max_put;
+
+		//A copy of min_put and max_put (x, y and z of each) for update_minmax to
+		//check without the lock, kept once the tree is shared between threads.
+		//The bounds only grow while IPs run, so a stale copy errs towards locking.
+		boost::atomic<T> published_bounds[6];
+		void publish_minmax();
+		bool inside_published(Vector const& addr) const;
+
+		//Pages taken from another tree, not in use yet.
+		std::vector<PageT*> spare_pages;
+
+		//Set by share_pages, after which the shared pages are this tree's to free.
+		bool sharing;
+		boost::atomic<unsigned> copies;
+
+		//The mapped pages which may not be in the tree yet. Once they all are,
+		//mapped.count is 0, and find stops looking for them.
+		MappedPages mapped;
+		std::size_t mapped_found;
+
+		struct Lock;
+		boost::recursive_mutex* threads_lock;
 	};
 }
 
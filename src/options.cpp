@@ -86,6 +86,70 @@ void stinkhorn::parseOptions(int argc, char* argv[], char** envp, Options& opts)
 		else
 			if(arg == "--sandbox" || arg == "-s")
 				opts.sandbox = true;
+		else
+			if(arg == "--analyze")
+				opts.analyze = true;
+		else
+			if(arg == "--parallel")
+				opts.parallel = true;
+		else
+			if(arg == "--speculate")
+				opts.speculate = true;
+		else
+			if(arg == "--batch") {
+				if(!*++argv)
+					throw runtime_error("expected an argument for " + arg);
+				argc--;
+
+				opts.batch = *argv;
+			}
+		else
+			if(arg == "--checkpoint") {
+				if(!*++argv)
+					throw runtime_error("expected an argument for " + arg);
+				argc--;
+
+				opts.checkpointFile = *argv;
+			}
+		else
+			if(arg == "--checkpoint-every") {
+				try {
+					if(!*++argv)
+						throw runtime_error("expected an argument for " + arg);
+					argc--;
+
+					int seconds = boost::lexical_cast<int>(*argv);
+					if(seconds <= 0)
+						throw runtime_error("argument to --checkpoint-every was nonpositive");
+					opts.checkpointInterval = seconds;
+				} catch (boost::bad_lexical_cast&) {
+					throw runtime_error("argument to --checkpoint-every was incorrect");
+				}
+			}
+		else
+			if(arg == "--restore") {
+				if(!*++argv)
+					throw runtime_error("expected an argument for " + arg);
+				argc--;
+
+				opts.restoreFile = *argv;
+			}
+		else
+			if(arg == "--image") {
+				if(!*++argv)
+					throw runtime_error("expected an argument for " + arg);
+				argc--;
+
+				opts.imageFile = *argv;
+			}
+		else
+			if(arg == "--make-image") {
+				if(!*++argv)
+					throw runtime_error("expected an argument for " + arg);
+				argc--;
+
+				opts.makeImage = *argv;
+			}
 		else 
 			if(arg == "--include-directory" || arg == "-I") {
 				if(!*++argv)
@@ -122,8 +186,27 @@ void stinkhorn::parseOptions(int argc, char* argv[], char** envp, Options& opts)
 		}
 	}
 
-	if(opts.shouldRun && opts.sourceFile.empty() && opts.sourceLines.empty())
+	if(!opts.batch.empty()) {
+		if(!opts.sourceFile.empty() || !opts.sourceLines.empty())
+			throw runtime_error("--batch takes the programs to run from its list");
+		if(opts.debug)
+			throw runtime_error("--batch can't be used with --debug");
+	} else if(opts.shouldRun && opts.sourceFile.empty() && opts.sourceLines.empty() && opts.restoreFile.empty() && opts.imageFile.empty())
 		throw runtime_error("source file not specified");
+
+	if(!opts.imageFile.empty()) {
+		if(!opts.sourceFile.empty() || !opts.sourceLines.empty())
+			throw runtime_error("--image takes the program from the image, not a source file");
+		if(!opts.restoreFile.empty() || !opts.makeImage.empty() || !opts.batch.empty())
+			throw runtime_error("--image can't be used with --restore, --make-image or --batch");
+	}
+	if(!opts.makeImage.empty() && (!opts.restoreFile.empty() || !opts.batch.empty()))
+		throw runtime_error("--make-image needs a source file, not --restore or --batch");
+
+	if(opts.checkpointInterval && opts.checkpointFile.empty())
+		throw runtime_error("--checkpoint-every needs --checkpoint");
+	if((!opts.checkpointFile.empty() || !opts.restoreFile.empty()) && (opts.parallel || opts.debug || opts.runCount != 1 || !opts.batch.empty()))
+		throw runtime_error("--checkpoint and --restore can't be used with --parallel, --debug, --bench or --batch");
 }
 
 void showHelp() {
@@ -147,11 +230,20 @@ void showHelp() {
 		option("-w", "--warnings", "turn on warnings", false),
 		option("-93", "--befunge-93", "befunge-93 compatibility", false),
 		option("-N", "--no-concurrent", "disable concurrency", false),
+		option("", "--parallel", "run IPs on all cores at once. IPs no longer take turns in a fixed order, so programs that rely on the order of ticks may behave differently", false),
+		option("", "--speculate", "run IPs on all cores at once, but check that they didn't interfere, and if they did, run them again in turn. Programs behave exactly as they would without it", false),
 		option("-s", "--sandbox", "disable system execution and file/network I/O", false),
 		option("-B", "--cell-size", "change the cell size (default 32)", true),
 		option("-3", "--trefunge", "use trefunge instead of befunge", false),
 		option("-S", "--source-line", "specifies the source code inline, instead of reading from a file. May be specified again to specify the next line of the source. Note: ^, <, > and \" must usually be escaped.", false),
 		option("", "--show-source-lines", "useful for debugging --source-line", false),
+		option("", "--batch", "run each program in the given list file or directory (see batch.hpp), several at once, and print each one's exit code and running time", true),
+		option("", "--analyze", "instead of running, list which pages hold code and which hold data, and where the program may modify itself", false),
+		option("", "--checkpoint", "save the running program to the given file on SIGUSR1 (see --checkpoint-every), so that it can be restored later", true),
+		option("", "--checkpoint-every", "with --checkpoint, also save the program every given number of seconds", true),
+		option("", "--restore", "carry on running the program saved in the given checkpoint file. Input it had already read isn't read again", true),
+		option("", "--make-image", "instead of running, write the source file's funge-space, ready to run, to the given image file", true),
+		option("", "--image", "run the program in the given image file (see --make-image), which starts at once however big it is. The image must be made by the same build, with the same cell size and --befunge-93 setting", true),
 		option("-d", "--debug", "attach debugger", false),
 		option("-b", "--bench", "benchmark by running until 2 seconds has elapsed", false),
 		option("", "--benchn", "benchmark by running the given number of times", true)
@@ -306,7 +398,9 @@ void completeArg(string& arg) {
 	string list[] = {
 		"--debug", "--warnings", "--trefunge", "--befunge93", 
 		"--help", "--version", "--show-source-lines", "--include-directory", "--cell-size",
-		"--source-line", "--bench", "--benchn", "--no-concurrent", "--sandbox"
+		"--source-line", "--bench", "--benchn", "--no-concurrent", "--sandbox",
+		"--analyze", "--parallel", "--speculate", "--batch", "--checkpoint", "--checkpoint-every",
+		"--restore", "--image", "--make-image"
 	};
 
 	//Can't really declare these inside the predicate
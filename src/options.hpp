@@ -6,24 +6,31 @@
 
 namespace stinkhorn {
 	struct Options {
-		bool debug, warnings, befunge93, trefunge, shouldRun, showSourceLines, concurrent, sandbox, environmentSorted;
+		bool debug, warnings, befunge93, trefunge, shouldRun, showSourceLines, concurrent, sandbox, environmentSorted, analyze, parallel, speculate;
 		int cellSize;
 		int runCount;
 
 		std::string sourceFile;
 		std::string pathToSelf;
+		std::string batch; ///<A list of programs, or a directory of them, for --batch
+		std::string checkpointFile; ///<Where --checkpoint saves the program
+		std::string restoreFile; ///<The checkpoint --restore carries on from
+		unsigned checkpointInterval; ///<Seconds between checkpoints, or 0 to save only on SIGUSR1
+		std::string imageFile; ///<The funge-space image --image runs
+		std::string makeImage; ///<Where --make-image writes the source file's funge-space image
 		std::vector<std::string> sourceLines;
 		std::vector<std::string> include;
 
 		char** environment;
 
 		Options() {
-			debug = warnings = befunge93 = trefunge = shouldRun = showSourceLines = sandbox = false;
+			debug = warnings = befunge93 = trefunge = shouldRun = showSourceLines = sandbox = analyze = parallel = speculate = false;
 			environmentSorted = false;
 			concurrent = true;
 			environment = 0;
 			cellSize = 32;
 			runCount = 1;
+			checkpointInterval = 0;
 		}
 	};
 
@@ -0,0 +1,272 @@
+#include "speculation.hpp"
+#include "octree.hpp"
+#include "thread.hpp"
+
+#include <algorithm>
+#include <utility>
+
+using stinkhorn::Stinkhorn;
+
+namespace {
+	//Orders pairs by their first halves alone.
+	template<class PairT, class OrderT>
+	struct FirstOrder {
+		bool operator()(PairT const& lhs, PairT const& rhs) const {
+			return OrderT()(lhs.first, rhs.first);
+		}
+	};
+}
+
+template<class CellT, int Dimensions>
+Stinkhorn<CellT, Dimensions>::AccessLog::Journal::Journal(Tree& tree) :
+	m_tree(tree)
+{
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::Journal::record(Vector const& cell) {
+	boost::mutex::scoped_lock lock(m_lock);
+	if(m_original.find(cell) == m_original.end())
+		m_original.insert(std::make_pair(cell, m_tree.get(cell)));
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::Journal::restore(Vector const& cell) {
+	typename std::map<Vector, CellT, CellOrder>::const_iterator original = m_original.find(cell);
+	if(original != m_original.end())
+		m_tree.put(cell, original->second);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::Journal::restoreAll() {
+	for(typename std::map<Vector, CellT, CellOrder>::const_iterator original = m_original.begin(); original != m_original.end(); ++original)
+		m_tree.put(original->first, original->second);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::Journal::clear() {
+	m_original.clear();
+}
+
+template<class CellT, int Dimensions>
+Stinkhorn<CellT, Dimensions>::AccessLog::AccessLog() :
+	m_journal(0),
+	m_searched(false)
+{
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::start(Journal& journal) {
+	m_journal = &journal;
+	m_reads.clear();
+	m_writes.clear();
+	m_searched = false;
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::undo() {
+	for(typename std::vector<Vector>::const_iterator cell = m_writes.begin(); cell != m_writes.end(); ++cell)
+		m_journal->restore(*cell);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::AccessLog::commit(Tree& tree) const {
+	for(typename std::vector<Vector>::const_iterator cell = m_writes.begin(); cell != m_writes.end(); ++cell)
+		tree.update_minmax(*cell);
+}
+
+template<class CellT, int Dimensions>
+bool Stinkhorn<CellT, Dimensions>::AccessLog::conflicting(std::vector<AccessLog>& logs) {
+	typedef std::pair<Vector, std::size_t> Written; //A page, and the IP which wrote to it
+	std::vector<Written> written;
+
+	for(std::size_t i = 0; i < logs.size(); ++i) {
+		std::vector<Vector> pages;
+		for(typename std::vector<Vector>::const_iterator cell = logs[i].m_writes.begin(); cell != logs[i].m_writes.end(); ++cell)
+			pages.push_back(*cell >> PageT::bits);
+
+		std::sort(pages.begin(), pages.end(), CellOrder());
+		pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+		for(typename std::vector<Vector>::const_iterator page = pages.begin(); page != pages.end(); ++page)
+			written.push_back(Written(*page, i));
+	}
+
+	if(written.empty())
+		return false;
+
+	typedef FirstOrder<Written, CellOrder> ByPage;
+	std::sort(written.begin(), written.end(), ByPage());
+
+	bool several_writers = false;
+	for(std::size_t w = 1; w < written.size(); ++w) {
+		if(written[w].first == written[w - 1].first)
+			return true;
+		if(written[w].second != written[0].second)
+			several_writers = true;
+	}
+
+	for(std::size_t i = 0; i < logs.size(); ++i) {
+		AccessLog const& log = logs[i];
+
+		if(log.m_searched && (several_writers || written[0].second != i))
+			return true;
+
+		for(typename std::vector<Vector>::const_iterator page = log.m_reads.begin(); page != log.m_reads.end(); ++page) {
+			typename std::vector<Written>::const_iterator w = std::lower_bound(written.begin(), written.end(), Written(*page, 0), ByPage());
+			if(w != written.end() && w->first == *page && w->second != i)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+template<class CellT, int Dimensions>
+Stinkhorn<CellT, Dimensions>::Speculator::Speculator(Tree& tree, unsigned workers) :
+	m_tree(tree),
+	m_journal(tree),
+	m_threads(0),
+	m_ticks(0),
+	m_next(0),
+	m_running(0),
+	m_generation(0),
+	m_stopping(false)
+{
+	Worker worker = { this };
+	for(unsigned i = 0; i < workers; ++i)
+		m_workers.create_thread(worker);
+}
+
+template<class CellT, int Dimensions>
+Stinkhorn<CellT, Dimensions>::Speculator::~Speculator() {
+	{
+		boost::mutex::scoped_lock lock(m_lock);
+		m_stopping = true;
+		m_started.notify_all();
+	}
+
+	m_workers.join_all();
+}
+
+template<class CellT, int Dimensions>
+typename Stinkhorn<CellT, Dimensions>::Speculator::Result
+Stinkhorn<CellT, Dimensions>::Speculator::run(std::vector<Thread*>& threads, std::size_t ticks)
+{
+	std::size_t const count = threads.size();
+	m_threads = &threads;
+	m_logs.resize(count);
+	m_saved.resize(count);
+	m_done.assign(count, 0);
+
+	Vector min, max;
+	m_tree.get_minmax(min, max);
+
+	std::vector<std::size_t> jobs;
+	for(std::size_t i = 0; i < count; ++i) {
+		threads[i]->save(m_saved[i]);
+		m_logs[i].start(m_journal);
+		jobs.push_back(i);
+	}
+
+	dispatch(jobs, ticks);
+
+	Result result;
+	result.ticks = *std::min_element(m_done.begin(), m_done.end());
+	result.rolled_back = AccessLog::conflicting(m_logs);
+
+	if(result.rolled_back) {
+		m_journal.restoreAll();
+		m_tree.set_minmax(min, max);
+		for(std::size_t i = 0; i < count; ++i)
+			threads[i]->restore(m_saved[i]);
+
+		m_journal.clear();
+		m_saved.clear();
+		result.ticks = 0;
+		return result;
+	}
+
+	//Nothing any IP read was written by another, so each IP's writes can be
+	//undone on their own.
+	jobs.clear();
+	for(std::size_t i = 0; i < count; ++i) {
+		if(m_done[i] > result.ticks) {
+			m_logs[i].undo();
+			threads[i]->restore(m_saved[i]);
+			m_logs[i].start(m_journal);
+			jobs.push_back(i);
+		}
+	}
+
+	if(!jobs.empty() && result.ticks)
+		dispatch(jobs, result.ticks);
+
+	m_tree.set_minmax(min, max);
+	for(std::size_t i = 0; i < count; ++i)
+		m_logs[i].commit(m_tree);
+
+	m_journal.clear();
+	m_saved.clear(); //Otherwise the IPs' stacks stay shared with the snapshots.
+	return result;
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Speculator::dispatch(std::vector<std::size_t> const& jobs, std::size_t ticks) {
+	{
+		boost::mutex::scoped_lock lock(m_lock);
+		m_jobs = jobs;
+		m_ticks = ticks;
+		m_next = 0;
+		m_running = jobs.size();
+		++m_generation;
+		m_started.notify_all();
+	}
+
+	runJobs();
+
+	boost::mutex::scoped_lock lock(m_lock);
+	while(m_running)
+		m_finished.wait(lock);
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Speculator::runJobs() {
+	for(;;) {
+		std::size_t i, ticks;
+		{
+			boost::mutex::scoped_lock lock(m_lock);
+			if(m_next == m_jobs.size())
+				return;
+			i = m_jobs[m_next++];
+			ticks = m_ticks;
+		}
+
+		m_done[i] = (*m_threads)[i]->speculate(ticks, m_logs[i]);
+
+		boost::mutex::scoped_lock lock(m_lock);
+		if(!--m_running)
+			m_finished.notify_all();
+	}
+}
+
+template<class CellT, int Dimensions>
+void Stinkhorn<CellT, Dimensions>::Speculator::work() {
+	unsigned seen = 0;
+
+	for(;;) {
+		{
+			boost::mutex::scoped_lock lock(m_lock);
+			while(m_generation == seen && !m_stopping)
+				m_started.wait(lock);
+
+			if(m_stopping)
+				return;
+			seen = m_generation;
+		}
+
+		runJobs();
+	}
+}
+
+INSTANTIATE(class, AccessLog);
+INSTANTIATE(class, Speculator);
@@ -0,0 +1,157 @@
+#ifndef B98_SPECULATION_HPP_INCLUDED
+#define B98_SPECULATION_HPP_INCLUDED
+
+#include "stinkhorn.hpp"
+#include "vector.hpp"
+
+#include <map>
+#include <vector>
+
+#include "boost/noncopyable.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/condition_variable.hpp"
+
+namespace stinkhorn {
+	/**
+	 * What one IP did to funge-space during a speculative window (see
+	 * Speculator): the pages it read, the cells it wrote, and whether it
+	 * searched along a line through funge-space, which could have crossed any
+	 * page. The IP's cursor fills it in.
+	 **/
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::AccessLog {
+		typedef TreePage PageT;
+
+		struct CellOrder {
+			bool operator()(Vector const& lhs, Vector const& rhs) const {
+				if(getZ(lhs) != getZ(rhs))
+					return getZ(lhs) < getZ(rhs);
+				if(lhs.y != rhs.y)
+					return lhs.y < rhs.y;
+				return lhs.x < rhs.x;
+			}
+		};
+
+	public:
+		//What each cell written during a window held before it, shared by every
+		//IP's log. Whichever IP writes to a cell first records it, under the lock,
+		//before writing.
+		class Journal : boost::noncopyable {
+		public:
+			Journal(Tree& tree);
+
+			void record(Vector const& cell);
+			void restore(Vector const& cell);
+			void restoreAll();
+			void clear();
+
+		private:
+			Tree& m_tree;
+			boost::mutex m_lock;
+			std::map<Vector, CellT, CellOrder> m_original;
+		};
+
+		AccessLog();
+
+		//Empties the log for a new window.
+		void start(Journal& journal);
+
+		void read(Vector const& page_address) {
+			if(m_reads.empty() || m_reads.back() != page_address)
+				m_reads.push_back(page_address);
+		}
+
+		void write(Vector const& cell) {
+			m_journal->record(cell);
+			m_writes.push_back(cell);
+		}
+
+		void search() {
+			m_searched = true;
+		}
+
+		//Puts back the cells this IP wrote. Only right when no other IP wrote them.
+		void undo();
+
+		//Grows funge-space's bounds over the cells this IP wrote, as the writes
+		//would have done had they not been made speculatively.
+		void commit(Tree& tree) const;
+
+		//True if any IP wrote to a page that another IP read or wrote, or wrote
+		//anything at all while another searched funge-space.
+		static bool conflicting(std::vector<AccessLog>& logs);
+
+	private:
+		Journal* m_journal;
+		std::vector<Vector> m_reads, m_writes;
+		bool m_searched;
+	};
+
+	/**
+	 * Runs IPs for a window of ticks on a pool of worker threads, then checks
+	 * that the result is what taking turns would have given.
+	 *
+	 * Each IP runs on its own until the window ends or it reaches an instruction
+	 * that isn't just the IP working on itself and funge-space (output, input,
+	 * spawning, fingerprints, ? and so on), and logs what it touched. If no IP
+	 * touched a page another wrote to, no IP could have seen another's writes,
+	 * so the order of their ticks made no difference. Otherwise, everything is
+	 * put back as it was at the start of the window.
+	 *
+	 * When an IP stopped early, the IPs all have to end up the same number of
+	 * ticks in. The ones that went further are put back and run again for
+	 * exactly that many, which does the same as before, since nothing they read
+	 * has changed.
+	 **/
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::Speculator
+		: boost::noncopyable
+	{
+	public:
+		struct Result {
+			std::size_t ticks;  ///<how many ticks every IP is now further on
+			bool rolled_back;   ///<IPs interfered, and nothing has changed
+		};
+
+		//Starts that many worker threads, which help the thread calling run.
+		Speculator(Tree& tree, unsigned workers);
+		~Speculator();
+
+		Result run(std::vector<Thread*>& threads, std::size_t ticks);
+
+	private:
+		struct Worker {
+			Speculator* speculator;
+
+			void operator()() {
+				speculator->work();
+			}
+		};
+
+		//Runs m_threads[i] for ticks for each i in jobs, across the workers.
+		void dispatch(std::vector<std::size_t> const& jobs, std::size_t ticks);
+		void runJobs();
+		void work();
+
+		Tree& m_tree;
+		typename AccessLog::Journal m_journal;
+
+		std::vector<Thread*>* m_threads;
+		std::vector<AccessLog> m_logs;
+		std::vector<typename Thread::Snapshot> m_saved;
+		std::vector<std::size_t> m_done;
+
+		//The current batch of jobs. m_lock guards these and m_stopping.
+		boost::mutex m_lock;
+		boost::condition_variable m_started, m_finished;
+		std::vector<std::size_t> m_jobs;
+		std::size_t m_ticks, m_next, m_running;
+		unsigned m_generation;
+		bool m_stopping;
+
+		boost::thread_group m_workers;
+	};
+}
+
+#endif
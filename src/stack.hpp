@@ -17,7 +17,7 @@ http://catseye.mine.nu:8080/projects/funge98/doc/funge98.html
 #include "vector.hpp"
 #include "config.hpp"
 
-#include <stack>
+#include <deque>
 #include <string>
 #include <vector>
 #include <iterator>
@@ -26,488 +26,152 @@ http://catseye.mine.nu:8080/projects/funge98/doc/funge98.html
 #include <cassert>
 #include <stdexcept>
 
+#include "boost/shared_ptr.hpp"
+
 namespace stinkhorn {
 	namespace detail {
-		template <typename T>
-		class Deque {
-			static const int ChunkSizeElems = 4096 / sizeof(T);
+		/**
+		 * Contiguous storage for the stack stack. Small stacks live in an inline
+		 * buffer; larger ones move to the heap and grow by doubling. Memory is
+		 * only given back once the contents drop below a quarter of the capacity,
+		 * so a program hovering around a boundary doesn't keep reallocating.
+		 *
+		 * Cells can also be added and removed at the front in amortised constant
+		 * time, by leaving slack before the first cell. Only queue and invert mode
+		 * do that - otherwise first_ stays at the start of the storage, and
+		 * push_back and pop_back are just a pointer bump.
+		 **/
+		template<class T>
+		class StackBuffer {
+			static const std::size_t InlineSize = 32;
 
 		public:
 			typedef T value_type;
 			typedef T& reference;
-			typedef T* pointer;
 			typedef T const& const_reference;
+			typedef T* pointer;
 			typedef T const* const_pointer;
+			typedef T* iterator;
+			typedef T const* const_iterator;
+			typedef std::reverse_iterator<iterator> reverse_iterator;
+			typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
 			typedef std::size_t size_type;
 			typedef std::ptrdiff_t difference_type;
 
-		private:
-			typedef std::deque<pointer> ChunkList;
-			ChunkList chunks;
-
-			size_type 
-				begin_, // Index into the first chunk of the first element. 
-				end_,   // Index into the last chunk of the last element, plus one.
-				        // As far as I understand it, if end_ == 0, it points into an
-						// as-yet unallocated chunk. Maybe. Fuck knows.
-				size_; // Amount of elements in the Deque.
-			
-		protected:
-			pointer get_chunk() { return new value_type[ChunkSizeElems]; }
-			void destroy_chunk(pointer chunk) { 
-				delete[] chunk; 
-			}
-
-			struct DequeIteratorBase 
-			{
-				friend class Deque<T>;
-
-				DequeIteratorBase(const DequeIteratorBase& other) 
-					: deque(other.deque), offset(other.offset), chunk(other.chunk), chunkIndex(other.chunkIndex)
-				{ }
-
-				void updateChunk() {
-					chunkIndex = offset / ChunkSizeElems;
-					chunk = deque.chunks.begin() + chunkIndex;
-					check_valid();
-				}
-
-				bool operator==(const DequeIteratorBase& other) const {
-					return offset == other.offset;
-				}
-
-				bool operator!=(const DequeIteratorBase& other) const {
-					return offset != other.offset;
-				}
-
-				bool operator>(const DequeIteratorBase& other) const {
-					return offset > other.offset;
-				}
-
-				bool operator<(const DequeIteratorBase& other) const {
-					return offset < other.offset;
-				}
-				
-				bool operator>=(const DequeIteratorBase& other) const {
-					return offset >= other.offset;
-				}
-
-				bool operator<=(const DequeIteratorBase& other) const {
-					return offset <= other.offset;
-				}
-
-				friend difference_type operator -(const DequeIteratorBase& x, const DequeIteratorBase& y) {
-					assert(&x.deque == &y.deque);
-					return x.offset - y.offset;
-				}
-
-			protected:
-				DequeIteratorBase(const Deque<T>& deque, size_type offset) 
-					: deque(deque), offset(offset)
-				{
-					updateChunk();
-				}
-
-				DequeIteratorBase(const Deque<T>& deque, size_type offset, typename ChunkList::const_iterator chunk, size_type chunkIndex) 
-					: deque(deque), offset(offset), chunk(chunk), chunkIndex(chunkIndex)
-				{
-					check_valid();
-				}
-
-				void advance(difference_type diff) {
-					size_type 
-						chunk0 = chunkIndex,
-						chunk1 = (offset + diff) / ChunkSizeElems;
+			StackBuffer()
+				: storage_(inline_), first_(inline_), last_(inline_), end_(inline_ + InlineSize), shrink_(inline_)
+			{}
 
-					chunk += chunk1 - chunk0;
-					chunkIndex += chunk1 - chunk0;
-					offset += diff;
-
-					check_valid();
-				}
-
-				// TODO: Does not validate that the cached chunk is actually part of the 
-				// Deque - removing and adding a chunk would cause an iterator to become invalid.
-				// (But this should be the case anyway.)
-				void check_valid() const {
-					assert(offset <= deque.size());
-
-					// Only non end() iterators need a valid chunk.
-					if(offset < deque.size()) {
-						assert(chunkIndex < deque.chunks.size());
-
-						// This is expensive!
-						assert(std::count(deque.chunks.begin(), deque.chunks.end(), *chunk) == 1);
-					}
-				}
-
-			protected:
-				const Deque<T>& deque;
-				typename ChunkList::const_iterator chunk;
-				size_type chunkIndex;
-				size_type offset;
-			};
-
-			struct DequeIterator 
-				: DequeIteratorBase
-				, std::iterator<std::random_access_iterator_tag, T, difference_type, pointer, reference>
+			StackBuffer(StackBuffer const& other)
+				: storage_(inline_), first_(inline_), last_(inline_), end_(inline_ + InlineSize), shrink_(inline_)
 			{
-				friend class Deque<T>;
-
-				reference operator*() const {
-					check_valid();
-
-					return (*this->chunk)[this->offset % ChunkSizeElems];
-				}
-
-				DequeIterator& operator+=(difference_type diff) {
-					this->advance(diff);
-					return *this;
-				}
-
-				DequeIterator& operator-=(difference_type diff) {
-					return *this += -diff;
-				}
-
-				DequeIterator operator+(difference_type diff) const {
-					DequeIterator itr(*this);
-					return itr += diff;
-				}
-
-				DequeIterator operator+(size_type diff) const {
-					DequeIterator itr(*this);
-					return itr += diff;
-				}
-
-				DequeIterator operator-(difference_type diff) const {
-					DequeIterator itr(*this);
-					return itr += -diff;
-				}
-
-				DequeIterator& operator++() {
-					return *this += difference_type(1);
-				}
-
-				DequeIterator operator++(int) {
-					DequeIterator i(*this);
-					operator++();
-					return i;
-				}
-
-				DequeIterator& operator--() {
-					return *this -= difference_type(1);
-				}
-
-				DequeIterator operator--(int) {
-					DequeIterator i(*this);
-					operator--();
-					return i;
-				}
-
-			protected:
-				DequeIterator(Deque<T>& deque, size_type offset, typename ChunkList::const_iterator chunk, size_type chunkIndex) 
-					: DequeIteratorBase(deque, offset, chunk, chunkIndex)
-				{ }
-
-				DequeIterator(Deque<T>& deque, size_type offset)
-					: DequeIteratorBase(deque, offset)
-				{ }
-			};
-
-			struct ConstDequeIterator 
-				: DequeIteratorBase
-				, std::iterator<std::random_access_iterator_tag, T const, difference_type, const_pointer, const_reference>
-			{
-				friend class Deque<T>;
-
-				const_reference operator*() const {
-					return (*this->chunk)[this->offset % ChunkSizeElems];
-				}
-
-				ConstDequeIterator(const DequeIterator& itr)
-					: DequeIteratorBase(itr)
-				{ }
-
-				ConstDequeIterator& operator+=(difference_type diff) {
-					this->advance(diff);
-					return *this;
-				}
-
-				ConstDequeIterator& operator-=(difference_type diff) {
-					return *this += -diff;
-				}
-
-				ConstDequeIterator operator+(difference_type diff) const {
-					ConstDequeIterator itr(*this);
-					return itr += diff;
-				}
-
-				ConstDequeIterator operator+(size_type diff) const {
-					DequeIteratorBase itr(*this);
-					return itr += diff;
-				}
-
-				ConstDequeIterator operator-(difference_type diff) const {
-					ConstDequeIterator itr(*this);
-					return itr += -diff;
-				}
-
-				/*difference_type operator-(const ConstDequeIterator& other) const {
-					return difference_type(offset) - difference_type(other.offset);
-				}*/
-
-				ConstDequeIterator& operator++() {
-					return *this += difference_type(1);
-				}
-
-				ConstDequeIterator operator++(int) {
-					ConstDequeIterator i(*this);
-					operator++();
-					return i;
-				}
-
-				ConstDequeIterator& operator--() {
-					return *this -= difference_type(1);
-				}
-
-				ConstDequeIterator operator--(int) {
-					ConstDequeIterator i(*this);
-					operator--();
-					return i;
-				}
-
-			protected:
-				ConstDequeIterator(const Deque<T>& deque, size_type offset, typename ChunkList::const_iterator chunk, size_type chunkIndex) 
-					: DequeIteratorBase(deque, offset, chunk, chunkIndex)
-				{ }
-
-				ConstDequeIterator(const Deque<T>& deque, size_type offset)
-					: DequeIteratorBase(deque, offset)
-				{ }
-			};
-
-		public:
-			typedef DequeIterator iterator;
-			typedef ConstDequeIterator const_iterator;
-			typedef std::reverse_iterator<iterator> reverse_iterator;
-			typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
-
-		public:
-			Deque() {
-				begin_ = 0;
-				end_ = 0;
-				size_ = 0;
+				insert(end(), other.begin(), other.end());
 			}
 
-			Deque(const Deque& other) {
-				/*typename ChunkList::const_iterator
-					i = other.chunks.begin(),
-					e = other.chunks.end();
-
-				for (; i != e; ++i) {
-					pointer chunk = get_chunk();
-					std::copy(*i, *i + ChunkSizeElems, chunk);
-					chunks.push_back(chunk);
-				}
-
-				begin_ = other.begin_;
-				end_ = other.end_;
-				size_ = other.size_;
-
-				check_valid();*/
-
-				begin_ = end_ = size_ = 0;
-				std::copy(other.begin(), other.end(), std::back_inserter(*this));
+			~StackBuffer() {
+				if(storage_ != inline_)
+					delete[] storage_;
 			}
 
-			Deque<T>& operator=(const Deque<T>& other) {
-				resize(other.size());
-				std::copy(other.begin(), other.end(), begin());
-				return *this;
-			}
-
-			~Deque() {
-				check_valid();
-
-				while (!chunks.empty()) {
-					destroy_chunk(chunks.back());
-					chunks.pop_back();
+			StackBuffer& operator=(StackBuffer const& other) {
+				if(this != &other) {
+					last_ = first_;
+					insert(end(), other.begin(), other.end());
 				}
+				return *this;
 			}
 
-			void push_front(T elem) {
-				check_valid();
-
-				if (begin_ == 0) {
-					chunks.push_front(get_chunk());
-					begin_ = ChunkSizeElems;
-				}
-
-				chunks.front()[begin_--] = elem;
-				size_++;
-
-				check_valid();
+			void push_back(const_reference x) {
+				if(last_ == end_)
+					grow_back(1);
+				*last_++ = x;
 			}
 
-			reference front() {
-				if (empty())
-					throw std::runtime_error("front() called on an empty Deque");
-
-				return chunks.front()[begin_];
+			void pop_back() {
+				assert(!empty());
+				if(--last_ < shrink_)
+					shrink();
 			}
 
-			const_reference front() const {
-				if (empty())
-					throw std::runtime_error("front() called on an empty Deque");
-
-				return chunks.front()[begin_];
+			void push_front(const_reference x) {
+				if(first_ == storage_)
+					grow_front();
+				*--first_ = x;
 			}
 
 			void pop_front() {
-				check_valid();
-
-				if (empty())
-					throw std::runtime_error("pop_front() called on an empty Deque");
-
-				if(++begin_ == ChunkSizeElems) {
-					begin_ = 0;
-					end_ -= ChunkSizeElems;
-
-					destroy_chunk(chunks.front());
-					chunks.pop_front();
-				}
-
-				size_--;
-				check_valid();
+				assert(!empty());
+				++first_;
 			}
 
-			void push_back(T elem) {
-				check_valid();
-
-				if (end_ >= ChunkSizeElems) {
-					chunks.push_back(get_chunk());
-					chunks.back()[0] = elem;
-					end_ = 1;
-				} else if (chunks.empty()) {
-					chunks.push_back(get_chunk());
-					end_ = 1;
-					chunks.back()[0] = elem;
-				} else {
-					chunks.back()[end_++] = elem;
-				}
+			reference front() { return *first_; }
+			const_reference front() const { return *first_; }
+			reference back() { return last_[-1]; }
+			const_reference back() const { return last_[-1]; }
 
-				size_++;
-				check_valid();
-			}
+			reference operator[](size_type index) { return first_[index]; }
+			const_reference operator[](size_type index) const { return first_[index]; }
 
-			reference back() {
-				if (empty())
-					throw std::runtime_error("back() called on an empty Deque");
+			size_type size() const { return last_ - first_; }
+			bool empty() const { return last_ == first_; }
 
-				return chunks.back()[end_ - 1];
-			}
+			iterator begin() { return first_; }
+			iterator end() { return last_; }
+			const_iterator begin() const { return first_; }
+			const_iterator end() const { return last_; }
 
-			const_reference back() const { 
-				if (empty())
-					throw std::runtime_error("back() called on an empty Deque");
+			reverse_iterator rbegin() { return reverse_iterator(end()); }
+			reverse_iterator rend() { return reverse_iterator(begin()); }
+			const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+			const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
 
-				return chunks.back()[end_ - 1];
+			void clear() {
+				resize(0);
 			}
 
-			void pop_back() {
-				check_valid();
-
-				if (end_ == 0) {
-					end_ = ChunkSizeElems - 1;
-					if (chunks.empty())
-						throw std::runtime_error("pop_back() called on an empty Deque");
-					else {
-						destroy_chunk(chunks.back());
-						chunks.pop_back();
-					}
+			void resize(size_type size) {
+				size_type old_size = this->size();
+				if(size > old_size) {
+					if(size_type(end_ - last_) < size - old_size)
+						grow_back(size - old_size);
+					std::fill(last_, first_ + size, value_type());
+					last_ = first_ + size;
 				} else {
-					end_--;
+					last_ = first_ + size;
+					if(last_ < shrink_)
+						shrink();
 				}
-
-				size_--;
-				check_valid();
-			}
-
-			void swap(Deque<T>& other) {
-				std::swap(begin_, other.begin_);
-				std::swap(end_, other.end_);
-				std::swap(size_, other.size_);
-				chunks.swap(other.chunks);
-				
-				check_valid();
 			}
 
-			void clear() {
-				Deque().swap(*this);
-				check_valid();
-			}
-
-			void resize(size_type new_size) {
-				if (new_size == size_)
-					return;
-
-				if (new_size < size_) {
-					size_type chunksToRemove = (size_ - new_size) / ChunkSizeElems;
-					size_type elemsToRemove = (size_ - new_size) % ChunkSizeElems;
+			void insert(iterator pos, size_type count, const_reference x) {
+				size_type offset = pos - first_;
+				value_type copy = x; //x could be in the buffer
+				if(size_type(end_ - last_) < count)
+					grow_back(count);
 
-					if (elemsToRemove > end_) {
-						chunksToRemove++;
-						end_ = end_ + ChunkSizeElems - elemsToRemove;
-					} else {
-						end_ -= elemsToRemove;
-					}
-
-					while(chunksToRemove --> 0) {
-						destroy_chunk(chunks.back());
-						chunks.pop_back();
-					}
-
-					size_ = new_size;
-				} else {
-					size_type old_size = size_;
-					size_type chunksToAdd = (new_size - size_) / ChunkSizeElems;
-					size_type elemsToAdd = (new_size - size_) % ChunkSizeElems;
-
-					end_ += elemsToAdd;
-					size_ = new_size;
-
-					size_type newChunkCount = (begin_ + size_ + ChunkSizeElems - 1) / ChunkSizeElems;
-					while(newChunkCount > chunks.size())
-						chunks.push_back(get_chunk());
-
-					check_valid();
-					std::fill(begin() + old_size, end(), value_type());
-				}
-
-				check_valid();		
+				pos = first_ + offset;
+				std::copy_backward(pos, last_, last_ + count);
+				std::fill(pos, pos + count, copy);
+				last_ += count;
 			}
 
-			void insert(const DequeIterator& itr, const_reference x) {
-				insert(itr, &x, &x + 1);
+			void insert(iterator pos, const_reference x) {
+				value_type copy = x; //x could be in the buffer
+				insert(pos, &copy, &copy + 1);
 			}
 
-			template<class InputIterator>
-			void insert(const DequeIterator& itr, InputIterator first, InputIterator last) {
-				check_valid();
-
-				size_type insertionCount = last - first;
-				size_type moveCount = end() - itr;
-
-				// Make room for the new elements.
-				resize(size_ + insertionCount);
+			///[first, last) must not point into this buffer.
+			template<class InputIter>
+			void insert(iterator pos, InputIter first, InputIter last) {
+				size_type offset = pos - first_;
+				size_type count = static_cast<size_type>(std::distance(first, last));
+				if(size_type(end_ - last_) < count)
+					grow_back(count);
 
-				// Move the elements after the insertion point.
-				std::copy_backward(itr, itr + moveCount, itr + insertionCount + moveCount);
-
-				// Insert the elements.
-				std::copy(first, last, itr);
-
-				check_valid();
+				pos = first_ + offset;
+				std::copy_backward(pos, last_, last_ + count);
+				std::copy(first, last, pos);
+				last_ += count;
 			}
 
 			iterator erase(iterator pos) {
@@ -515,98 +179,67 @@ namespace stinkhorn {
 			}
 
 			iterator erase(iterator first, iterator last) {
-				check_valid();
-
-				size_type eraseCount = last - first;
-				size_type moveCount = end() - last;
-
-				// Move the elements after the erase point into the space where the erased elements are.
-				std::copy(last, last + moveCount, first);
-
-				// Remove the now-unused storage.
-				resize(size_ - eraseCount);
-
-				check_valid();
-				return first; // TODO: This should work...
-			}
-
-			reference operator[](size_type index) {
-				check_valid();
-
-				if(index > size_)
-					throw new std::runtime_error("Index out of range in Deque::operator[]");
-
-				index += begin_;
-				pointer chunk = chunks[index / ChunkSizeElems];
-				return chunk[index % ChunkSizeElems];
-			}
-
-			const_reference operator[](size_type index) const {
-				check_valid();
-
-				if(index > size_)
-					throw new std::runtime_error("Index out of range in Deque::operator[]");
-
-				index += begin_;
-				pointer chunk = chunks[index / ChunkSizeElems];
-				return chunk[index % ChunkSizeElems];
-			}
-
-			size_type size() const { return size_; }
-			bool empty() const { return size_ == 0; }
-
-			iterator begin() {
-				return iterator(*this, 0, chunks.begin(), 0);
-			}
-
-			iterator end() {
-				return iterator(*this, size_);
-			}
-
-			const_iterator begin() const {
-				return cbegin();
-			}
+				//Erasing from the front just leaves more slack there.
+				if(first == first_) {
+					first_ = last;
+					return first_;
+				}
 
-			const_iterator end() const {
-				return cend();
+				size_type offset = first - first_;
+				last_ = std::copy(last, last_, first);
+				if(last_ < shrink_)
+					shrink();
+				return first_ + offset;
 			}
 
-			reverse_iterator rbegin() {
-				return reverse_iterator(end());
+		private:
+			//Makes room for count more cells at the back, by sliding the contents down
+			//over the slack at the front if there is plenty of it, or by reallocating.
+			void grow_back(size_type count) {
+				size_type size = this->size(), slack = first_ - storage_;
+				if(slack >= size && size_type(end_ - last_) + slack >= count) {
+					last_ = std::copy(first_, last_, storage_);
+					first_ = storage_;
+				} else {
+					relocate(std::max(capacity() * 2, size + count), 0);
+				}
 			}
 
-			reverse_iterator rend() {
-				return reverse_iterator(begin());
+			//Makes room in front of the first cell, leaving as much slack at the front
+			//as there is at the back.
+			void grow_front() {
+				size_type capacity = std::max(this->capacity() * 2, size() * 2 + 2);
+				relocate(capacity, (capacity - size()) / 2);
 			}
 
-			const_reverse_iterator rbegin() const {
-				return crbegin();
+			void shrink() {
+				relocate(std::max(capacity() / 2, size_type(InlineSize)), 0);
 			}
 
-			const_reverse_iterator rend() const {
-				return crend();
-			}
+			size_type capacity() const { return end_ - storage_; }
 
-		protected:
-			const_iterator cbegin() const {
-				return const_iterator(*this, 0, chunks.begin(), 0);
-			}
+			//Moves the contents into new storage of the given capacity, front cells from
+			//its start. Going back to the inline buffer only ever happens from the heap.
+			void relocate(size_type capacity, size_type front) {
+				pointer storage = capacity > InlineSize ? new value_type[capacity] : inline_;
+				if(storage == inline_)
+					capacity = InlineSize;
 
-			const_iterator cend() const {
-				return const_iterator(*this, size_);
-			}
+				pointer first = storage + front;
+				pointer last = std::copy(first_, last_, first);
 
-			const_reverse_iterator crbegin() const {
-				return const_reverse_iterator(cend());
-			}
+				if(storage_ != inline_)
+					delete[] storage_;
 
-			const_reverse_iterator crend() const {
-				return const_reverse_iterator(cbegin());
+				storage_ = storage;
+				first_ = first;
+				last_ = last;
+				end_ = storage + capacity;
+				shrink_ = storage == inline_ ? storage : storage + capacity / 4;
 			}
 
-			void check_valid() const {
-				assert((end_ + ChunkSizeElems - begin_) % ChunkSizeElems == size_ % ChunkSizeElems);
-			}
+			pointer storage_, first_, last_, end_, shrink_;
+			value_type inline_[InlineSize];
 		};
 	}
 
@@ -622,24 +255,42 @@ namespace stinkhorn {
 	of Befunge-93; and the second on stack stack or SOSS, which is the stack
 	directly under the TOSS.
 
-	TODO:
-	- Support reverse mode and clear mode for the MODE fingerprint.
+	Each stack has its own buffer, so both ends of the TOSS can be pushed to and
+	popped from in constant time however deep the stack stack is. That's what
+	the invert and queue modes of the MODE fingerprint need.
+
+	Copying a stack stack (as t does for the new IP) only copies the pointers to
+	the buffers, which are then shared by both copies until one of them writes
+	to a stack, at which point it takes a copy of that stack alone.
 	**/
-	template<class T>
+	template<class T, int Dimensions>
 	class StackStack {
 	public:
 		typedef T CellT;
-		typedef vector3<T> VectorT;
+		typedef vectorN<T, Dimensions> VectorT;
 		typedef std::basic_string<CellT> String;
-		typedef detail::Deque<T> StorageT;
+		typedef detail::StackBuffer<T> StorageT;
+		typedef boost::shared_ptr<StorageT> StoragePtr;
 
 		StackStack();
-		StackStack(StackStack<T> const& other);
+		StackStack(StackStack<T, Dimensions> const& other);
+
+		StackStack<T, Dimensions>& operator=(const StackStack<T, Dimensions>& other);
+
+		//The common case (neither invert nor queue mode) is kept small enough to inline.
+		void push(T value) {
+			if(!m_invert_mode)
+				own()->push_back(value);
+			else
+				own()->push_front(value);
+		}
 
-		StackStack<T>& operator=(const StackStack<T>& other);
+		T pop() {
+			if(!m_queue_mode)
+				return popBack();
+			return popFront();
+		}
 
-		void push(T value);
-		T pop();
 		VectorT popVector(int dimensions);
 		VectorT pushVector(VectorT const& v, int dimensions);
 
@@ -654,11 +305,37 @@ namespace stinkhorn {
 
 		void clearTopStack();
 
-		void pushBack(T value);
-		CellT popBack();
+		//Bulk forms of pop() and push(), for k.
+		void discard(std::size_t count);
+		void pushRepeated(T value, std::size_t count);
+
+		void pushBack(T value) {
+			own()->push_back(value);
+		}
 
-		void pushFront(CellT value);
-		CellT popFront();
+		CellT popBack() {
+			if(top().empty())
+				return 0;
+
+			StorageT* stack = own();
+			T x = stack->back();
+			stack->pop_back();
+			return x;
+		}
+
+		void pushFront(CellT value) {
+			own()->push_front(value);
+		}
+
+		CellT popFront() {
+			if(top().empty())
+				return 0;
+
+			StorageT* stack = own();
+			T x = stack->front();
+			stack->pop_front();
+			return x;
+		}
 
 		T nth(std::size_t index);
 		std::size_t stackCount();
@@ -668,12 +345,24 @@ namespace stinkhorn {
 		template<class OutIter>
 		void getStackSizes(OutIter);
 
+		template<class InputIter>
+		void pushRange(InputIter first, InputIter last);
+
 		template<class U> //U is some sort of string (could be char, could be T)
 		void readString(U& out);
 		void pushString(String const& str);
 
-		//STRN operations (put here because it's easier and faster)
+		//STRN operations (put here because it's easier and faster). These work on the
+		//cells of the TOSS where they lie, rather than going through readString and
+		//pushString. The ones returning bool return false if the IP should reflect
+		//(or, for strnFind, if nothing was found).
 		CellT strnGetLength();
+		void strnAppend();
+		CellT strnCompare();
+		bool strnFind();
+		bool strnLeft(CellT n);
+		bool strnMid(CellT start, CellT n);
+		bool strnRight(CellT n);
 
 		//These two modes correspond to the I and Q instructions of the MODE fingerprint
 		bool invertMode() const { return m_invert_mode; }
@@ -682,112 +371,125 @@ namespace stinkhorn {
 		bool queueMode() const { return m_queue_mode; }
 		void queueMode(bool value) { m_queue_mode = value; }
 
+		//For checkpoints (see checkpoint.hpp): the modes, then every stack, bottom
+		//first, each bottom cell first.
+		template<class WriterT>
+		void save(WriterT& out) const;
+		template<class ReaderT>
+		void restore(ReaderT& in);
+
 	private:
 		bool m_invert_mode;
 		bool m_queue_mode;
 
-		StorageT values;
-		std::stack<std::size_t> indices;
+		//Bottom stack first. Each may be shared with copies of this stack stack.
+		std::deque<StoragePtr> stacks;
+
+		//stacks.back() once this stack stack is its only owner, or 0 while it may
+		//still be shared. Copying clears it on both sides, hence mutable.
+		mutable StorageT* toss;
+
+		//The TOSS, for reading.
+		StorageT const& top() const {
+			return toss ? *toss : *stacks.back();
+		}
+
+		//The TOSS, for writing: it's copied first if it's shared.
+		StorageT* own() {
+			if(!toss)
+				toss = unshare(stacks.back());
+			return toss;
+		}
+
+		StorageT& soss() { return *unshare(stacks[stacks.size() - 2]); }
+
+		static StorageT* unshare(StoragePtr& stack);
+
+		std::size_t strnBegin(std::size_t end);
+		void strnReplace(std::size_t keep, std::size_t first, std::size_t last);
 	};
 
-	template<class T>
-	StackStack<T>::StackStack() {
+	template<class T, int Dimensions>
+	StackStack<T, Dimensions>::StackStack() 
+		: stacks(1, StoragePtr(new StorageT))
+	{
 		m_invert_mode = m_queue_mode = false;
+		toss = stacks.back().get();
 	}
 
-	template<class T>
-	StackStack<T>::StackStack(StackStack<T> const& other) 
+	template<class T, int Dimensions>
+	StackStack<T, Dimensions>::StackStack(StackStack<T, Dimensions> const& other) 
 		: m_invert_mode(other.m_invert_mode),
 		m_queue_mode(other.m_queue_mode),
-		values(other.values),
-		indices(other.indices)
+		stacks(other.stacks)
 	{
+		toss = other.toss = 0;
 	}
 
-	template<class T>
-	StackStack<T>& StackStack<T>::operator=(const StackStack<T>& other) {
-		m_invert_mode = other.m_invert_mode;
-		m_queue_mode = other.m_queue_mode;
-		values = other.values;
-		indices = other.indices;
+	template<class T, int Dimensions>
+	StackStack<T, Dimensions>& StackStack<T, Dimensions>::operator=(const StackStack<T, Dimensions>& other) {
+		if(this != &other) {
+			m_invert_mode = other.m_invert_mode;
+			m_queue_mode = other.m_queue_mode;
+			stacks = other.stacks;
+			toss = other.toss = 0;
+		}
 		return *this;
 	}
 
-	template<class T>
-	void StackStack<T>::push(CellT value) {
-		if(m_invert_mode)
-			pushFront(value);
-		else
-			pushBack(value);
-	}
-
-	template<class T>
-	typename StackStack<T>::CellT StackStack<T>::pop() {
-		if(m_queue_mode)
-			return popFront();
-		else
-			return popBack();
-	}
-
-	template<class T>
-	void StackStack<T>::pushBack(T value) {
-		values.push_back(value);
-	}
-
-	template<class T>
-	T StackStack<T>::popBack() {
-		if(indices.size() && indices.top() == values.size()) {
-			return 0;
-		}
-
-		if(values.size()) {
-			T x = values.back();
-			values.pop_back();
-			return x;
-		}
-
-		return 0;
+	template<class T, int Dimensions>
+	typename StackStack<T, Dimensions>::StorageT* StackStack<T, Dimensions>::unshare(StoragePtr& stack) {
+		if(!stack.unique())
+			stack.reset(new StorageT(*stack));
+		return stack.get();
 	}
 
 	//I *assume* this is how it should work in Queue Mode.
-	template<class T>
-	T StackStack<T>::nth(std::size_t index) {
-		if(index >= topStackSize())
+	template<class T, int Dimensions>
+	T StackStack<T, Dimensions>::nth(std::size_t index) {
+		StorageT const& stack = top();
+		if(index >= stack.size())
 			return CellT();
 
 		if(m_queue_mode) {
-			std::size_t toss_begin = indices.size() ? indices.top() : 0;
-			return values[toss_begin + index];
+			return stack[index];
 		} else {
-			return values.rbegin()[index];
+			return stack.rbegin()[index];
 		}
 	}
 
-	template<class T>
-	std::size_t StackStack<T>::stackCount() {
-		return indices.size() + 1;
+	template<class T, int Dimensions>
+	std::size_t StackStack<T, Dimensions>::stackCount() {
+		return stacks.size();
 	}
 
-	template<class T>
-	std::size_t StackStack<T>::topStackSize() {
-		return values.size() - (indices.size() ? indices.top() : 0);
+	template<class T, int Dimensions>
+	std::size_t StackStack<T, Dimensions>::topStackSize() {
+		return top().size();
 	}
 
-	template<class T>
-	void StackStack<T>::resizeTopStack(std::size_t size) {
-		std::size_t toss_begin = indices.size() ? indices.top() : 0;
-		values.resize(toss_begin + size);
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::resizeTopStack(std::size_t size) {
+		own()->resize(size);
 	}
 
-	template<class T>
+	/**
+	Writes the size of the TOSS, followed by the offset (counting from the bottom
+	of the bottom stack) at which each stack above the bottom one begins, from the
+	TOSS downwards.
+	**/
+	template<class T, int Dimensions>
 	template<class OutIter>
-	void StackStack<T>::getStackSizes(OutIter out) {
-		std::stack<size_t> x = indices;
+	void StackStack<T, Dimensions>::getStackSizes(OutIter out) {
+		*out++ = top().size();
+
+		std::size_t begin = 0;
+		for(std::size_t i = 0; i + 1 < stacks.size(); ++i)
+			begin += stacks[i]->size();
 
-		*out++ = values.size() - (indices.size() ? indices.top() : 0);
-		while(x.size()) {
-			*out++ = x.top();
-			x.pop();
+		for(std::size_t i = stacks.size() - 1; i > 0; --i) {
+			*out++ = begin;
+			begin -= stacks[i - 1]->size();
 		}
 	}
 
@@ -812,50 +514,38 @@ namespace stinkhorn {
 	I think the last two paragraphs mean k, not n. This function takes a reference
 	to the thread's state in order to modify its storage offset.
 	**/
-	template<class T>
-	void StackStack<T>::pushStack(VectorT const& current_storage_offset, int dimensions) {
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::pushStack(VectorT const& current_storage_offset, int dimensions) {
 		CellT transfer = pop();
-		std::size_t zeroes = 0;
 
-		std::vector<CellT> buffer;
+		stacks.push_back(StoragePtr(new StorageT));
+		toss = stacks.back().get();
+		StorageT& soss = this->soss();
 
-		//Work out how many zeroes we need and copy any elements we are transferring
-		//into the temporary buffer. 
+		//Copy the transferred cells across as a block, with zeroes under them if the
+		//SOSS is short of cells, or push |n| zeroes onto the SOSS.
 		if(transfer > 0) {
-			std::size_t soss_begin = indices.size() ? indices.top() : 0;
-			std::size_t available = values.size() - soss_begin;
-
-			if(static_cast<std::size_t>(transfer) > available) {
-				zeroes = static_cast<std::size_t>(transfer) - available;
-				transfer = static_cast<CellT>(available);
-				assert(transfer >= 0); //Could happen due to overflow
-			}
-
-			buffer.reserve(static_cast<std::size_t>(transfer));
-			std::copy(values.end() - static_cast<std::size_t>(transfer), values.end(), std::back_inserter(buffer));
-			values.resize(values.size() - static_cast<std::size_t>(transfer));
-		} else {
-			zeroes = static_cast<std::size_t>(-transfer);
+			std::size_t count = std::min(static_cast<std::size_t>(transfer), soss.size());
+			toss->insert(toss->end(), static_cast<std::size_t>(transfer) - count, CellT(0));
+			toss->insert(toss->end(), soss.end() - count, soss.end());
+			soss.resize(soss.size() - count);
 		}
 
-		//Push the current storage offset
-		push(current_storage_offset.x);
-		push(current_storage_offset.y);
-		if(dimensions > 2)
-			push(current_storage_offset.z);
-
-		if(transfer < 0) {
-			//This goes before indices.push(), not after, because it's the SOSS.
-			while(zeroes-- > 0)
-				values.push_back(CellT(0));
-			indices.push(values.size());
+		//Push the current storage offset onto the SOSS, as push() would.
+		if(m_invert_mode) {
+			soss.push_front(current_storage_offset.x);
+			soss.push_front(current_storage_offset.y);
+			if(dimensions > 2)
+				soss.push_front(getZ(current_storage_offset));
 		} else {
-			indices.push(values.size());
-			while(zeroes-- > 0)
-				values.push_back(CellT(0));
+			soss.push_back(current_storage_offset.x);
+			soss.push_back(current_storage_offset.y);
+			if(dimensions > 2)
+				soss.push_back(getZ(current_storage_offset));
 		}
 
-		std::copy(buffer.begin(), buffer.end(), std::back_inserter(values));
+		if(transfer < 0)
+			soss.insert(soss.end(), static_cast<std::size_t>(-transfer), CellT(0));
 	}
 
 	/**
@@ -877,58 +567,41 @@ namespace stinkhorn {
 	there is no SOSS, that is, a stack-stack underflow would occur. Returns true
 	if the operation is successful.
 	**/
-	template<class T>
-	bool StackStack<T>::popStack(VectorT& storage_offset, int dimensions) {
-		CellT transfer;
-		std::size_t zeroes = 0;
-		VectorT old_storage_offset(0, 0, 0);
-		std::vector<CellT> buffer;
-
+	template<class T, int Dimensions>
+	bool StackStack<T, Dimensions>::popStack(VectorT& storage_offset, int dimensions) {
 		//Before modifying the stack stack, ensure that the operation will succeed.
 		//The operation can only fail if there isn't a SOSS to return to.
-		if(indices.empty())
+		if(stacks.size() < 2)
 			return false;
 
-		//Determine how many cells to transfer and how many zeroes to copy onto the
-		//SOSS
-		transfer = pop();
-		if(transfer > 0) {
-			//indices is guaranteed to have entries
-			std::size_t toss_begin = indices.top();
-			std::size_t available = values.size() - toss_begin;
-
-			if(static_cast<std::size_t>(transfer) > available) {
-				zeroes = static_cast<std::size_t>(transfer) - available;
-				transfer = static_cast<CellT>(available);
-				assert(transfer >= 0); //Could happen due to overflow
-			}
-
-			buffer.reserve(static_cast<std::size_t>(transfer));
-			std::copy(values.begin() + toss_begin, values.end(), std::back_inserter(buffer));
-		} else {
-			zeroes = static_cast<std::size_t>(-transfer);
-		}
-
-		//Remove the TOSS
-		values.resize(indices.top());
-		indices.pop();
+		CellT transfer = pop();
 
 		//Restore the old storage offset, which is stored at the top of the SOSS.
-		//Probably should be moved to a separate function if the need arises.
+		//The old TOSS is only read, so it needn't be owned (toss may be 0 if it's
+		//shared), and it lives in stacks until it is popped below.
+		StorageT& soss = this->soss();
+		StorageT const& old_toss = top();
+		toss = &soss;
+
 		if(dimensions > 2)
-			storage_offset.z = pop();
+			setZ(storage_offset, pop());
 		storage_offset.y = pop();
 		storage_offset.x = pop();
 
-		//Transfer cells and copy zeroes onto the SOSS
-		if(transfer > 0)
-			while(zeroes-- > 0)
-				values.push_back(CellT(0));
-		else
-			while(transfer++)
-				pop();
+		//The whole TOSS is carried over as a block, with zeroes underneath it if it
+		//holds fewer than n cells (but no zeroes at all if it is empty).
+		if(transfer > 0 && !old_toss.empty()) {
+			std::size_t count = old_toss.size();
+			if(static_cast<std::size_t>(transfer) > count)
+				soss.insert(soss.end(), static_cast<std::size_t>(transfer) - count, CellT(0));
+			soss.insert(soss.end(), old_toss.begin(), old_toss.end());
+		}
 
-		std::copy(buffer.begin(), buffer.end(), std::back_inserter(values));
+		stacks.pop_back();
+		toss = &soss;
+
+		if(transfer < 0)
+			discard(static_cast<std::size_t>(-transfer));
 
 		return true;
 	}
@@ -950,68 +623,91 @@ namespace stinkhorn {
 
 	~ If count is zero, nothing happens. 
 	**/
-	template<class T>
-	bool StackStack<T>::transfer(CellT elements) {
-		if(indices.empty())
+	template<class T, int Dimensions>
+	bool StackStack<T, Dimensions>::transfer(CellT elements) {
+		if(stacks.size() < 2)
 			return false;
 
-		//In the negative case, pop() n times into a buffer, then splice the buffer into this->values and bump up the index of where the TOSS starts.
-		if(elements < 0) {
-			std::size_t avail = topStackSize();
-			std::vector<CellT> buffer;
-
-			CellT n = -elements;
-			while(n--)
-				buffer.push_back(pop());
+		StorageT& soss = this->soss();
+		own();
 
-			values.insert(values.begin() + indices.top(), buffer.begin(), buffer.end());
-			indices.top() += std::size_t(-elements);
+		if(elements < 0) {
+			//pop() |n| times onto the top of the SOSS; once the TOSS runs out, pop()
+			//gives zeroes. Taking cells from the top reverses them, taking them from
+			//the bottom (in queue mode) doesn't.
+			std::size_t n = static_cast<std::size_t>(-elements);
+			std::size_t count = std::min(n, toss->size());
+			if(m_queue_mode) {
+				soss.insert(soss.end(), toss->begin(), toss->begin() + count);
+				toss->erase(toss->begin(), toss->begin() + count);
+			} else {
+				soss.insert(soss.end(), toss->rbegin(), toss->rbegin() + count);
+				toss->resize(toss->size() - count);
+			}
+
+			soss.insert(soss.end(), n - count, CellT(0));
 			return true;
 		}
 
-		if(elements == 0)
-			return true;
-
-		std::size_t toss_begin, soss_begin;
-
-		toss_begin = indices.top();
-		indices.pop();
-		soss_begin = indices.size() ? indices.top() : 0;
-		indices.push(toss_begin);
-
 		//Determine how many elements we're *really* going to transfer, and how many
 		//zeroes will be needed.
-		std::size_t available = toss_begin - soss_begin;
-		std::size_t zeroes = 0;
-		if(static_cast<std::size_t>(elements) > available) {
-			zeroes = static_cast<std::size_t>(elements) - available;
-			elements = static_cast<CellT>(available);
-			assert(elements >= 0); //Could happen due to overflow
-		}
-
-		std::vector<CellT> buffer;
-		buffer.reserve(static_cast<std::size_t>(elements));
-		std::copy(values.begin() + toss_begin - static_cast<std::size_t>(elements), values.begin() + toss_begin, std::back_inserter(buffer));
+		std::size_t n = static_cast<std::size_t>(elements);
+		std::size_t count = std::min(n, soss.size());
 
-		//Copy them in backwards, remove them from the SOSS and add on the necessary zeroes
-		std::copy(buffer.rbegin(), buffer.rend(), std::back_inserter(values));
-		values.erase(values.begin() + toss_begin - static_cast<std::size_t>(elements), values.begin() + toss_begin);
-		indices.top() -= static_cast<std::size_t>(elements);
+		toss->insert(toss->end(), soss.rbegin(), soss.rbegin() + count);
+		soss.resize(soss.size() - count);
+		toss->insert(toss->end(), n - count, CellT(0));
+		return true;
+	}
 
-		while(zeroes--)
-			values.push_back(CellT(0));
+	/**
+	Pops count cells (or as many as there are) from the TOSS, discarding them.
+	**/
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::discard(std::size_t count) {
+		own();
+		std::size_t size = toss->size();
+		if(count > size)
+			count = size;
 
-		return true;
+		if(m_queue_mode)
+			toss->erase(toss->begin(), toss->begin() + count);
+		else
+			toss->resize(size - count);
 	}
 
-	template<class T>
-	void StackStack<T>::clearTopStack() {
-		if(indices.empty()) {
-			values.clear();
-			return;
+	/**
+	Pushes count copies of value onto the TOSS.
+	**/
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::pushRepeated(T value, std::size_t count) {
+		own();
+		if(m_invert_mode) {
+			while(count--)
+				toss->push_front(value);
+		} else {
+			toss->insert(toss->end(), count, value);
 		}
+	}
 
-		values.resize(indices.top());
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::clearTopStack() {
+		own()->clear();
+	}
+
+	/**
+	Pushes the cells in [first, last) in order, so that *(last - 1) ends up on top.
+	**/
+	template<class T, int Dimensions>
+	template<class InputIter>
+	void StackStack<T, Dimensions>::pushRange(InputIter first, InputIter last) {
+		own();
+		if(m_invert_mode) {
+			for(; first != last; ++first)
+				toss->push_front(*first);
+		} else {
+			toss->insert(toss->end(), first, last);
+		}
 	}
 
 	/**
@@ -1024,120 +720,251 @@ namespace stinkhorn {
 	 * Strings on the stack use null-terminators to indicate the end of the string.
 	 */
 	//TODO: Handle queue mode/insert mode
-	template<class T>
+	template<class T, int Dimensions>
 	template<class U>
-	void StackStack<T>::readString(U& out) {
-		typedef typename U::size_type size_type;
-		size_type lower = indices.size() ? indices.top() : 0;
+	void StackStack<T, Dimensions>::readString(U& out) {
 		out.clear();
+		own();
 
-		if(values.size() == 0)
-			return;
+		typename StorageT::reverse_iterator itr = toss->rbegin(), rend = toss->rend();
+		for(; itr != rend && *itr != 0; ++itr)
+			out += typename U::value_type(*itr);
 
-		size_type pos = values.size() - 1;
-		while(true) {
-			if(pos == lower || values[pos] == 0) {
-				if(pos == lower && values[pos] != 0)
-					out += char(values[pos]);
-				break;
-			}
+		//Pop the string, and its terminator if there is one.
+		toss->resize(itr == rend ? 0 : (rend - itr) - 1);
+	}
 
-			out += char(values[pos]);
+	//TODO: Handle queue mode/insert mode
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::pushString(String const& str) {
+		own()->push_back(0);
+		toss->insert(toss->end(), str.rbegin(), str.rend());
+	}
+
+	/**
+	Returns the index of the first cell of the string whose first character is at
+	end - 1. The string's terminator is the cell before it, unless the string
+	runs to the bottom of the TOSS, in which case this returns 0.
+	**/
+	template<class T, int Dimensions>
+	std::size_t StackStack<T, Dimensions>::strnBegin(std::size_t end) {
+		StorageT const& stack = top();
+		typename StorageT::const_reverse_iterator first(stack.begin() + end), last = stack.rend();
+		return last - std::find(first, last, CellT(0));
+	}
 
-			--pos;
+	/**
+	Replaces everything from cell keep upwards with a terminator followed by the
+	cells [first, last), which must lie above keep (or start at the bottom).
+	**/
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::strnReplace(std::size_t keep, std::size_t first, std::size_t last) {
+		if(first == 0) {
+			//No room underneath for the terminator, so make some.
+			toss->resize(last);
+			toss->push_front(0);
+			return;
 		}
 
-		values.resize(pos);
+		assert(keep < first);
+		typename StorageT::iterator cells = toss->begin();
+		cells[keep] = 0;
+		std::copy(cells + first, cells + last, cells + keep + 1);
+		toss->resize(keep + 1 + (last - first));
 	}
 
 	//TODO: Handle queue mode/insert mode
-	template<class T>
-	void StackStack<T>::pushString(String const& str) {
-		values.push_back(0);
-		for(typename String::size_type i = 0, len = str.size(); i < len; i++)
-			values.push_back(str[len - 1 - i]);
+	template<class T, int Dimensions>
+	T StackStack<T, Dimensions>::strnGetLength() {
+		//Find how many cells we would need to pop to get a zero.
+		std::size_t size = top().size();
+		return static_cast<CellT>(size - strnBegin(size));
 	}
 
-	//TODO: Handle queue mode/insert mode
-	template<class T>
-	T StackStack<T>::strnGetLength() {
-		//Find how many cells we would need to pop to get a zero.
-		typename String::size_type lower = indices.size() ? indices.top() : 0;
-		typename String::size_type max = values.size() - lower;
-		
-		for(typename StorageT::const_reverse_iterator itr = values.rbegin(), rend = values.rend(); itr != rend; ++itr) {
-			if(*itr == 0)
-				return static_cast<CellT>(itr - values.rbegin());
+	/**
+	A: The second string goes on the end of the first, which only means taking
+	out the first string's terminator.
+	**/
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::strnAppend() {
+		own();
+		std::size_t begin = strnBegin(toss->size());
+		if(begin > 0) {
+			toss->erase(toss->begin() + (begin - 1));
+			begin = strnBegin(begin - 1);
 		}
 
-		return max;
+		if(begin == 0)
+			toss->push_front(0);
 	}
 
-	//Ouch. I didn't foresee needing to implement something like this.
-	//O(n) complexity just for a push is not nice (only when there is
-	//more than one stack on the stack stack)
-	template<class T>
-	void StackStack<T>::pushFront(CellT value) {
-		if(indices.empty())
-			values.push_front(value);
-		else
-			values.insert(values.begin() + indices.top(), value);
+	/**
+	C: Compares the first string with the second the way String::compare would,
+	then pops them both.
+	**/
+	template<class T, int Dimensions>
+	T StackStack<T, Dimensions>::strnCompare() {
+		own();
+		std::size_t end1 = toss->size(), begin1 = strnBegin(end1);
+		std::size_t end2 = begin1 ? begin1 - 1 : 0, begin2 = strnBegin(end2);
+
+		typedef typename StorageT::reverse_iterator Iter;
+		Iter first1(toss->begin() + end1), first2(toss->begin() + end2);
+		std::size_t length1 = end1 - begin1, length2 = end2 - begin2;
+
+		CellT result = static_cast<CellT>(length1) - static_cast<CellT>(length2);
+		std::pair<Iter, Iter> m = std::mismatch(first1, first1 + std::min(length1, length2), first2);
+		if(m.first != first1 + std::min(length1, length2))
+			result = *m.first < *m.second ? -1 : 1;
+
+		toss->resize(begin2 ? begin2 - 1 : 0);
+		return result;
 	}
 
-	template<class T>
-	typename StackStack<T>::CellT StackStack<T>::popFront() {
-		if(indices.empty()) {
-			if(values.empty())
-				return CellT(); //Whole stack stack is empty
+	/**
+	F: Searches the first string for the second. If it's there, the first string
+	from that point on replaces them both; if not, they are both popped and false
+	is returned.
+	**/
+	template<class T, int Dimensions>
+	bool StackStack<T, Dimensions>::strnFind() {
+		own();
+		std::size_t end1 = toss->size(), begin1 = strnBegin(end1);
+		std::size_t end2 = begin1 ? begin1 - 1 : 0, begin2 = strnBegin(end2);
+		std::size_t keep = begin2 ? begin2 - 1 : 0;
+
+		typedef typename StorageT::reverse_iterator Iter;
+		typename StorageT::iterator cells = toss->begin();
+		Iter first1(cells + end1), last1(cells + begin1);
+		Iter found = std::search(first1, last1, Iter(cells + end2), Iter(cells + begin2));
+
+		if(found == last1 && end2 != begin2) {
+			toss->resize(keep);
+			return false;
+		}
+
+		strnReplace(keep, begin1, end1 - (found - first1));
+		return true;
+	}
 
-			//No SOSS
-			CellT c = values.front();
-			values.pop_front();
-			return c;
-		} else {
-			if(values.size() == indices.top())
-				return CellT(); //TOSS is empty
-			typename StorageT::iterator itr(values.begin() + indices.top());
-			CellT c = *itr;
-			values.erase(itr);
-			return c;
+	//L: Leaves the leftmost n characters of the string.
+	template<class T, int Dimensions>
+	bool StackStack<T, Dimensions>::strnLeft(CellT n) {
+		own();
+		std::size_t end = toss->size(), begin = strnBegin(end);
+		if(n < 0) {
+			toss->resize(begin ? begin - 1 : 0);
+			return false;
 		}
+
+		std::size_t count = std::min(static_cast<std::size_t>(n), end - begin);
+		strnReplace(begin ? begin - 1 : 0, end - count, end);
+		return true;
 	}
 
-	template<class T>
-	typename StackStack<T>::VectorT StackStack<T>::popVector(int dimensions) {
+	/**
+	M: Leaves n characters of the string, starting from the start'th. Reflects
+	if start is beyond the end of the string - except for the empty string,
+	which just stays empty.
+	**/
+	template<class T, int Dimensions>
+	bool StackStack<T, Dimensions>::strnMid(CellT start, CellT n) {
+		own();
+		std::size_t end = toss->size(), begin = strnBegin(end), length = end - begin;
+		if(n < 0 || start < 0 || (length && static_cast<std::size_t>(start) >= length)) {
+			toss->resize(begin ? begin - 1 : 0);
+			return false;
+		}
+
+		std::size_t skip = std::min(static_cast<std::size_t>(start), length);
+		std::size_t count = std::min(static_cast<std::size_t>(n), length - skip);
+		strnReplace(begin ? begin - 1 : 0, end - skip - count, end - skip);
+		return true;
+	}
+
+	//R: Leaves the rightmost n characters of the string.
+	template<class T, int Dimensions>
+	bool StackStack<T, Dimensions>::strnRight(CellT n) {
+		own();
+		std::size_t end = toss->size(), begin = strnBegin(end);
+		if(n < 0) {
+			toss->resize(begin ? begin - 1 : 0);
+			return false;
+		}
+
+		std::size_t count = std::min(static_cast<std::size_t>(n), end - begin);
+		strnReplace(begin ? begin - 1 : 0, begin, begin + count);
+		return true;
+	}
+
+	template<class T, int Dimensions>
+	typename StackStack<T, Dimensions>::VectorT StackStack<T, Dimensions>::popVector(int dimensions) {
 		VectorT v;
 		if(dimensions > 2)
-			v.z = pop();
+			setZ(v, pop());
 		if(dimensions > 1)
 			v.y = pop();
 		v.x = pop();
 		return v;
 	}
 
-	template<class T>
-	typename StackStack<T>::VectorT StackStack<T>::pushVector(VectorT const& v, int dimensions) {
+	template<class T, int Dimensions>
+	typename StackStack<T, Dimensions>::VectorT StackStack<T, Dimensions>::pushVector(VectorT const& v, int dimensions) {
 		push(v.x);
 		if(dimensions > 1)
 			push(v.y);
 		if(dimensions > 2)
-			push(v.z);
+			push(getZ(v));
 		return v;
 	}
 
 
-	template<class T>
-	void StackStack<T>::popStackNoSemantics() {
-		if(indices.empty())
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::popStackNoSemantics() {
+		if(stacks.size() < 2)
 			return;
 
-		values.resize(indices.top());
-		indices.pop();
+		stacks.pop_back();
+		toss = 0;
 	}
 
-	template<class T>
-	void StackStack<T>::pushStackNoSemantics() {
-		indices.push(values.size());
+	template<class T, int Dimensions>
+	void StackStack<T, Dimensions>::pushStackNoSemantics() {
+		stacks.push_back(StoragePtr(new StorageT));
+		toss = stacks.back().get();
+	}
+
+	template<class T, int Dimensions>
+	template<class WriterT>
+	void StackStack<T, Dimensions>::save(WriterT& out) const {
+		out.flag(m_invert_mode);
+		out.flag(m_queue_mode);
+		out.count(stacks.size());
+		for(typename std::deque<StoragePtr>::const_iterator stack = stacks.begin(); stack != stacks.end(); ++stack) {
+			out.count((*stack)->size());
+			for(typename StorageT::const_iterator cell = (*stack)->begin(); cell != (*stack)->end(); ++cell)
+				out.cell(*cell);
+		}
+	}
+
+	template<class T, int Dimensions>
+	template<class ReaderT>
+	void StackStack<T, Dimensions>::restore(ReaderT& in) {
+		m_invert_mode = in.flag();
+		m_queue_mode = in.flag();
+
+		stacks.clear();
+		for(std::size_t count = static_cast<std::size_t>(in.count(1)); stacks.size() < count; ) {
+			StoragePtr stack(new StorageT);
+			for(std::size_t size = static_cast<std::size_t>(in.count(1)); stack->size() < size; )
+				stack->push_back(static_cast<T>(in.cell()));
+			stacks.push_back(stack);
+		}
+
+		//There is always a TOSS.
+		if(stacks.empty())
+			stacks.push_back(StoragePtr(new StorageT));
+		toss = stacks.back().get();
 	}
 }
 
@@ -6,14 +6,17 @@
 #include <ostream>
 
 namespace stinkhorn {
-	template<class CellT>
+	template<class CellT, int Dimensions>
 	class StackStack;
 
-	template<class CellT>
-	struct vector3;
+	template<class CellT, int Dimensions>
+	struct vectorN;
 
 	typedef uint64 IdT;
 
+	class CheckpointWriter;
+	class CheckpointReader;
+
 	//These need to specialize on Dimensions.
 	template<class CellT, int Dimensions>
 	class TreeNode;
@@ -29,8 +32,8 @@ namespace stinkhorn {
 
 	template<class CellT, int Dimensions>
 	struct Stinkhorn {
-		typedef vector3<CellT> Vector;
-		typedef StackStack<CellT> StackStackT;
+		typedef vectorN<CellT, Dimensions> Vector;
+		typedef StackStack<CellT, Dimensions> StackStackT;
 		typedef typename unsigned_of<CellT>::type UCell;
 
 		typedef std::basic_string<CellT> String;
@@ -40,6 +43,12 @@ namespace stinkhorn {
 
 		class Context;
 		class Cursor;
+		class Analysis;
+		class ProgramImage;
+		class MappedImage;
+		class Checkpoint;
+		class AccessLog;
+		class Speculator;
 		class DebugInterpreter;
 		struct IFingerprint;
 		struct IFingerprintState;
@@ -52,6 +61,7 @@ namespace stinkhorn {
 		struct TrefungeFingerprint;
 		class Interpreter;
 		class Thread;
+		class ThreadTable;
 
 		struct NullFingerprint;
 		struct RomaFingerprint;
@@ -63,6 +73,7 @@ namespace stinkhorn {
 		struct ToysFingerprint;
 		struct SockFingerprint;
 		struct StrnFingerprint;
+		struct ModeFingerprint;
 	};
 }
 
@@ -0,0 +1,92 @@
+#include "../libstinkhorn.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+//A smoke test of the C interface: what an embedding program does with it.
+namespace {
+	int failures = 0;
+
+	void check(bool passed, char const* what) {
+		if(!passed) {
+			std::cout << "failed: " << what << std::endl;
+			++failures;
+		}
+	}
+
+	void collect(void* user, char const* buffer, size_t size) {
+		static_cast<std::string*>(user)->append(buffer, size);
+	}
+
+	size_t noInput(void*, char*, size_t) {
+		return 0;
+	}
+
+	//Counts down from 100 in a loop the scheduler can't run in one tick (the ;;
+	//keeps it off the fast path), then prints hi, leaves 7 and 8 on the stack and
+	//quits with 3.
+	char const Counter[] =
+		"\"d\">1-:;;v\n"
+		"   ^     _\"ih\",,78 3q\n";
+
+	int load(stinkhorn_interpreter* in, char const* source) {
+		return stinkhorn_load(in, source, std::strlen(source));
+	}
+}
+
+int testCApi() {
+	check(stinkhorn_create(16, 2) == 0, "an unsupported cell size is refused");
+
+	stinkhorn_interpreter* in = stinkhorn_create(32, 2);
+	check(in != 0, "a 32-bit Befunge interpreter is created");
+	if(!in)
+		return failures;
+
+	std::string output;
+	stinkhorn_set_output(in, collect, &output);
+	stinkhorn_set_input(in, noInput, 0);
+	stinkhorn_set_sandbox(in, 1);
+
+	check(load(in, Counter) == 0, "the program loads");
+	check(stinkhorn_run(in, 100) == STINKHORN_RUNNING, "100 ticks don't finish it");
+	check(output.empty(), "nothing is printed before the loop ends");
+
+	check(stinkhorn_run(in, 0) == STINKHORN_FINISHED, "running on finishes it");
+	check(output == "hi", "it prints hi");
+	check(stinkhorn_exit_code(in) == 3, "q's exit code comes back");
+	check(stinkhorn_stack_size(in) >= 2 && stinkhorn_stack_at(in, 0) == 8 && stinkhorn_stack_at(in, 1) == 7,
+		"the last IP's stack is left to read, top first");
+
+	//Reset keeps the output callback, and the old program is gone.
+	stinkhorn_reset(in);
+	output.clear();
+	check(load(in, "\"A\",@") == 0, "a second program loads after reset");
+	check(stinkhorn_run(in, 0) == STINKHORN_FINISHED, "the second program finishes");
+	check(output == "A", "the second program prints A");
+	check(stinkhorn_exit_code(in) == 0, "@ exits with 0");
+	check(stinkhorn_stack_size(in) == 0, "the second program's stack is empty");
+
+	//Two interpreters can start from one image, each writing its own copy.
+	char const Writer[] = "\"B\"00p00g,@";
+	stinkhorn_image* image = stinkhorn_image_create(32, 2, Writer, std::strlen(Writer));
+	check(image != 0, "an image is made from a program");
+	if(image) {
+		stinkhorn_interpreter* other = stinkhorn_create(32, 2);
+		std::string other_output;
+		stinkhorn_set_output(other, collect, &other_output);
+
+		stinkhorn_reset(in);
+		output.clear();
+		check(stinkhorn_load_image(in, image) == 0 && stinkhorn_load_image(other, image) == 0, "both load the image");
+		check(stinkhorn_run(in, 0) == STINKHORN_FINISHED && stinkhorn_run(other, 0) == STINKHORN_FINISHED, "both finish");
+		check(output == "B" && other_output == "B", "both print what they wrote over the image");
+
+		stinkhorn_destroy(other);
+		stinkhorn_reset(in);
+		stinkhorn_image_destroy(image);
+	}
+
+	stinkhorn_destroy(in);
+	return failures;
+}
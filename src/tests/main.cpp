@@ -1,8 +1,11 @@
 #include <iostream>
 
 void showVersion();
+int testCApi();
 
 int main() {
     std::cout << "Testing version: ";
     showVersion();
+
+    return testCApi();
 }
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Runs each test-*.sh in this directory, as make test does, from the top of
+# the tree once stinkhorn and stinkhorn_tests are built. Every test gets:
+#   STINKHORN  the interpreter to run
+#   TESTS      this directory, where the test programs are
+#   SCRATCH    an empty directory of its own, removed afterwards
+# and passes by exiting with 0. The exit code is the number that failed.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+STINKHORN=${STINKHORN:-$(pwd)/stinkhorn}
+export TESTS STINKHORN
+
+failed=0
+for test in "$TESTS"/test-*.sh; do
+	name=$(basename "$test" .sh)
+	SCRATCH=$(mktemp -d "${TMPDIR:-/tmp}/stinkhorn-$name.XXXXXX")
+	export SCRATCH
+
+	if output=$(cd "$SCRATCH" && bash "$test" 2>&1); then
+		echo "pass: $name"
+	else
+		echo "FAIL: $name"
+		echo "$output" | sed 's/^/    /'
+		failed=$((failed + 1))
+	fi
+
+	rm -rf "$SCRATCH"
+done
+
+exit $failed
@@ -0,0 +1,51 @@
+# --analyze reports which pages the program's paths execute (code), which its
+# g and p reach (data), and what could make that wrong, without running it.
+failed=0
+check() {
+	local name=$1 expected=$2
+	output=$("$STINKHORN" --analyze $name.b98 </dev/null)
+	if [ "$output" != "$expected" ]; then
+		echo "--analyze $name reported:"
+		echo "$output"
+		echo "rather than:"
+		echo "$expected"
+		failed=1
+	fi
+}
+
+# A p into the next page along, which is only data, and a p onto the code.
+printf '188*2+0p150p@\n' >put.b98
+check put "Pages (64 cells wide, listed by their first cell):
+  {0, 0}: code and data
+  {64, 0}: data
+Hazards:
+  {11, 0}: p writes onto a page holding code
+Every path from the origin was followed."
+
+# A j by a constant is followed, here into the next page, which is then code.
+printf '88*j%64s@\n' '' >jump.b98
+check jump "Pages (64 cells wide, listed by their first cell):
+  {0, 0}: code
+  {64, 0}: code
+Hazards:
+  none
+Every path from the origin was followed."
+
+# A g from the next page makes it data.
+printf '"ab"v\n    >188*2+1g,@\n' >get.b98
+check get "Pages (64 cells wide, listed by their first cell):
+  {0, 0}: code
+  {64, 0}: data
+Hazards:
+  none
+Every path from the origin was followed."
+
+# Where a j goes depends on the input, so nothing past it is followed.
+printf '&j@\n' >input.b98
+check input "Pages (64 cells wide, listed by their first cell):
+  {0, 0}: code
+Hazards:
+  {1, 0}: j jumps a computed distance (not followed)
+Some paths could not be followed, so IPs may execute pages not listed as code."
+
+exit $failed
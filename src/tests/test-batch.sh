@@ -0,0 +1,56 @@
+# --batch runs every program in a list (or a directory) and prints a line for
+# each, as it finishes: the source, its exit code and how long it took. Each
+# program reads from and writes to the files given, or else the ones named
+# after it.
+printf '"olleh",,,,,@\n' >hello.b98
+printf '~.~.@\n' >echo.b98
+printf 'xy\n' >echo.in
+printf '7q\n' >quit.b98
+
+cat >list <<END
+# Blank lines and comments are skipped.
+hello.b98
+
+echo.b98 echo.in echoed
+quit.b98 - -
+END
+
+"$STINKHORN" --batch list </dev/null >batch.out || exit 1
+
+#The order programs finish in, and their times, vary.
+if [ -n "$(awk -F '\t' '$3 !~ /^[0-9][0-9.e+-]*$/' batch.out)" ]; then
+	echo "--batch printed a line without a time:"
+	cat batch.out
+	exit 1
+fi
+
+cut -f 1,2 batch.out | sort >codes
+printf 'echo.b98\t0\nhello.b98\t0\nquit.b98\t7\n' >expected
+if ! cmp -s codes expected; then
+	echo "--batch printed:"
+	cat batch.out
+	exit 1
+fi
+
+if [ "$(cat hello.out)" != "hello" ] || [ "$(cat echoed)" != "120 121 " ] || [ -e quit.out ]; then
+	echo "the programs' output went astray: hello.out has \"$(cat hello.out)\", echoed has \"$(cat echoed)\""
+	exit 1
+fi
+
+# Given a directory, every program in it runs, with its .in and .out.
+rm -f hello.out echoed
+mkdir programs
+mv hello.b98 echo.b98 echo.in quit.b98 programs
+"$STINKHORN" --batch programs </dev/null >batch.out || exit 1
+
+cut -f 1,2 batch.out | sed 's|.*/||' | sort >codes
+if ! cmp -s codes expected; then
+	echo "--batch on a directory printed:"
+	cat batch.out
+	exit 1
+fi
+
+if [ "$(cat programs/echo.out)" != "120 121 " ]; then
+	echo "echo.b98 in a directory printed \"$(cat programs/echo.out)\""
+	exit 1
+fi
@@ -0,0 +1,3 @@
+# stinkhorn_tests, built next to stinkhorn, drives the C interface the way an
+# embedding program would (see capi.cpp).
+"$(dirname "$STINKHORN")/stinkhorn_tests"
@@ -0,0 +1,9 @@
+# A tight loop must still let a checkpoint be saved: this one never leaves
+# the fast path for loops, so it is stopped after two seconds, by which time
+# --checkpoint-every 1 should have saved it at least once.
+timeout 2 "$STINKHORN" --checkpoint loop.ck --checkpoint-every 1 "$TESTS/checkpoint-loop.b98" </dev/null
+
+if [ ! -s loop.ck ]; then
+	echo "no checkpoint was saved while the loop ran"
+	exit 1
+fi
@@ -0,0 +1,36 @@
+# A program checkpointed as it runs must, restored, finish as it would have
+# without stopping. It counts for a few seconds in a loop which keeps its count
+# in funge-space and what's left on the stack, so both have to come back.
+program="$TESTS/checkpoint-count.b98"
+"$STINKHORN" --checkpoint count.ck --checkpoint-every 1 "$program" </dev/null >whole.out || exit 1
+if [ ! -s count.ck ]; then
+	echo "no checkpoint was saved"
+	exit 1
+fi
+
+timeout 20 "$STINKHORN" --restore count.ck </dev/null >restored.out || exit 1
+if ! cmp -s whole.out restored.out; then
+	echo "the restored program printed $(cat restored.out) rather than $(cat whole.out)"
+	exit 1
+fi
+
+# A damaged checkpoint is refused rather than believed. Here the length of the
+# source file's name, in the last record, is made huge.
+at=$(grep -boaF "$program" count.ck | tail -n 1 | cut -d: -f1)
+cp count.ck damaged.ck
+printf '\377\377\377\377\377\377\377\377\001' | dd of=damaged.ck bs=1 seek=$((at - 1)) conv=notrunc 2>/dev/null
+
+"$STINKHORN" --restore damaged.ck </dev/null >/dev/null 2>error
+status=$?
+if [ $status -eq 0 ] || [ $status -ge 128 ] || ! grep -q "cut short or damaged" error; then
+	echo "a damaged checkpoint wasn't refused cleanly (exit $status): $(cat error)"
+	exit 1
+fi
+
+head -c 100 count.ck >short.ck
+"$STINKHORN" --restore short.ck </dev/null >/dev/null 2>error
+status=$?
+if [ $status -eq 0 ] || [ $status -ge 128 ]; then
+	echo "a truncated checkpoint wasn't refused cleanly (exit $status): $(cat error)"
+	exit 1
+fi
@@ -0,0 +1,57 @@
+# An image made with --make-image must run as the source does, even though the
+# program writes over its own (mapped, shared) page, and an image that has
+# been damaged must be refused with an error rather than run.
+program="$TESTS/image.b98"
+"$STINKHORN" "$program" </dev/null >source.out || exit 1
+"$STINKHORN" --make-image good.img "$program" </dev/null || exit 1
+"$STINKHORN" --image good.img </dev/null >image.out || exit 1
+if ! cmp -s source.out image.out; then
+	echo "the image printed $(cat image.out) rather than $(cat source.out)"
+	exit 1
+fi
+
+#Where the directory of page addresses and the pages themselves start.
+number() {
+	od -An -t u8 -j "$1" -N 8 good.img | tr -d ' '
+}
+directory=$(number 8)
+pages=$(number 16)
+
+#Writes bytes (given as printf escapes) into a copy of the good image.
+damage() {
+	cp good.img "$1"
+	printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+refused() {
+	"$STINKHORN" --image "$1" </dev/null >/dev/null 2>error
+	status=$?
+	if [ $status -eq 0 ] || [ $status -ge 128 ] || ! grep -q "$2" error; then
+		echo "$1 wasn't refused as $2 (exit $status): $(cat error)"
+		failed=1
+	fi
+}
+
+failed=0
+refused "$program" "isn't a funge-space image"
+
+head -c $(( $(wc -c <good.img) - 100 )) good.img >short.img
+refused short.img "cut short or damaged"
+
+#The program spans two pages, (0, 0) and (1, 0), of 32-bit cells.
+damage unsorted.img "$directory" '\001\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000'
+refused unsorted.img "out of order or repeated"
+
+damage repeated.img "$directory" '\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000'
+refused repeated.img "out of order or repeated"
+
+#A page's cells are followed by its usage and then its shared flag.
+shared=$(( pages + 64 * 64 * 4 + 1 ))
+if [ "$(od -An -t u1 -j $shared -N 1 good.img | tr -d ' ')" != 1 ]; then
+	echo "the first page's shared flag isn't where this test expects"
+	exit 1
+fi
+damage unshared.img "$shared" '\000'
+refused unshared.img "isn't marked shared"
+
+exit $failed
@@ -0,0 +1,34 @@
+# y with a positive argument picks one cell out of what y with 0 would push,
+# working it out on its own. For each index, that must be the cell y pushes
+# there: one of the info items, the stack from before y (past the items'
+# end), or 0 (past that). 0 and negative arguments push every item. The
+# environment is emptied so that the items are short, and both programs are
+# y.b98, the same size, with y on the same cell, so that the arguments, the
+# bounds and the IP's position match.
+printf '789    0y aa*k.@\n' >y.b98
+all=($(env -i "$STINKHORN" y.b98 </dev/null)) || exit 1
+
+failed=0
+for n in -7 -1 $(seq 1 45); do
+	#Items 15 and 16, the date and time, are cells 20 and 21.
+	if [ $n = 20 -o $n = 21 ]; then
+		continue
+	fi
+
+	#n is pushed in five cells, as a*15 + b or 0 - b.
+	if [ $n -lt 0 ]; then
+		push=$(printf '  0%x-' $((-n)))
+		expected=${all[0]}
+	else
+		push=$(printf '%xf*%x+' $((n / 15)) $((n % 15)))
+		expected=${all[$((n - 1))]}
+	fi
+
+	printf '789%sy.@@@@@@\n' "$push" >y.b98
+	output=$(env -i "$STINKHORN" y.b98 </dev/null) || exit 1
+	if [ "$output" != "$expected " ]; then
+		echo "${n}y gave $output rather than $expected"
+		failed=1
+	fi
+done
+exit $failed
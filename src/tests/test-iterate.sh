@@ -0,0 +1,25 @@
+# k does some instructions in one step rather than count times. Whatever MODE's
+# invert and queue modes are, 4k must leave the same stack as the instruction
+# written out five times (k doesn't move past it, so it runs once more).
+failed=0
+for modes in "" I Q IQ; do
+	#The count goes where k will pop it from.
+	case $modes in
+		Q|IQ) numbers='4 123456789';;
+		*) numbers='123456789 4';;
+	esac
+
+	for instruction in ':' '\' '$' '5' 'n'; do
+		printf '"EDOM"4($$%s%sk%s ...........@\n' "$numbers" "$modes" "$instruction" >k.b98
+		printf '"EDOM"4($$%s%s$%s%s%s%s%s ...........@\n' "$numbers" "$modes" \
+			"$instruction" "$instruction" "$instruction" "$instruction" "$instruction" >written.b98
+
+		iterated=$(timeout 10 "$STINKHORN" k.b98 </dev/null 2>&1)
+		written=$(timeout 10 "$STINKHORN" written.b98 </dev/null 2>&1)
+		if [ "$iterated" != "$written" ]; then
+			echo "4k$instruction in mode '$modes' printed $iterated rather than $written"
+			failed=1
+		fi
+	done
+done
+exit $failed
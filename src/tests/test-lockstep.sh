@@ -0,0 +1,10 @@
+# Eight IPs, spawned by three t's, meet on the same cell with different
+# stacks, then run every arithmetic instruction together before each prints
+# what it has left. They must print what they would one at a time, in the
+# order they tick.
+output=$("$STINKHORN" "$TESTS/lockstep.b98" </dev/null) || exit 1
+
+if [ "$output" != "6 7 8 6 3 4 8 6 " ]; then
+	echo "the IPs printed \"$output\""
+	exit 1
+fi
@@ -0,0 +1,41 @@
+# A lone IP runs loops round without moving its cursor. Each program here is
+# run alone and then with a second IP going round and round (spawned by the
+# t), which makes it tick through the loop as usual, and both must print the
+# same. The loop runner stops a loop for a checkpoint, which
+# test-checkpoint-loop checks.
+failed=0
+check() {
+	local name=$1 expected=$2 spawn
+	for spawn in ' ' t; do
+		program "$spawn" >$name.b98
+		output=$(timeout 10 "$STINKHORN" $name.b98 </dev/null | head -c 100)
+		if [ "$output" != "$expected" ]; then
+			echo "$name, with '$spawn' spawning, printed \"$output\" rather than \"$expected\""
+			failed=1
+		fi
+	done
+}
+
+# The first time round, p writes a 1 over the 3 the loop counts down by, so it
+# counts 10, 7, 6, ... 0, eight times round. Going on with the 3 would miss 0.
+program() {
+	cat <<END
+0a:#v$1        v
+>             v
+^:p29*77-3\\+1\\_\$.q
+END
+}
+check p-on-path "8 "
+
+# Counting down by 3 from 10125 on top of 42 is done in one step, and must
+# leave the 0 it ends on, and the 42.
+program() {
+	cat <<END
+67*ff*f*3*:#v$1 v
+           >   v
+           ^:-3_..q
+END
+}
+check countdown "0 42 "
+
+exit $failed
@@ -0,0 +1,34 @@
+# MODE's I pushes onto the bottom of the stack, Q pops off the bottom, and
+# with both the stack works as usual again, at the other end. Each program
+# loads MODE, drops the fingerprint's ID and the 1 ( pushes, then prints.
+failed=0
+check() {
+	local code=$1 expected=$2
+	printf '"EDOM"4($$%s\n' "$code" >mode.b98
+	output=$(timeout 10 "$STINKHORN" mode.b98 </dev/null)
+	if [ "$output" != "$expected" ]; then
+		echo "$code printed \"$output\" rather than \"$expected\""
+		failed=1
+	fi
+}
+
+check '123...@' "3 2 1 "
+check 'I123...@' "1 2 3 "
+check 'Q123...@' "1 2 3 "
+check 'IQ123...@' "3 2 1 "
+check '12I3...@' "2 1 3 "
+check '12Q3I4....@' "4 1 2 3 "
+
+# The same with a second stack on the stack stack.
+check '0{Q123...@' "1 2 3 "
+check '0{IQ123...@' "3 2 1 "
+
+# In hover mode, > adds to the delta rather than setting it, so the IP goes
+# on two cells at a time, past the 9s.
+check 'H>919.9@' "1 "
+
+# In switch mode, [ turns into ] once executed, which g then reads.
+check 'S[
+      @,g0b<' "]"
+
+exit $failed
@@ -0,0 +1,11 @@
+# Under --parallel, IPs may take their ticks in any order, but each one still
+# sees its own writes: two IPs counting in cells of their own, on the page
+# they share, must print every count they would print without it.
+program="$TESTS/speculate.b98"
+"$STINKHORN" "$program" </dev/null | tr -s " " "\n" | sort >plain.out || exit 1
+"$STINKHORN" --parallel "$program" </dev/null | tr -s " " "\n" | sort >parallel.out || exit 1
+
+if ! cmp -s plain.out parallel.out; then
+	echo "--parallel printed different counts"
+	exit 1
+fi
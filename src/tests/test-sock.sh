@@ -0,0 +1,57 @@
+# SOCK's W must send everything it is given, even when that is more than a
+# non-blocking socket takes at once. Each program connects to a listener
+# here, which has a small buffer and is slow to start reading, and writes
+# 8 MB of funge-space to it in one W (more than Linux's largest send
+# buffer), then prints how much W said it sent.
+if ! command -v python3 >/dev/null; then
+	echo "skipped: needs python3 for the listener"
+	exit 0
+fi
+
+length=8000000
+
+#Runs program against a new listener, and checks that it printed expected.
+send() {
+	rm -f port received
+	python3 - >port <<'END' &
+import socket, sys, time
+listener = socket.socket()
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+listener.bind(("127.0.0.1", 0))
+listener.listen(1)
+print(listener.getsockname()[1])
+sys.stdout.flush()
+listener.settimeout(20)
+connection, _ = listener.accept()
+time.sleep(0.5)
+received = 0
+while True:
+	data = connection.recv(65536)
+	if not data:
+		break
+	received += len(data)
+open("received", "w").write(str(received))
+END
+	server=$!
+
+	for i in $(seq 50); do
+		[ -s port ] && break
+		sleep 0.1
+	done
+	port=$(cat port)
+
+	#C takes the port as it goes into the address, in network byte order.
+	echo "$(( (port & 255) << 8 | port >> 8 )) $length" | timeout 20 "$STINKHORN" "$TESTS/$1.b98" >sent || exit 1
+	wait $server
+
+	if [ "$(cat sent)" != "$2" ] || [ "$(cat received)" != "$length" ]; then
+		echo "$1 printed $(cat sent), and the listener received $(cat received), of $length bytes"
+		exit 1
+	fi
+}
+
+send sock-write "$length "
+
+#Here a second IP counts to 10000 and prints c. While W waits for the
+#listener, its IP is parked, so the count finishes first.
+send sock-write-parked "c$length "
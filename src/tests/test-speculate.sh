@@ -0,0 +1,12 @@
+# --speculate must leave what a program does exactly as it is without it: two
+# IPs counting in cells of their own, and two counting in the same cell, so
+# that they interfere and their windows are run again in turn.
+for program in speculate speculate-shared; do
+	"$STINKHORN" "$TESTS/$program.b98" </dev/null >plain.out || exit 1
+	"$STINKHORN" --speculate "$TESTS/$program.b98" </dev/null >speculated.out || exit 1
+
+	if ! cmp -s plain.out speculated.out; then
+		echo "$program: --speculate changed the output"
+		exit 1
+	fi
+done
@@ -0,0 +1,22 @@
+# A lone IP pushes a string literal in one step. The literal here starts with
+# a run of spaces, has more between its letters, and wraps round the end of
+# its row to close on the far side, so it pushes " a b c d" (a space stands
+# in for each run, and for the wrap). With a second IP going round and round
+# (spawned by the t), it is pushed a cell a tick instead, which must come to
+# the same thing.
+failed=0
+for spawn in ' ' t; do
+	cat >string.b98 <<END
+0    #v$spawn  v
+d"v       >"  a  b  c
+  >        :#,_q
+      z
+END
+
+	output=$(timeout 10 "$STINKHORN" string.b98 </dev/null)
+	if [ "$output" != "d c b a " ]; then
+		echo "with '$spawn' spawning, the string printed \"$output\""
+		failed=1
+	fi
+done
+exit $failed
@@ -3,8 +3,16 @@
 #include "octree.hpp"
 #include "context.hpp"
 #include "fingerprint.hpp"
+#include "analysis.hpp"
+#include "speculation.hpp"
+#include "checkpoint.hpp"
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <cctype>
 
 using std::cerr;
 using std::vector;
@@ -13,34 +21,349 @@ using std::string;
 using boost::shared_ptr;
 
 namespace stinkhorn {
+	namespace {
+		//The instructions that runArithmetic handles itself. Befunge-93 has no a-f,
+		//and asks the user what a division by zero should give, so / and % are left
+		//to the fingerprint there.
+		template<class CellT>
+		bool isArithmetic(CellT c, bool befunge93) {
+			switch(c) {
+				case '0': case '1': case '2': case '3': case '4':
+				case '5': case '6': case '7': case '8': case '9':
+				case '+': case '-': case '*': case '`': case '!':
+				case ':': case '\\': case '$':
+					return true;
+
+				case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
+				case '/': case '%':
+					return !befunge93;
+			}
+			return false;
+		}
+
+		//The instructions that only change the IP and the funge-space cells it reads
+		//and writes through its cursor, so a Speculator can undo them. ? draws on the
+		//random number generator, which all the IPs share. Befunge-93 has none of the
+		//Funge-98 ones, and warns about them with -w.
+		template<class CellT>
+		bool isSpeculative(CellT c, bool befunge93) {
+			if(isArithmetic(c, befunge93))
+				return true;
+
+			switch(c) {
+				case '>': case '<': case '^': case 'v': case '#':
+				case '_': case '|': case '"': case 'g': case 'p':
+					return true;
+
+				case '\'': case 's': case ';': case 'j': case 'x':
+				case '[': case ']': case 'w': case 'z': case 'n':
+				case 'r': case '{': case '}': case 'u':
+					return !befunge93;
+			}
+			return false;
+		}
+
+		//Holds the top one or two cells of a stack in locals, only writing them back
+		//when a cell underneath them is needed, or by spill().
+		template<class StackT, class CellT>
+		struct CachedTop {
+			StackT& stack;
+			CellT x, y; //x is on top of y
+			int count;
+
+			CachedTop(StackT& stack) : stack(stack), x(), y(), count(0) {}
+
+			CellT pop() {
+				if(count == 2) {
+					CellT v = x;
+					x = y;
+					count = 1;
+					return v;
+				} else if(count == 1) {
+					count = 0;
+					return x;
+				}
+				return stack.pop();
+			}
+
+			void push(CellT v) {
+				if(count == 2)
+					stack.push(y);
+				else
+					count++;
+				y = x;
+				x = v;
+			}
+
+			std::size_t size() {
+				return count + stack.topStackSize();
+			}
+
+			void spill() {
+				if(count == 2)
+					stack.push(y);
+				if(count >= 1)
+					stack.push(x);
+				count = 0;
+			}
+		};
+
+		//Executes c, which must be one of the isArithmetic instructions.
+		template<class TopT, class CellT>
+		void doArithmetic(TopT& top, CellT c) {
+			switch(c) {
+				case '+':
+					top.push(top.pop() + top.pop());
+					break;
+
+				case '*':
+					top.push(top.pop() * top.pop());
+					break;
+
+				case '-':
+					{
+						CellT b = top.pop();
+						top.push(top.pop() - b);
+						break;
+					}
+
+				case '/':
+					{
+						CellT b = top.pop(), a = top.pop();
+						top.push(b ? a / b : 0);
+						break;
+					}
+
+				case '%':
+					{
+						CellT b = top.pop(), a = top.pop();
+						top.push(b ? a % b : 0);
+						break;
+					}
+
+				case '`':
+					{
+						CellT b = top.pop();
+						top.push(top.pop() > b ? 1 : 0);
+						break;
+					}
+
+				case '!':
+					top.push(top.pop() != 0 ? 0 : 1);
+					break;
+
+				case ':':
+					{
+						CellT v = top.pop();
+						top.push(v);
+						top.push(v);
+						break;
+					}
+
+				case '\\':
+					{
+						CellT b = top.pop(), a = top.pop();
+						top.push(b);
+						top.push(a);
+						break;
+					}
+
+				case '$':
+					top.pop();
+					break;
+
+				default:
+					top.push(c <= '9' ? c - '0' : c - 'a' + 10);
+					break;
+			}
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::ThreadTable::ThreadTable() {
+		m_hot.reserve(MaxBlocks);
+		m_cold.reserve(MaxBlocks);
+	}
+
+	template<class CellT, int Dimensions>
+	Stinkhorn<CellT, Dimensions>::ThreadTable::~ThreadTable() {
+		for(std::size_t i = 0; i < m_hot.size(); ++i) {
+			delete m_hot[i];
+			delete m_cold[i];
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	typename Stinkhorn<CellT, Dimensions>::ThreadTable::Slot
+	Stinkhorn<CellT, Dimensions>::ThreadTable::add(Thread* thread)
+	{
+		boost::mutex::scoped_lock lock(m_lock);
+
+		if(m_free.empty()) {
+			if(m_hot.size() == MaxBlocks)
+				throw std::bad_alloc();
+
+			std::auto_ptr<Hot> hot(new Hot);
+			std::auto_ptr<Cold> cold(new Cold);
+			m_hot.push_back(hot.release());
+			m_cold.push_back(cold.release());
+
+			//The lowest slot goes last, to be handed out first.
+			for(Slot s = m_hot.size() * BlockSize; s-- > (m_hot.size() - 1) * BlockSize; )
+				m_free.push_back(s);
+		}
+
+		Slot slot = m_free.back();
+		m_free.pop_back();
+
+		position(slot) = Vector();
+		direction(slot) = Vector(1, 0, 0);
+		pageAddress(slot) = Vector();
+		page(slot) = 0;
+		pageCopies(slot) = 0;
+		flags(slot) = 0;
+		stack(slot) = 0;
+		storageOffset(slot) = Vector();
+		this->thread(slot) = thread;
+		return slot;
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::ThreadTable::remove(Slot slot) {
+		boost::mutex::scoped_lock lock(m_lock);
+		thread(slot) = 0;
+		m_free.push_back(slot);
+	}
+
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::ThreadTable::beside(Slot slot, Slot leader) {
+		//The stack is only looked at once the cheaper tests have passed.
+		return position(slot) == position(leader) && direction(slot) == direction(leader)
+			&& !(flags(slot) & (StringMode | HoverMode))
+			&& !stack(slot)->invertMode() && !stack(slot)->queueMode();
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::ThreadTable::follow(Slot slot, Slot leader) {
+		position(slot) = position(leader);
+		pageAddress(slot) = pageAddress(leader);
+		page(slot) = page(leader);
+		pageCopies(slot) = pageCopies(leader);
+	}
+
+	namespace {
+		//a[k] = a[k] c b[k] for the binary isArithmetic instruction c. Each case is
+		//a plain loop over the arrays, which the compiler can vectorise.
+		template<class CellT>
+		void combine(CellT c, CellT* a, CellT const* b, std::size_t n) {
+			switch(c) {
+				case '+':
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] += b[k];
+					break;
+
+				case '-':
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] -= b[k];
+					break;
+
+				case '*':
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] *= b[k];
+					break;
+
+				case '`':
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] = a[k] > b[k] ? 1 : 0;
+					break;
+
+				case '/':
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] = b[k] ? a[k] / b[k] : 0;
+					break;
+
+				case '%':
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] = b[k] ? a[k] % b[k] : 0;
+					break;
+			}
+		}
+	}
+
+	/**
+	The operands are popped off every stack into m_a and m_b, combined an array at
+	a time, and the results pushed back, so the stacks (which are separate objects)
+	are each only visited to load and store. The IPs' stacks are independent, so
+	this is the same as executing c on each in turn. Instructions which only move
+	cells around, or push a constant, gain nothing from this and are executed on
+	each stack as usual.
+	**/
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::ThreadTable::execute(CellT c, Slot const* first, Slot const* last) {
+		std::size_t n = last - first;
+
+		switch(c) {
+			case '+': case '-': case '*': case '`': case '/': case '%':
+				{
+					m_a.resize(n);
+					m_b.resize(n);
+					for(std::size_t k = 0; k < n; ++k) {
+						StackStackT& s = *stack(first[k]);
+						m_b[k] = s.pop();
+						m_a[k] = s.pop();
+					}
+
+					combine(c, &m_a[0], &m_b[0], n);
+
+					for(std::size_t k = 0; k < n; ++k)
+						stack(first[k])->push(m_a[k]);
+					break;
+				}
+
+			case '!':
+				{
+					m_a.resize(n);
+					for(std::size_t k = 0; k < n; ++k)
+						m_a[k] = stack(first[k])->pop();
+
+					CellT* a = &m_a[0];
+					for(std::size_t k = 0; k < n; ++k)
+						a[k] = a[k] != 0 ? 0 : 1;
+
+					for(std::size_t k = 0; k < n; ++k)
+						stack(first[k])->push(a[k]);
+					break;
+				}
+
+			default:
+				for(Slot const* s = first; s != last; ++s)
+					doArithmetic(*stack(*s), c);
+				break;
+		}
+	}
+
 	/**
 	* Start the IP at (0, 0, 0) moving east.
 	*/
 	template<class CellT, int Dimensions>
 	Stinkhorn<CellT, Dimensions>::Thread::Thread(Interpreter& owner, Tree& funge_space, CellT threadID)
 		: owner(owner)
+		, m_table(owner.threadTable())
+		, m_slot(m_table.add(this))
+		, m_flags(m_table.flags(m_slot))
 		, m_threadID(threadID)
+		, m_test_hits(0)
+		, m_parked_on(-1)
+		, m_parked_writing(false)
 	{
+		//The context starts with the interpreter's base fingerprint loaded.
 		m_context = new Context(*this, 0, funge_space);
-
-		IFingerprint* f;
-
-		if(owner.isBefunge93())
-			f = new Befunge93Fingerprint;
-		else if(owner.isTrefunge())
-			f = new TrefungeFingerprint;
-		else
-			f = new Befunge98Fingerprint;
-
-		m_context->pushFingerprint(f);
-
-		//It is now the fingerprint stack's responsibility.
-		f->release();
 	}
 
 	template<class CellT, int Dimensions>
 	Stinkhorn<CellT, Dimensions>::Thread::~Thread() {
 		delete m_context;
+		m_table.remove(m_slot);
 	}
 
 	template<class CellT, int Dimensions>
@@ -51,6 +374,18 @@ namespace stinkhorn {
 		CellT c = cr.currentCharacter();
 
 		if(m_context->stringMode()) {
+			//When nobody else can observe the ticks, push the rest of the string in one go.
+			//This leaves the cursor on the closing quote, which is handled as usual below.
+			if(c != '\"' && owner.singleThreaded() && cr.direction() != Vector()) {
+				bool space = m_context->space();
+				if(!cr.readString(m_context->stack(), space)) {
+					endl(cerr << "\n\n** COMMENCING INFINITE LOOP **");
+					while(1);
+				}
+				m_context->space(space);
+				c = cr.currentCharacter();
+			}
+
 			if(m_context->space() && c != ' ') {
 				m_context->stack().push(' ');
 				m_context->space(false);
@@ -65,6 +400,14 @@ namespace stinkhorn {
 					m_context->stack().push(c);
 				}
 			}
+		} else if(isArithmetic(c, owner.isBefunge93()) && unobserved()) {
+			//Nobody else can see the stack between these instructions, so it doesn't
+			//have to be kept up to date after each one.
+			runArithmetic(c);
+			return true;
+		} else if((c == '_' || c == '|') && unobserved()) {
+			if(!runLoop(c))
+				return true;
 		} else {
 			if(!execute(c)) {
 				if(owner.warnings())
@@ -72,6 +415,10 @@ namespace stinkhorn {
 					static_cast<char>(c) << " (" << static_cast<int>(c) << ")" <<
 					std::endl;
 			}
+
+			//It executes the instruction again once it is unparked.
+			if(parked())
+				return true;
 		}
 
 		Vector old_ip = cr.position();
@@ -92,6 +439,292 @@ namespace stinkhorn {
 		return !m_context->quitFlag();
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Thread::runArithmetic(CellT c) {
+		Cursor& cr = m_context->cursor();
+		CachedTop<StackStackT, CellT> top(m_context->stack());
+		bool befunge93 = owner.isBefunge93();
+
+		do {
+			doArithmetic(top, c);
+
+			if(!cr.advance()) {
+				top.spill();
+				endl(cerr << "\n\n** COMMENCING INFINITE LOOP **");
+				while(1);
+			}
+
+			c = cr.currentCharacter();
+		} while(isArithmetic(c, befunge93));
+
+		top.spill();
+	}
+
+	namespace {
+		//The direction _ or | sends the IP in, given the cell it popped.
+		template<class VectorT, class CellT>
+		VectorT testDirection(CellT test, CellT value) {
+			CellT d = value ? -1 : 1;
+			return test == '_' ? VectorT(d, 0, 0) : VectorT(0, d, 0);
+		}
+
+		template<class VectorT, class CellT>
+		struct LoopStep {
+			CellT instruction;
+			VectorT position, direction;
+
+			LoopStep(CellT instruction, VectorT const& position, VectorT const& direction)
+				: instruction(instruction), position(position), direction(direction)
+			{}
+		};
+	}
+
+	/**
+	A loop is recognised the second time in a row that the IP reaches the same _
+	or |. The path the IP would take from there is followed with a spare cursor,
+	and if it comes back to the test having only passed through arrows, #, z and
+	instructions that work on the stack and g and p, the instructions are recorded
+	and then executed round and round until the test sends the IP the other way.
+	The cursor stays on the test meanwhile, and since nothing else can observe
+	the IP, the ticks don't need to be counted out.
+
+	The one closed form is a bare countdown, where all the loop does between tests
+	is subtract a constant and duplicate the result.
+
+	A p that would write on the loop's own path (or grow funge-space, which could
+	change where it wraps) stops the loop there, and the instruction is left to
+	be executed as usual. So does any p in a loop that wraps, unless the load-time
+	analysis shows that it writes to a page holding no code.
+	**/
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::Thread::runLoop(CellT c) {
+		static const std::size_t MaxLoopSteps = 256;
+		typedef LoopStep<Vector, CellT> Step;
+
+		Cursor& cr = m_context->cursor();
+		CachedTop<StackStackT, CellT> top(m_context->stack());
+		Vector const test = cr.position();
+
+		Vector const loop_direction = testDirection<Vector>(c, top.pop());
+		cr.direction(loop_direction);
+
+		if(test == m_last_test && m_test_hits) {
+			m_test_hits++;
+		} else {
+			m_last_test = test;
+			m_test_hits = 1;
+		}
+
+		if(m_test_hits != 2)
+			return true;
+
+		//Follow the loop round, taking down what's executed on the way.
+		std::vector<Step> steps;
+		Vector lower = test, upper = test; //Every cell the path crosses (if it doesn't wrap)
+		bool wraps = false, befunge93 = owner.isBefunge93();
+
+		Cursor walker(cr);
+		for(std::size_t i = 0; ; ++i) {
+			if(i == MaxLoopSteps)
+				return true;
+
+			Vector from = walker.position();
+			if(!walker.advance())
+				return true;
+
+			Vector at = walker.position(), dir = walker.direction();
+
+			//The path only moves along one axis at a time, so unless it has wrapped,
+			//the cells it has crossed are all inside [lower, upper].
+			Vector moved = at - from;
+			CellT distance = moved.x * dir.x + moved.y * dir.y;
+			if(distance <= 0 || moved != dir * distance)
+				wraps = true;
+
+			lower = Vector(std::min(lower.x, at.x), std::min(lower.y, at.y), std::min<CellT>(getZ(lower), getZ(at)));
+			upper = Vector(std::max(upper.x, at.x), std::max(upper.y, at.y), std::max<CellT>(getZ(upper), getZ(at)));
+
+			if(at == test)
+				break;
+
+			CellT instruction = walker.currentCharacter();
+			switch(instruction) {
+				case '>': walker.direction(Vector(1, 0, 0)); break;
+				case '<': walker.direction(Vector(-1, 0, 0)); break;
+				case 'v': walker.direction(Vector(0, 1, 0)); break;
+				case '^': walker.direction(Vector(0, -1, 0)); break;
+
+				case '#':
+					walker.position(at + dir);
+					break;
+
+				case 'z':
+					if(befunge93)
+						return true;
+					break;
+
+				case 'g': case 'p':
+					steps.push_back(Step(instruction, at, dir));
+					break;
+
+				default:
+					if(!isArithmetic(instruction, befunge93))
+						return true;
+					steps.push_back(Step(instruction, at, dir));
+					break;
+			}
+		}
+
+		//A bare countdown by k finishes with 0 on top, as long as it gets there exactly.
+		if(steps.size() == 3 && steps[1].instruction == '-' && steps[2].instruction == ':'
+			&& isArithmetic(steps[0].instruction, befunge93) && std::isxdigit(static_cast<int>(steps[0].instruction))
+			&& loop_direction == testDirection<Vector>(c, CellT(1)))
+		{
+			CellT k = steps[0].instruction, n = top.pop();
+			k = k <= '9' ? k - '0' : k - 'a' + 10;
+
+			if(k > 0 && n > 0 && n % k == 0) {
+				top.push(0);
+				top.spill();
+				cr.direction(testDirection<Vector>(c, CellT(0)));
+				m_test_hits = 1;
+				return true;
+			}
+
+			top.push(n);
+		}
+
+		Vector const& storage_offset = m_context->storageOffset();
+		Analysis& analysis = owner.analysis();
+		Vector min, max;
+		m_context->fungeSpace().get_minmax(min, max);
+		Vector const one(1, 1, 1);
+
+		for(;;) {
+			for(typename std::vector<Step>::const_iterator s = steps.begin(); s != steps.end(); ++s) {
+				switch(s->instruction) {
+					case 'g':
+						{
+							CellT y = top.pop() + storage_offset.y;
+							CellT x = top.pop() + storage_offset.x;
+							top.push(cr.get(Vector(x, y, 0)));
+							break;
+						}
+
+					case 'p':
+						{
+							bool safe = top.size() >= 3;
+							Vector to;
+							if(safe) {
+								CellT y = top.pop(), x = top.pop();
+								to = Vector(x + storage_offset.x, y + storage_offset.y, 0);
+
+								//A page the load-time analysis found no code on can't be on
+								//the loop's path, wherever the path goes.
+								bool off_path = analysis.unreachable(to) || (!wraps && !inside(to, lower, upper + one));
+								if(!off_path || !inside(to, min, max + one)) {
+									top.push(x);
+									top.push(y);
+									safe = false;
+								}
+							}
+
+							if(!safe) {
+								top.spill();
+								cr.position(s->position);
+								cr.direction(s->direction);
+								return false;
+							}
+
+							cr.put(to, top.pop());
+							break;
+						}
+
+					default:
+						doArithmetic(top, s->instruction);
+						break;
+				}
+			}
+
+			Vector direction = testDirection<Vector>(c, top.pop());
+			if(direction != loop_direction) {
+				top.spill();
+				cr.direction(direction);
+				m_test_hits = 1;
+				return true;
+			}
+
+			//A checkpoint can only be saved from outside the loop, which could
+			//otherwise go round for ever. It picks up again at the next test.
+			if(checkpointWanted) {
+				top.spill();
+				m_test_hits = 1;
+				return true;
+			}
+		}
+	}
+
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::Thread::stackOnlyInstruction(CellT& c) {
+		if(m_context->stringMode() || m_context->hoverMode())
+			return false;
+
+		c = m_context->cursor().currentCharacter();
+		return isArithmetic(c, owner.isBefunge93());
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Thread::save(Snapshot& snapshot) const {
+		Cursor& cr = m_context->cursor();
+		snapshot.position = cr.position();
+		snapshot.direction = cr.direction();
+		snapshot.storage_offset = m_context->storageOffset();
+		snapshot.string_mode = m_context->stringMode();
+		snapshot.space = m_context->space();
+		snapshot.stack = m_context->stack();
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Thread::restore(Snapshot const& snapshot) {
+		Cursor& cr = m_context->cursor();
+		cr.position(snapshot.position);
+		cr.direction(snapshot.direction);
+		m_context->storageOffset(snapshot.storage_offset);
+		m_context->stringMode(snapshot.string_mode);
+		m_context->space(snapshot.space);
+		m_context->stack() = snapshot.stack;
+	}
+
+	template<class CellT, int Dimensions>
+	std::size_t Stinkhorn<CellT, Dimensions>::Thread::speculate(std::size_t ticks, AccessLog& log) {
+		//MODE's hover and switch modes change what the arrows and brackets do.
+		if(m_context->hoverMode() || m_context->switchMode())
+			return 0;
+
+		Cursor& cr = m_context->cursor();
+		bool befunge93 = owner.isBefunge93();
+		cr.log(&log);
+
+		std::size_t done = 0;
+		while(done < ticks) {
+			CellT c = cr.currentCharacter();
+			if(!m_context->stringMode() && !isSpeculative(c, befunge93))
+				break;
+
+			advance();
+			++done;
+		}
+
+		cr.log(0);
+		return done;
+	}
+
+	template<class CellT, int Dimensions>
+	bool Stinkhorn<CellT, Dimensions>::Thread::unobserved() {
+		StackStackT& stack = m_context->stack();
+		return owner.singleThreaded() && !stack.invertMode() && !stack.queueMode() && !m_context->hoverMode();
+	}
+
 	template<class CellT, int Dimensions>
 	bool Stinkhorn<CellT, Dimensions>::Thread::execute(CellT c) {
 		assert(m_context);
@@ -99,6 +732,19 @@ namespace stinkhorn {
 		return m_context->execute(c);
 	}
 
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Thread::park(int descriptor, bool writing) {
+		m_parked_on = descriptor;
+		m_parked_writing = writing;
+		m_flags |= ThreadTable::Parked;
+	}
+
+	template<class CellT, int Dimensions>
+	void Stinkhorn<CellT, Dimensions>::Thread::unpark() {
+		m_parked_on = -1;
+		m_flags &= ~ThreadTable::Parked;
+	}
+
 	template<class CellT, int Dimensions>
 	CellT Stinkhorn<CellT, Dimensions>::Thread::threadID() const {
 		return m_threadID;
@@ -125,4 +771,5 @@ namespace stinkhorn {
 	}
 }
 
+INSTANTIATE(class, ThreadTable);
 INSTANTIATE(class, Thread);
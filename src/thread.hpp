@@ -2,13 +2,100 @@
 #define B98_THREAD_HPP_INCLUDED
 
 #include "stinkhorn.hpp"
+#include "vector.hpp"
+#include "stack.hpp"
 
 #include <vector>
 #include <string>
 
 #include "boost/noncopyable.hpp"
+#include "boost/thread/mutex.hpp"
 
 namespace stinkhorn {
+	/**
+	 * Where the running IPs keep the state the scheduler looks at every tick:
+	 * each IP has a slot, and each field is an array indexed by it, so tick can
+	 * compare the positions and deltas of neighbouring IPs without going through
+	 * their Thread, Context and Cursor objects. The fields read every tick (the
+	 * cursor, the mode flags and the stack) are kept apart from those that
+	 * rarely are (the storage offset and the Thread itself).
+	 *
+	 * The arrays come in blocks which never move, so an IP's Cursor and Context
+	 * can hold references into its slot, and the lists of blocks have room for
+	 * MaxBlocks from the start, so looking a slot up never races with add.
+	 * add and remove reuse free slots, and lock so that --parallel workers can
+	 * spawn.
+	 */
+	template<class CellT, int Dimensions>
+	class Stinkhorn<CellT, Dimensions>::ThreadTable
+		: boost::noncopyable
+	{
+	public:
+		typedef std::size_t Slot;
+
+		//The bits of flags().
+		enum {
+			StringMode = 1, Space = 2, HoverMode = 4, SwitchMode = 8, Parked = 16
+		};
+
+		ThreadTable();
+		~ThreadTable();
+
+		//Gives thread a slot, starting at the origin moving east with no flags set.
+		Slot add(Thread* thread);
+		void remove(Slot slot);
+
+		Vector& position(Slot slot) { return hot(slot).position[slot % BlockSize]; }
+		Vector& direction(Slot slot) { return hot(slot).direction[slot % BlockSize]; }
+		Vector& pageAddress(Slot slot) { return hot(slot).page_address[slot % BlockSize]; }
+		TreePage*& page(Slot slot) { return hot(slot).page[slot % BlockSize]; }
+		unsigned& pageCopies(Slot slot) { return hot(slot).page_copies[slot % BlockSize]; }
+		unsigned char& flags(Slot slot) { return hot(slot).flags[slot % BlockSize]; }
+		StackStackT*& stack(Slot slot) { return hot(slot).stack[slot % BlockSize]; }
+
+		Vector& storageOffset(Slot slot) { return cold(slot).storage_offset[slot % BlockSize]; }
+		Thread*& thread(Slot slot) { return cold(slot).thread[slot % BlockSize]; }
+
+		//True if the IP in slot stands on the same cell as the one in leader, with
+		//the same delta, and would execute the instruction there in the same way.
+		bool beside(Slot slot, Slot leader);
+
+		//Moves the IP in slot to where the one in leader is, page and all.
+		void follow(Slot slot, Slot leader);
+
+		//Executes c, an instruction that only works on the stack, on the stacks of
+		//the IPs in [first, last), which must all be beside one another. The
+		//arithmetic is done a whole array of operands at a time.
+		void execute(CellT c, Slot const* first, Slot const* last);
+
+	private:
+		static const std::size_t BlockSize = 64, MaxBlocks = 1 << 20;
+
+		struct Hot {
+			Vector position[BlockSize], direction[BlockSize], page_address[BlockSize];
+			TreePage* page[BlockSize];
+			unsigned page_copies[BlockSize];
+			unsigned char flags[BlockSize];
+			StackStackT* stack[BlockSize];
+		};
+
+		struct Cold {
+			Vector storage_offset[BlockSize];
+			Thread* thread[BlockSize];
+		};
+
+		Hot& hot(Slot slot) { return *m_hot[slot / BlockSize]; }
+		Cold& cold(Slot slot) { return *m_cold[slot / BlockSize]; }
+
+		std::vector<Hot*> m_hot;
+		std::vector<Cold*> m_cold;
+		std::vector<Slot> m_free;
+		boost::mutex m_lock;
+
+		//execute's operands, kept to save allocating them every tick.
+		std::vector<CellT> m_a, m_b;
+	};
+
 	template<class CellT, int Dimensions>
 	class Stinkhorn<CellT, Dimensions>::Thread 
 		: boost::noncopyable 
@@ -22,15 +109,77 @@ namespace stinkhorn {
 		bool advance();
 		bool execute(CellT c);
 
+		//True if the IP is about to execute c, an instruction that only works on its
+		//own stack. IPs standing on the same cell with the same delta can then share
+		//the work of decoding it and finding the next cell, and execute it together
+		//(see ThreadTable).
+		bool stackOnlyInstruction(CellT& c);
+
+		//What save and restore keep: everything about the IP that the instructions
+		//speculate runs can change.
+		struct Snapshot {
+			Vector position, direction, storage_offset;
+			bool string_mode, space;
+			StackStackT stack;
+		};
+
+		void save(Snapshot& snapshot) const;
+		void restore(Snapshot const& snapshot);
+
+		//Runs up to ticks ticks, logging what the IP does to funge-space, but stops
+		//before any instruction that affects more than the IP and funge-space.
+		//Returns how many ticks it ran.
+		std::size_t speculate(std::size_t ticks, AccessLog& log);
+
+		//A parked IP is waiting for a descriptor to be ready before it executes
+		//the instruction it stands on (see Interpreter::park). Until then, the
+		//scheduler passes over it.
+		bool parked() const { return (m_flags & ThreadTable::Parked) != 0; }
+		int parkedOn() const { return m_parked_on; }
+		bool parkedForWriting() const { return m_parked_writing; }
+		void park(int descriptor, bool writing);
+		void unpark();
+
 		CellT threadID() const;
+
+		//Where the IP keeps its slot of the interpreter's ThreadTable.
+		ThreadTable& table() const { return m_table; }
+		typename ThreadTable::Slot slot() const { return m_slot; }
 	    
 		std::vector<std::string> const& includeDirectories() const;
 		Context& topContext() const;
 
 	private:
+		//Runs a stretch of stack arithmetic beginning with c, keeping the top of the
+		//stack in locals, and leaves the cursor on the first other instruction.
+		void runArithmetic(CellT c);
+
+		//Executes the _ or | c, and if it is the test of a loop that only does stack
+		//arithmetic and g and p, runs the whole loop without moving the cursor.
+		//Returns false if it stopped part-way round, with the cursor on the next
+		//instruction to execute.
+		bool runLoop(CellT c);
+
+		//Nobody can see what happens between ticks, and the stack and cursor work as
+		//usual (not in queue, invert or hover mode).
+		bool unobserved();
+
+	private:
+		Interpreter& owner;
+		ThreadTable& m_table;
+		typename ThreadTable::Slot m_slot;
+		unsigned char& m_flags;
+
 		CellT m_threadID;
 		Context* m_context;
-		Interpreter& owner;
+
+		//The last _ or | executed, and how many times in a row it has been.
+		Vector m_last_test;
+		int m_test_hits;
+
+		//What the IP is parked on, while it is.
+		int m_parked_on;
+		bool m_parked_writing;
 	};
 }
 
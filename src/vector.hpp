@@ -1,95 +1,163 @@
 #ifndef B98_VECTOR_HPP_INCLUDED
 #define B98_VECTOR_HPP_INCLUDED
 
-#include <iostream> 
+#include <iostream>
 
 namespace stinkhorn {
-	template<class T = int>
-	struct vector3 {
+	/**
+	 * The general (Trefunge) form of vectorN has three components. Befunge only
+	 * ever uses the z = 0 plane, so vectorN<T, 2> is specialised below to carry
+	 * just x and y; adding or comparing two of them then does 2D arithmetic, and
+	 * a whole vector fits in a single 64 or 128 bit register.
+	 **/
+	template<class T, int Dimensions = 3>
+	struct vectorN {
 		T x,y,z;
 
-		vector3():
+		vectorN():
 		x(), y(), z()
 		{}
 
-		vector3(T x, T y, T z):
+		vectorN(T x, T y, T z):
 		x(x), y(y), z(z)
 		{}
 
-		vector3<T> operator-() const {
-			return vector3<T>(-x,-y,-z);
+		vectorN<T, 3> operator-() const {
+			return vectorN<T, 3>(-x,-y,-z);
 		}
 
-		friend T dot(vector3<T> const& lhs, vector3<T> const& rhs) {
-			return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * lhs.z;
+		friend T dot(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
+			return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
 		}
 	};
 
+	//There is no z at all, so code shared with Trefunge reads it through getZ and
+	//setZ below, and writing to a 2D vector's z fails to compile.
 	template<class T>
-	vector3<T> operator +(vector3<T> const& lhs, vector3<T> const& rhs) {
-		return vector3<T>(lhs.x + rhs.x,
+	struct vectorN<T, 2> {
+		T x,y;
+
+		vectorN():
+		x(), y()
+		{}
+
+		vectorN(T x, T y):
+		x(x), y(y)
+		{}
+
+		//The z coordinate is dropped, since it can only ever be 0.
+		vectorN(T x, T y, T):
+		x(x), y(y)
+		{}
+
+		vectorN<T, 2> operator-() const {
+			return vectorN<T, 2>(-x,-y);
+		}
+
+		friend T dot(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+			return lhs.x * rhs.x + lhs.y * rhs.y;
+		}
+	};
+
+	///The z component, which is always 0 in a 2D vector.
+	template<class T>
+	T getZ(vectorN<T, 3> const& v) {
+		return v.z;
+	}
+
+	template<class T>
+	T getZ(vectorN<T, 2> const&) {
+		return T();
+	}
+
+	///Sets z, where there is one. A 2D vector's stays 0.
+	template<class T, class U>
+	void setZ(vectorN<T, 3>& v, U z) {
+		v.z = z;
+	}
+
+	template<class T, class U>
+	void setZ(vectorN<T, 2>&, U) {
+	}
+
+	///Returns true if lower <= point < upper in every dimension.
+	template<class T>
+	bool inside(vectorN<T, 3> const& point, vectorN<T, 3> const& lower, vectorN<T, 3> const& upper) {
+		return point.x >= lower.x && point.y >= lower.y && point.z >= lower.z &&
+			point.x < upper.x && point.y < upper.y && point.z < upper.z;
+	}
+
+	template<class T>
+	bool inside(vectorN<T, 2> const& point, vectorN<T, 2> const& lower, vectorN<T, 2> const& upper) {
+		return point.x >= lower.x && point.y >= lower.y &&
+			point.x < upper.x && point.y < upper.y;
+	}
+
+	template<class T>
+	vectorN<T, 3> operator +(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
+		return vectorN<T, 3>(lhs.x + rhs.x,
 			lhs.y + rhs.y,
 			lhs.z + rhs.z);
 	}
 
 	template<class T>
-	vector3<T> operator -(vector3<T> const& lhs, vector3<T> const& rhs) {
-		return vector3<T>(lhs.x - rhs.x,
+	vectorN<T, 3> operator -(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
+		return vectorN<T, 3>(lhs.x - rhs.x,
 			lhs.y - rhs.y,
 			lhs.z - rhs.z);
 	}
 
 	template<class T>
-	vector3<T> operator /(vector3<T> const& lhs, vector3<T> const& rhs) {
-		return vector3<T>(lhs.x / rhs.x,
+	vectorN<T, 3> operator /(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
+		return vectorN<T, 3>(lhs.x / rhs.x,
 			lhs.y / rhs.y,
 			lhs.z / rhs.z);
 	}
 
 	template<class T, class U>
-	vector3<T> operator /(vector3<T> const& lhs, U t) {
-		return vector3<T>(lhs.x / t,
+	vectorN<T, 3> operator /(vectorN<T, 3> const& lhs, U t) {
+		return vectorN<T, 3>(lhs.x / t,
 			lhs.y / t,
 			lhs.z / t);
 	}
 
 	template<class T>
-	vector3<T> operator >>(vector3<T> const& lhs, T bits) {
-		return vector3<T>(lhs.x >> bits,
+	vectorN<T, 3> operator >>(vectorN<T, 3> const& lhs, T bits) {
+		return vectorN<T, 3>(lhs.x >> bits,
 			lhs.y >> bits,
 			lhs.z >> bits);
 	}
 
 	template<class T>
-	vector3<T> operator &(vector3<T> const& lhs, T bitmask) {
-		return vector3<T>(lhs.x & bitmask,
+	vectorN<T, 3> operator &(vectorN<T, 3> const& lhs, T bitmask) {
+		return vectorN<T, 3>(lhs.x & bitmask,
 			lhs.y & bitmask,
 			lhs.z & bitmask);
 	}
 
 	template<class T>
-	vector3<T> operator *(vector3<T> const& lhs, vector3<T> const& rhs) {
-		return vector3<T>(lhs.x * rhs.x,
+	vectorN<T, 3> operator *(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
+		return vectorN<T, 3>(lhs.x * rhs.x,
 			lhs.y * rhs.y,
 			lhs.z * rhs.z);
 	}
 
 	template<class T>
-	vector3<T> operator *(vector3<T> const& lhs, T rhs) {
-		return vector3<T>(lhs.x * rhs,
+	vectorN<T, 3> operator *(vectorN<T, 3> const& lhs, T rhs) {
+		return vectorN<T, 3>(lhs.x * rhs,
 			lhs.y * rhs,
 			lhs.z * rhs);
 	}
 
 	template<class T>
-	vector3<T> operator *(T lhs, vector3<T> const& rhs) {
-		return vector3<T>(lhs * rhs.x,
+	vectorN<T, 3> operator *(T lhs, vectorN<T, 3> const& rhs) {
+		return vectorN<T, 3>(lhs * rhs.x,
 			lhs * rhs.y,
 			lhs * rhs.z);
 	}
 
 	template<class T>
-	vector3<T>& operator +=(vector3<T>& lhs, vector3<T> const& rhs) {
+	vectorN<T, 3>& operator +=(vectorN<T, 3>& lhs, vectorN<T, 3> const& rhs) {
 		lhs.x += rhs.x;
 		lhs.y += rhs.y;
 		lhs.z += rhs.z;
@@ -97,7 +165,7 @@ namespace stinkhorn {
 	}
 
 	template<class T>
-	vector3<T>& operator -=(vector3<T>& lhs, vector3<T> const& rhs) {
+	vectorN<T, 3>& operator -=(vectorN<T, 3>& lhs, vectorN<T, 3> const& rhs) {
 		lhs.x -= rhs.x;
 		lhs.y -= rhs.y;
 		lhs.z -= rhs.z;
@@ -105,7 +173,7 @@ namespace stinkhorn {
 	}
 
 	template<class T>
-	vector3<T>& operator /=(vector3<T>& lhs, vector3<T> const& rhs) {
+	vectorN<T, 3>& operator /=(vectorN<T, 3>& lhs, vectorN<T, 3> const& rhs) {
 		lhs.x /= rhs.x;
 		lhs.y /= rhs.y;
 		lhs.z /= rhs.z;
@@ -113,7 +181,7 @@ namespace stinkhorn {
 	}
 
 	template<class T>
-	vector3<T>& operator *=(vector3<T>& lhs, vector3<T> const& rhs) {
+	vectorN<T, 3>& operator *=(vectorN<T, 3>& lhs, vectorN<T, 3> const& rhs) {
 		lhs.x *= rhs.x;
 		lhs.y *= rhs.y;
 		lhs.z *= rhs.z;
@@ -121,7 +189,7 @@ namespace stinkhorn {
 	}
 
 	template<class T>
-	vector3<T>& operator >>=(vector3<T>& lhs, T bits) {
+	vectorN<T, 3>& operator >>=(vectorN<T, 3>& lhs, T bits) {
 		lhs.x >>= bits;
 		lhs.y >>= bits;
 		lhs.z >>= bits;
@@ -129,23 +197,130 @@ namespace stinkhorn {
 	}
 
 	template<class T>
-	bool operator ==(vector3<T> const& lhs, vector3<T> const& rhs) {
+	bool operator ==(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
 		return lhs.x == rhs.x &&
 			lhs.y == rhs.y &&
 			lhs.z == rhs.z;
 	}
 
 	template<class T>
-	bool operator !=(vector3<T> const& lhs, vector3<T> const& rhs) {
+	bool operator !=(vectorN<T, 3> const& lhs, vectorN<T, 3> const& rhs) {
 		return lhs.x != rhs.x ||
 			lhs.y != rhs.y ||
 			lhs.z != rhs.z;
 	}
 
 	template<class T, class CharT, class TraitsT>
-	std::basic_ostream<CharT, TraitsT>& operator << (std::basic_ostream<CharT, TraitsT>& ostr, vector3<T> const& v) {
+	std::basic_ostream<CharT, TraitsT>& operator << (std::basic_ostream<CharT, TraitsT>& ostr, vectorN<T, 3> const& v) {
 		return ostr << "{" << v.x << ", " << v.y << ", " << v.z << "}";
 	}
+
+	//2D forms of the above. These never touch a z component.
+	template<class T>
+	vectorN<T, 2> operator +(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+		return vectorN<T, 2>(lhs.x + rhs.x,
+			lhs.y + rhs.y);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator -(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+		return vectorN<T, 2>(lhs.x - rhs.x,
+			lhs.y - rhs.y);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator /(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+		return vectorN<T, 2>(lhs.x / rhs.x,
+			lhs.y / rhs.y);
+	}
+
+	template<class T, class U>
+	vectorN<T, 2> operator /(vectorN<T, 2> const& lhs, U t) {
+		return vectorN<T, 2>(lhs.x / t,
+			lhs.y / t);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator >>(vectorN<T, 2> const& lhs, T bits) {
+		return vectorN<T, 2>(lhs.x >> bits,
+			lhs.y >> bits);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator &(vectorN<T, 2> const& lhs, T bitmask) {
+		return vectorN<T, 2>(lhs.x & bitmask,
+			lhs.y & bitmask);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator *(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+		return vectorN<T, 2>(lhs.x * rhs.x,
+			lhs.y * rhs.y);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator *(vectorN<T, 2> const& lhs, T rhs) {
+		return vectorN<T, 2>(lhs.x * rhs,
+			lhs.y * rhs);
+	}
+
+	template<class T>
+	vectorN<T, 2> operator *(T lhs, vectorN<T, 2> const& rhs) {
+		return vectorN<T, 2>(lhs * rhs.x,
+			lhs * rhs.y);
+	}
+
+	template<class T>
+	vectorN<T, 2>& operator +=(vectorN<T, 2>& lhs, vectorN<T, 2> const& rhs) {
+		lhs.x += rhs.x;
+		lhs.y += rhs.y;
+		return lhs;
+	}
+
+	template<class T>
+	vectorN<T, 2>& operator -=(vectorN<T, 2>& lhs, vectorN<T, 2> const& rhs) {
+		lhs.x -= rhs.x;
+		lhs.y -= rhs.y;
+		return lhs;
+	}
+
+	template<class T>
+	vectorN<T, 2>& operator /=(vectorN<T, 2>& lhs, vectorN<T, 2> const& rhs) {
+		lhs.x /= rhs.x;
+		lhs.y /= rhs.y;
+		return lhs;
+	}
+
+	template<class T>
+	vectorN<T, 2>& operator *=(vectorN<T, 2>& lhs, vectorN<T, 2> const& rhs) {
+		lhs.x *= rhs.x;
+		lhs.y *= rhs.y;
+		return lhs;
+	}
+
+	template<class T>
+	vectorN<T, 2>& operator >>=(vectorN<T, 2>& lhs, T bits) {
+		lhs.x >>= bits;
+		lhs.y >>= bits;
+		return lhs;
+	}
+
+	template<class T>
+	bool operator ==(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+		return lhs.x == rhs.x &&
+			lhs.y == rhs.y;
+	}
+
+	template<class T>
+	bool operator !=(vectorN<T, 2> const& lhs, vectorN<T, 2> const& rhs) {
+		return lhs.x != rhs.x ||
+			lhs.y != rhs.y;
+	}
+
+	template<class T, class CharT, class TraitsT>
+	std::basic_ostream<CharT, TraitsT>& operator << (std::basic_ostream<CharT, TraitsT>& ostr, vectorN<T, 2> const& v) {
+		return ostr << "{" << v.x << ", " << v.y << "}";
+	}
 }
 
 #endif